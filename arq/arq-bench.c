@@ -0,0 +1,975 @@
+/*
+ * arq-bench.c
+ *
+ * Measure how well the ARQ schemes do over different networks.
+ * A server and a client session run in the same process over two
+ * loopback sockets, the server streams data from memory and the
+ * client receives it, much like snw-server -e and snw-client.
+ * The sockets are read and written here, the sessions are only
+ * given the datagrams and hand theirs back (arq_session_set_output()).
+ *
+ * Every combination of the settings given is run once, and a line
+ * of CSV is printed for each.
+ *
+ *   ./arq-bench -m sr,gbn -w 1,64 -s 1M,10M -l 0,0.01 -r 0,2
+ *
+ *   -m  modes, sr or gbn
+ *   -c  congestion control, none, reno or cubic
+ *   -p  pacing in Mbit/s, 0 for none or cwnd for one window per RTT
+ *   -f  forward error correction, k:m for m parity packets after
+ *       every k data packets (arq_session_set_fec()) or 0 for none
+ *   -M  most data in a packet, probed for (arq_session_set_mss())
+ *   -g  1 for UDP GSO and GRO, 0 for none
+ *   -k  1 for a CRC32C in every packet (arq_session_set_crc()), 0 for none
+ *   -w  windows
+ *   -b  batches
+ *   -a  ACK every so many packets (arq_session_set_delack())
+ *   -t  starting timeouts in ms (arq_session_set_timeout())
+ *   -s  amount of data, with an optional K or M suffix
+ *   -l  loss probability of every packet
+ *   -r  round trip times in ms, half of it added in each direction
+ *   -S  seed of the channel model (1)
+ *   -T  most seconds for a run (30), ok is 0 if it took longer
+ *   -W  only time the retransmit timers (arq_timer_add()), with so
+ *       many of them outstanding, instead of any transfers
+ *
+ * Loss and delay replace those of the channel model, everything
+ * else (jitter, duplication, reordering) comes from the environment
+ * as described in unreliable_sendto.h.
+ *
+ *   UNRELIABLE_REORDER=0.01 ./arq-bench -l 0.001 -r 10
+ *
+ * The columns are,
+ *
+ *   goodput_mbps      data received by the client per second
+ *   retransmit_ratio  re-sent data packets over all data packets sent
+ *   acks              ACK datagrams sent by the client
+ *   parity            parity packets sent by the server
+ *   recovered         data packets the client rebuilt from them
+ *   mss_used          data in a packet at the end, after probing
+ *   p50_us, p99_us    time from arq_session_send() of a packet on the
+ *                     server to arq_session_recv() on the client
+ *   cpu_ms            user and system time of the whole process,
+ *                     including the thread that delays packets
+ *   timeouts, fast    packets the server found lost by their timers
+ *                     and by the ACKs (fast retransmit)
+ *   rtt_avg_ms        of the RTTs the server measured
+ *
+ * With -W the columns are the nanoseconds per timer to add it, to
+ * cancel it and to expire it, as the wheel is moved on from one
+ * arq_wheel_next() to the next like a session does.
+ *
+ *   ./arq-bench -W 1000,100000,1000000
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unreliable_sendto.h"
+#include "arq.h"
+
+#define MAX_LIST 32
+
+/* room for a datagram read with GRO, a run of segments */
+#define RX_SZ 65536
+
+/* socket buffers, a window of large packets must fit (net.core.rmem_max) */
+#define SOCK_BUF (4 * 1024 * 1024)
+
+struct list {
+	int n;
+	double v[MAX_LIST];
+};
+
+struct config {
+	int mode;
+	const struct arq_cc *cc;
+	double pacing;		/* bytes per second */
+	int fec_k;
+	int fec_m;
+	int mss;
+	int offload;		/* GSO and GRO */
+	int crc;
+	int window;
+	int batch;
+	int delack;
+	double timeout;
+	size_t size;
+	double loss;
+	double rtt;
+};
+
+struct result {
+	int ok;
+	double seconds;
+	unsigned long packets;
+	unsigned long resent;
+	unsigned long acks;
+	unsigned long parity;
+	unsigned long recovered;
+	int mss_used;
+	double p50;
+	double p99;
+	double cpu_ms;
+	unsigned long timeouts;
+	unsigned long fast;
+	double rtt_avg;
+};
+
+/* the server side, sends 'size' bytes once it gets a request */
+enum {
+	S_REQUEST,
+	S_DATA,
+	S_EOF,
+	S_CLOSE
+};
+
+struct endpoint {
+	int sockfd;
+	char *rx;		/* ARQ_MAX_BATCH datagrams of RX_SZ */
+	struct arq_session *sess;
+};
+
+static struct unreliable_channel channel;
+static double limit_s = 30;
+
+void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-m modes] [-c ccs] [-p pacings] [-f fecs] [-M msss] [-g offloads] [-k crcs]"
+			" [-w windows] [-b batches]"
+			" [-a acks] [-t timeouts] [-s sizes] [-l losses] [-r rtts]"
+			" [-S seed] [-T seconds] [-W timers]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/* a comma separated list of numbers, sizes may end in K or M */
+static int parse_list(char *arg, struct list *l, int size) {
+	char *tok, *end;
+	double v;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+
+		v = strtod(tok, &end);
+		if (end == tok)
+			return -1;
+		if (size && ('K' == *end || 'k' == *end)) {
+			v *= 1024;
+			end++;
+		} else if (size && ('M' == *end || 'm' == *end)) {
+			v *= 1024 * 1024;
+			end++;
+		}
+		if (*end != '\0' || v < 0)
+			return -1;
+
+		l->v[l->n++] = v;
+	}
+
+	return l->n ? 0 : -1;
+}
+
+/* congestion control by name, their index in 'ccs' */
+static const struct arq_cc *ccs[] = { NULL, &arq_cc_reno, &arq_cc_cubic };
+
+static int parse_ccs(char *arg, struct list *l) {
+	char *tok;
+	int i;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+
+		for (i = 1; i < 3; i++) {
+			if (0 == strcmp(tok, ccs[i]->name))
+				break;
+		}
+		if (3 == i && strcmp(tok, "none"))
+			return -1;
+
+		l->v[l->n++] = (3 == i) ? 0 : i;
+	}
+
+	return l->n ? 0 : -1;
+}
+
+/* pacing in Mbit/s, or cwnd */
+static int parse_pacing(char *arg, struct list *l) {
+	char *tok, *end;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+
+		if (0 == strcmp(tok, "cwnd")) {
+			l->v[l->n++] = ARQ_PACE_CWND;
+			continue;
+		}
+
+		l->v[l->n] = strtod(tok, &end) * 1e6 / 8;
+		if (end == tok || *end != '\0' || l->v[l->n] < 0)
+			return -1;
+		l->n++;
+	}
+
+	return l->n ? 0 : -1;
+}
+
+/* k:m or 0, kept as k * 256 + m */
+static int parse_fec(char *arg, struct list *l) {
+	char *tok, *end;
+	long k, m;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+
+		k = strtol(tok, &end, 10);
+		m = k ? 1 : 0;
+		if (':' == *end)
+			m = strtol(end + 1, &end, 10);
+		if (end == tok || *end != '\0' || k < 0 || k > FEC_MAX_K
+				|| m < 0 || m > FEC_MAX_M || (k && 0 == m))
+			return -1;
+
+		l->v[l->n++] = k * 256 + m;
+	}
+
+	return l->n ? 0 : -1;
+}
+
+static int parse_modes(char *arg, struct list *l) {
+	char *tok;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+
+		if (0 == strcmp(tok, "sr"))
+			l->v[l->n++] = ARQ_SR;
+		else if (0 == strcmp(tok, "gbn"))
+			l->v[l->n++] = ARQ_GBN;
+		else
+			return -1;
+	}
+
+	return l->n ? 0 : -1;
+}
+
+static double ts_ms(const struct timespec *ts) {
+	return ts->tv_sec * 1e3 + ts->tv_nsec / 1e6;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double cpu_ms(void) {
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+/* xorshift, the same numbers every time */
+static uint32_t bench_rand(uint32_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+/*
+ * Time the timers of 'n' packets in flight, with timeouts up to
+ * 65536 ticks (about 1.3 s) so that they spread over three levels.
+ * Half of them are cancelled, as by their ACKs, and the rest expire.
+ */
+static int timer_bench(int n, double *add_ns, double *cancel_ns,
+		double *expire_ns) {
+	struct arq_wheel *w;
+	struct arq_timer *t, *e;
+	uint64_t start, tick;
+	uint32_t x = 1;
+	int i, expired = 0;
+
+	w = malloc(sizeof(*w));
+	t = calloc(n, sizeof(*t));
+	if (NULL == w || NULL == t) {
+		free(w);
+		free(t);
+		return -1;
+	}
+	arq_wheel_init(w, 0);
+
+	start = now_ns();
+	for (i = 0; i < n; i++)
+		arq_timer_add(w, &t[i], 1 + bench_rand(&x) % 65536);
+	*add_ns = (double) (now_ns() - start) / n;
+
+	start = now_ns();
+	for (i = 0; i < n; i += 2)
+		arq_timer_del(w, &t[i]);
+	*cancel_ns = (double) (now_ns() - start) / ((n + 1) / 2);
+
+	start = now_ns();
+	while (arq_wheel_next(w, &tick)) {
+		for (e = arq_wheel_expire(w, tick); e; e = e->next)
+			expired++;
+	}
+	*expire_ns = (double) (now_ns() - start) / (expired ? expired : 1);
+
+	free(w);
+	free(t);
+
+	return expired == n / 2 ? 0 : -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* the byte of the data stream at 'off' */
+static unsigned char pattern(size_t off) {
+	return (off * 7 + (off >> 11)) & 0xff;
+}
+
+/*
+ * A packet of data starts with the time it was given to
+ * arq_session_send(), the rest is a pattern that can be checked.
+ */
+static size_t fill(char *buf, size_t off, size_t len) {
+	uint64_t ns;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = pattern(off + i);
+
+	if (len >= sizeof(ns)) {
+		ns = now_ns();
+		memcpy(buf, &ns, sizeof(ns));
+	}
+
+	return len;
+}
+
+static int endpoint_open(struct endpoint *e, struct sockaddr_in *addr) {
+	socklen_t len = sizeof(*addr);
+	int buf = SOCK_BUF;
+
+	e->rx = malloc(ARQ_MAX_BATCH * RX_SZ);
+	if (NULL == e->rx)
+		return -1;
+
+	e->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (-1 == e->sockfd)
+		return -1;
+
+	if (-1 == setsockopt(e->sockfd, SOL_SOCKET, SO_RCVBUF,
+				&buf, sizeof(buf))
+			|| -1 == setsockopt(e->sockfd, SOL_SOCKET, SO_SNDBUF,
+				&buf, sizeof(buf)))
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr->sin_port = 0;
+	if (-1 == bind(e->sockfd, (struct sockaddr *) addr, sizeof(*addr)))
+		return -1;
+
+	return getsockname(e->sockfd, (struct sockaddr *) addr, &len);
+}
+
+/*
+ * Give everything that is waiting on the socket to the session.
+ * With GRO a datagram may be a run of segments of the same size.
+ */
+static int endpoint_drain(struct endpoint *e) {
+	struct sockaddr_in addrs[ARQ_MAX_BATCH];
+	struct mmsghdr msgs[ARQ_MAX_BATCH];
+	struct iovec iov[ARQ_MAX_BATCH];
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		size_t align;
+	} ctl[ARQ_MAX_BATCH];
+	struct cmsghdr *cmsg;
+	int seg, len, off;
+	int i, k;
+
+	do {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < ARQ_MAX_BATCH; i++) {
+			iov[i].iov_base = e->rx + i * RX_SZ;
+			iov[i].iov_len = RX_SZ;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctl[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctl[i].buf);
+		}
+
+		k = recvmmsg(e->sockfd, msgs, ARQ_MAX_BATCH, MSG_DONTWAIT, NULL);
+		if (-1 == k) {
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				return 0;
+			/* an ICMP error from a packet of an earlier run */
+			if (ECONNREFUSED == errno)
+				continue;
+			return -1;
+		}
+
+		for (i = 0; i < k; i++) {
+			len = seg = msgs[i].msg_len;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+					cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				if (SOL_UDP == cmsg->cmsg_level
+						&& UDP_GRO == cmsg->cmsg_type)
+					memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+			}
+			if (seg <= 0)
+				seg = len;
+
+			for (off = 0; off < len; off += seg) {
+				if (-1 == arq_session_input(e->sess,
+						e->rx + i * RX_SZ + off,
+						MIN(seg, len - off),
+						(struct sockaddr *) &addrs[i],
+						msgs[i].msg_hdr.msg_namelen))
+					return -1;
+			}
+		}
+	} while (k == ARQ_MAX_BATCH);
+
+	return 0;
+}
+
+/* the datagrams of the session of 'e', sent on its socket */
+static int endpoint_output(void *arg, struct mmsghdr *msgs, unsigned int n) {
+	struct endpoint *e = arg;
+
+	return unreliable_sendmmsg(e->sockfd, msgs, n, MSG_DONTWAIT);
+}
+
+/* re-send on 'e' if its timer has expired, and keep the earliest timer */
+static int endpoint_expire(struct endpoint *e, struct timespec *next) {
+	struct timespec ts, now;
+
+	if (!arq_session_deadline(e->sess, &ts))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_ms(&ts) <= ts_ms(&now)) {
+		/* a give up only starts the resends over */
+		if (-1 == arq_session_expire(e->sess))
+			return -1;
+		if (!arq_session_deadline(e->sess, &ts))
+			return 0;
+	}
+
+	if (0 == next->tv_sec || ts_ms(&ts) < ts_ms(next))
+		*next = ts;
+
+	return 0;
+}
+
+static int endpoint_setup(struct endpoint *e, const struct config *c) {
+	int probe = IP_PMTUDISC_PROBE;
+	int on = 1;
+
+	/* the endpoint reads the socket, it takes the runs apart */
+	if (c->offload && -1 == setsockopt(e->sockfd, SOL_UDP, UDP_GRO,
+				&on, sizeof(on)))
+		return -1;
+
+	/* and writes it, so it is also up to it to let probes through */
+	if (c->mss > DATA_SZ && -1 == setsockopt(e->sockfd, IPPROTO_IP,
+				IP_MTU_DISCOVER, &probe, sizeof(probe)))
+		return -1;
+	arq_session_set_output(e->sess, endpoint_output, e);
+
+	if (-1 == arq_session_set_window(e->sess, c->window)
+			|| -1 == arq_session_set_mode(e->sess, c->mode)
+			|| -1 == arq_session_set_batch(e->sess, c->batch)
+			|| -1 == arq_session_set_timeout(e->sess, c->timeout)
+			|| -1 == arq_session_set_delack(e->sess, c->delack,
+				ACK_DELAY_MS)
+			|| -1 == arq_session_set_mss(e->sess, c->mss, 1)
+			|| -1 == arq_session_set_offload(e->sess,
+				c->offload ? ARQ_GSO : 0)
+			|| -1 == arq_session_set_crc(e->sess, c->crc))
+		return -1;
+	arq_session_set_cc(e->sess, c->cc);
+	if (-1 == arq_session_set_pacing(e->sess, c->pacing))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * run()
+ *
+ * Transfer 'c->size' bytes from a server to a client session.
+ *
+ * Returns: 0 with the result, or -1 on error with errno set.
+ */
+static int run(const struct config *c, struct result *r) {
+	struct endpoint srv, cli;
+	struct sockaddr_in srv_addr, cli_addr;
+	struct unreliable_channel ch;
+	struct arq_stats st;
+	struct pollfd fds[2];
+	struct timespec next, now, wait;
+	static char buf[ARQ_MAX_MSS];
+	double *lat = NULL;
+	size_t nlat = 0;
+	size_t sent = 0, recvd = 0, len;
+	uint64_t start, ns;
+	double cpu, left;
+	int state = S_REQUEST;
+	int done = 0;
+	int ret = -1;
+	int n;
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+	memset(&srv, 0, sizeof(srv));
+	memset(&cli, 0, sizeof(cli));
+	srv.sockfd = cli.sockfd = -1;
+
+	ch = channel;
+	ch.periodic = 0;
+	ch.loss = c->loss;
+	ch.delay_ms = c->rtt / 2;
+	if (-1 == unreliable_set_channel(&ch))
+		return -1;
+
+	lat = malloc((c->size / MAXDATA + 1) * sizeof(*lat));
+	if (NULL == lat)
+		return -1;
+
+	if (-1 == endpoint_open(&srv, &srv_addr)
+			|| -1 == endpoint_open(&cli, &cli_addr))
+		goto out;
+
+	srv.sess = arq_session_new(-1, NULL, 0);
+	cli.sess = arq_session_new(-1, (struct sockaddr *) &srv_addr,
+			sizeof(srv_addr));
+	if (NULL == srv.sess || NULL == cli.sess)
+		goto out;
+	if (-1 == endpoint_setup(&srv, c) || -1 == endpoint_setup(&cli, c))
+		goto out;
+	if (-1 == arq_session_set_fec(srv.sess, c->fec_k, c->fec_m))
+		goto out;
+
+	fds[0].fd = srv.sockfd;
+	fds[1].fd = cli.sockfd;
+	fds[0].events = fds[1].events = POLLIN;
+
+	cpu = cpu_ms();
+	start = now_ns();
+
+	/* the request, the server only waits for one packet */
+	if (-1 == arq_session_send(cli.sess, "data", 5, MSG_DONTWAIT))
+		goto out;
+
+	for (;;) {
+		/* server, as far as it can go without waiting */
+		for (n = 0; -1 != n; ) {
+			switch (state) {
+			case S_REQUEST:
+				n = arq_session_recv(srv.sess, buf, sizeof(buf),
+						MSG_DONTWAIT);
+				if (-1 != n)
+					state = S_DATA;
+				break;
+
+			case S_DATA:
+				if (sent == c->size) {
+					state = S_EOF;
+					break;
+				}
+				len = fill(buf, sent, MIN(c->size - sent,
+						(size_t) arq_session_mss(srv.sess)));
+				n = arq_session_send(srv.sess, buf, len,
+						MSG_DONTWAIT);
+				if (-1 != n)
+					sent += n;
+				break;
+
+			case S_EOF:
+				n = arq_session_send(srv.sess, NULL, 0,
+						MSG_DONTWAIT);
+				if (-1 != n)
+					state = S_CLOSE;
+				break;
+
+			case S_CLOSE:
+				if (-1 == arq_session_flush(srv.sess))
+					goto out;
+				n = -1;
+				errno = EAGAIN;
+				break;
+			}
+		}
+		if (EAGAIN != errno)
+			goto out;
+
+		/* client, everything that has arrived in order */
+		while (!done) {
+			n = arq_session_recv(cli.sess, buf, sizeof(buf),
+					MSG_DONTWAIT);
+			if (-1 == n) {
+				if (EAGAIN != errno)
+					goto out;
+				break;
+			}
+
+			if (0 == n) {
+				r->seconds = (now_ns() - start) / 1e9;
+				done = 1;
+				break;
+			}
+
+			if ((size_t) n >= sizeof(ns)) {
+				memcpy(&ns, buf, sizeof(ns));
+				lat[nlat++] = (now_ns() - ns) / 1e3;
+				for (i = 0; i < sizeof(ns); i++)
+					buf[i] = pattern(recvd + i);
+			}
+			for (i = 0; i < (size_t) n; i++) {
+				if (buf[i] != (char) pattern(recvd + i)) {
+					fprintf(stderr, "corrupt data at %zu\n",
+							recvd + i);
+					goto out;
+				}
+			}
+			recvd += n;
+		}
+
+		/* the client ACKs the EOF, the server must hear it */
+		if (done && S_CLOSE == state && 0 == arq_session_pending(srv.sess))
+			break;
+
+		if ((now_ns() - start) / 1e9 > limit_s)
+			break;
+
+		memset(&next, 0, sizeof(next));
+		if (-1 == endpoint_expire(&srv, &next)
+				|| -1 == endpoint_expire(&cli, &next))
+			goto out;
+
+		/* wait for a packet, the next timer or to check the limit */
+		left = 100;
+		if (next.tv_sec) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = MIN(left, ts_ms(&next) - ts_ms(&now));
+		}
+		if (left < 0)
+			left = 0;
+		wait.tv_sec = left / 1000;
+		wait.tv_nsec = (left - wait.tv_sec * 1000) * 1e6;
+
+		n = ppoll(fds, 2, &wait, NULL);
+		if (-1 == n) {
+			if (EINTR == errno)
+				continue;
+			goto out;
+		}
+
+		if (-1 == endpoint_drain(&srv) || -1 == endpoint_drain(&cli))
+			goto out;
+	}
+
+	r->ok = done && recvd == c->size;
+	if (!done)
+		r->seconds = (now_ns() - start) / 1e9;
+	r->cpu_ms = cpu_ms() - cpu;
+
+	arq_session_stats(srv.sess, &st);
+	r->packets = st.packets_sent;
+	r->resent = st.packets_resent;
+	r->parity = st.fec_sent;
+	r->mss_used = arq_session_mss(srv.sess);
+	r->timeouts = st.timeouts;
+	r->fast = st.fast_resends;
+	r->rtt_avg = st.rtt_avg_ms;
+	arq_session_stats(cli.sess, &st);
+	r->acks = st.acks_sent;
+	r->recovered = st.fec_recovered;
+
+	if (nlat) {
+		qsort(lat, nlat, sizeof(*lat), cmp_double);
+		r->p50 = lat[nlat / 2];
+		r->p99 = lat[(nlat * 99) / 100];
+	}
+
+	ret = 0;
+out:
+	/* let the packets still being delayed go before the sockets */
+	if (c->rtt > 0 || ch.reorder > 0)
+		usleep((c->rtt / 2 + ch.jitter_ms + ch.reorder_ms) * 1000 + 1000);
+
+	if (srv.sess)
+		arq_session_free(srv.sess);
+	if (cli.sess)
+		arq_session_free(cli.sess);
+	if (srv.sockfd != -1)
+		close(srv.sockfd);
+	if (cli.sockfd != -1)
+		close(cli.sockfd);
+	free(srv.rx);
+	free(cli.rx);
+	free(lat);
+
+	return ret;
+}
+
+int main(int argc, char* argv[]) {
+	struct list timers;
+	struct list modes, ccs_l, pacings, fecs, msss, offloads, crcs, windows, batches, delacks, timeouts, sizes, losses, rtts;
+	struct config c;
+	struct result r;
+	char pacing[32];
+	char fec[32];
+	int im, ic, ip, iff, iM, ig, ik, iw, ib, ia, it, is, il, ir, i;
+	double add_ns, cancel_ns, expire_ns;
+	int opt;
+
+	/* a small sweep by default */
+	timers.n = 0;
+	modes.n = 1;
+	modes.v[0] = ARQ_SR;
+	ccs_l.n = 1;
+	ccs_l.v[0] = 0;
+	pacings.n = 1;
+	pacings.v[0] = 0;
+	fecs.n = 1;
+	fecs.v[0] = 0;
+	msss.n = 1;
+	msss.v[0] = DATA_SZ;
+	offloads.n = 1;
+	offloads.v[0] = 0;
+	crcs.n = 1;
+	crcs.v[0] = 0;
+	windows.n = 2;
+	windows.v[0] = 1;
+	windows.v[1] = 64;
+	batches.n = 1;
+	batches.v[0] = 1;
+	delacks.n = 1;
+	delacks.v[0] = 1;
+	timeouts.n = 1;
+	timeouts.v[0] = TIMEOUT_MS;
+	sizes.n = 1;
+	sizes.v[0] = 1024 * 1024;
+	losses.n = 2;
+	losses.v[0] = 0;
+	losses.v[1] = 0.01;
+	rtts.n = 2;
+	rtts.v[0] = 0;
+	rtts.v[1] = 2;
+
+	unreliable_get_channel(&channel);
+
+	while ((opt = getopt(argc, argv, "m:c:p:f:M:g:k:w:b:a:t:s:l:r:S:T:W:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (-1 == parse_modes(optarg, &modes))
+				usage(argv[0]);
+			break;
+		case 'c':
+			if (-1 == parse_ccs(optarg, &ccs_l))
+				usage(argv[0]);
+			break;
+		case 'p':
+			if (-1 == parse_pacing(optarg, &pacings))
+				usage(argv[0]);
+			break;
+		case 'f':
+			if (-1 == parse_fec(optarg, &fecs))
+				usage(argv[0]);
+			break;
+		case 'M':
+			if (-1 == parse_list(optarg, &msss, 1))
+				usage(argv[0]);
+			break;
+		case 'g':
+			if (-1 == parse_list(optarg, &offloads, 0))
+				usage(argv[0]);
+			break;
+		case 'k':
+			if (-1 == parse_list(optarg, &crcs, 0))
+				usage(argv[0]);
+			break;
+		case 'w':
+			if (-1 == parse_list(optarg, &windows, 0))
+				usage(argv[0]);
+			break;
+		case 'b':
+			if (-1 == parse_list(optarg, &batches, 0))
+				usage(argv[0]);
+			break;
+		case 'a':
+			if (-1 == parse_list(optarg, &delacks, 0))
+				usage(argv[0]);
+			break;
+		case 't':
+			if (-1 == parse_list(optarg, &timeouts, 0))
+				usage(argv[0]);
+			break;
+		case 's':
+			if (-1 == parse_list(optarg, &sizes, 1))
+				usage(argv[0]);
+			break;
+		case 'l':
+			if (-1 == parse_list(optarg, &losses, 0))
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (-1 == parse_list(optarg, &rtts, 0))
+				usage(argv[0]);
+			break;
+		case 'S':
+			channel.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			limit_s = atof(optarg);
+			break;
+		case 'W':
+			if (-1 == parse_list(optarg, &timers, 1))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+	for (iM = 0; iM < msss.n; iM++) {
+		if (msss.v[iM] < DATA_SZ || msss.v[iM] > ARQ_MAX_MSS)
+			usage(argv[0]);
+	}
+
+	if (timers.n) {
+		printf("timers,add_ns,cancel_ns,expire_ns\n");
+		for (i = 0; i < timers.n; i++) {
+			if (timers.v[i] < 2
+					|| -1 == timer_bench(timers.v[i], &add_ns,
+						&cancel_ns, &expire_ns)) {
+				fprintf(stderr, "timer_bench failed\n");
+				exit(EXIT_FAILURE);
+			}
+			printf("%.0f,%.1f,%.1f,%.1f\n", timers.v[i],
+					add_ns, cancel_ns, expire_ns);
+		}
+		return 0;
+	}
+
+	/* a packet to a socket of an earlier run must not end this one */
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("mode,cc,pacing,fec,mss,offload,crc,window,batch,ack_every,timeout_ms,size,loss,rtt_ms,ok,"
+			"seconds,goodput_mbps,packets,resent,retransmit_ratio,acks,"
+			"parity,recovered,mss_used,p50_us,p99_us,cpu_ms,"
+			"timeouts,fast,rtt_avg_ms\n");
+
+	for (im = 0; im < modes.n; im++)
+	for (ic = 0; ic < ccs_l.n; ic++)
+	for (ip = 0; ip < pacings.n; ip++)
+	for (iff = 0; iff < fecs.n; iff++)
+	for (iM = 0; iM < msss.n; iM++)
+	for (ig = 0; ig < offloads.n; ig++)
+	for (ik = 0; ik < crcs.n; ik++)
+	for (iw = 0; iw < windows.n; iw++)
+	for (ib = 0; ib < batches.n; ib++)
+	for (ia = 0; ia < delacks.n; ia++)
+	for (it = 0; it < timeouts.n; it++)
+	for (is = 0; is < sizes.n; is++)
+	for (il = 0; il < losses.n; il++)
+	for (ir = 0; ir < rtts.n; ir++) {
+		c.mode = modes.v[im];
+		c.cc = ccs[(int) ccs_l.v[ic]];
+		c.pacing = pacings.v[ip];
+		c.fec_k = (int) fecs.v[iff] / 256;
+		c.fec_m = (int) fecs.v[iff] % 256;
+		c.mss = msss.v[iM];
+		c.offload = (0 != offloads.v[ig]);
+		c.crc = (0 != crcs.v[ik]);
+		c.window = windows.v[iw];
+		c.batch = batches.v[ib];
+		c.delack = delacks.v[ia];
+		c.timeout = timeouts.v[it];
+		c.size = sizes.v[is];
+		c.loss = losses.v[il];
+		c.rtt = rtts.v[ir];
+
+		if (-1 == run(&c, &r)) {
+			perror("run");
+			exit(EXIT_FAILURE);
+		}
+
+		if (ARQ_PACE_CWND == c.pacing)
+			snprintf(pacing, sizeof(pacing), "cwnd");
+		else
+			snprintf(pacing, sizeof(pacing), "%g",
+					c.pacing * 8 / 1e6);
+		if (c.fec_k)
+			snprintf(fec, sizeof(fec), "%d:%d", c.fec_k, c.fec_m);
+		else
+			snprintf(fec, sizeof(fec), "0");
+
+		printf("%s,%s,%s,%s,%d,%d,%d,%d,%d,%d,%g,%zu,%g,%g,%d,%.3f,%.2f,%lu,%lu,%.4f,%lu,"
+				"%lu,%lu,%d,%.0f,%.0f,%.0f,%lu,%lu,%.3f\n",
+				(ARQ_GBN == c.mode) ? "gbn" : "sr",
+				c.cc ? c.cc->name : "none", pacing, fec,
+				c.mss, c.offload, c.crc, c.window, c.batch, c.delack, c.timeout, c.size,
+				c.loss, c.rtt, r.ok, r.seconds,
+				(r.seconds > 0) ? r.ok * c.size * 8 / r.seconds / 1e6 : 0,
+				r.packets, r.resent,
+				r.packets ? (double) r.resent / r.packets : 0,
+				r.acks, r.parity, r.recovered, r.mss_used,
+				r.p50, r.p99, r.cpu_ms,
+				r.timeouts, r.fast, r.rtt_avg);
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/*
+ * arq-trace.c
+ *
+ * Print the binary event trace of ARQ sessions (arq_session_set_events(),
+ * snw-server -E, snw-client -E) as CSV, one line for each event.
+ *
+ *   ./arq-trace events.bin > events.csv
+ *
+ * The columns are,
+ *
+ *   us        time since the first event in the file
+ *   session   which session it belongs to, numbered as they are created
+ *   event     send, resend, timeout, fast, giveup, ack, dupack, rtt,
+ *             recv, ack_sent or crc
+ *   seq       sequence number of the packet, or the one ACKed
+ *   arg       depends on the event (see ARQ_EV_* in arq.h), such as
+ *             the transmission number of a copy or an RTT in us
+ *   len       data in the packet
+ *
+ * With no file, or "-", the trace is read from the standard input.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arq.h"
+
+static const char *names[] = {
+	[ARQ_EV_SEND] = "send",
+	[ARQ_EV_RESEND] = "resend",
+	[ARQ_EV_TIMEOUT] = "timeout",
+	[ARQ_EV_FAST] = "fast",
+	[ARQ_EV_GIVEUP] = "giveup",
+	[ARQ_EV_ACK] = "ack",
+	[ARQ_EV_DUPACK] = "dupack",
+	[ARQ_EV_RTT] = "rtt",
+	[ARQ_EV_RECV] = "recv",
+	[ARQ_EV_ACK_SENT] = "ack_sent",
+	[ARQ_EV_CRC] = "crc"
+};
+
+#define NAMES (sizeof(names) / sizeof(names[0]))
+
+void usage(char *prog) {
+	fprintf(stderr, "usage: %s [trace file]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+	struct arq_event ev[ARQ_EV_BUF];
+	uint64_t first = 0;
+	FILE *fp = stdin;
+	size_t n, i;
+	int started = 0;
+
+	if (argc > 2)
+		usage(argv[0]);
+	if (2 == argc && strcmp(argv[1], "-")) {
+		fp = fopen(argv[1], "rb");
+		if (NULL == fp) {
+			perror(argv[1]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("us,session,event,seq,arg,len\n");
+
+	while ((n = fread(ev, sizeof(ev[0]), ARQ_EV_BUF, fp)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (!started) {
+				first = ev[i].us;
+				started = 1;
+			}
+
+			/* blocks of other sessions may be a little older */
+			printf("%lld,%u,", (long long) (ev[i].us - first),
+					ev[i].session);
+			if (ev[i].type < NAMES && names[ev[i].type])
+				printf("%s", names[ev[i].type]);
+			else
+				printf("%u", ev[i].type);
+			printf(",%u,%u,%u\n", ev[i].seq, ev[i].arg, ev[i].len);
+		}
+	}
+
+	if (ferror(fp)) {
+		perror("fread");
+		exit(EXIT_FAILURE);
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	return 0;
+}
@@ -1,4 +1,14 @@
 
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include "arq.h"
 
 /*
@@ -83,162 +93,3143 @@
  *      |                      |        ACK accepted.
  *      |                      |
  *
+ *
+ *        Selective Repeat (window 3)
+ *        ---------------------------
+ *
+ * arq_recvfrom            arq_sendto
+ *      |                      |
+ *      |         data:0       |
+ *      |<---------------------+      Up to 'window' packets
+ *      |         data:1       |        are sent without
+ *      |     X<---------------+        waiting for an ACK.
+ *      |         data:2       |
+ *      |<---------------------+      Out of order, data:2 is
+ *      |                      |        buffered until data:1
+ *      |          ACK:0       |        arrives.
+ *      +--------------------->|      Window slides to 1.
+ *      |         data:3       |
+ *      |<---------------------+
+ *      |          ACK:2       |
+ *      +--------------------->|      Window stays at 1.
+ *      |          ACK:3       |
+ *      +--------------------->|
+ *      |                      |
+ *      |                  (timeout)  Only data:1 is re-sent.
+ *      |         data:1       |
+ *      |<---------------------+      data:1, data:2 and data:3
+ *      |                      |        are returned in order.
+ *      |          ACK:1       |
+ *      +--------------------->|      Window slides to 4.
+ *      |                      |
+ *
+ *         Go-Back-N (window 3)
+ *         --------------------
+ *
+ * arq_recvfrom            arq_sendto
+ *      |                      |
+ *      |         data:0       |
+ *      |<---------------------+
+ *      |         data:1       |
+ *      |     X<---------------+
+ *      |         data:2       |
+ *      |<---------------------+      Out of order, discarded.
+ *      |                      |
+ *      |         CACK:0       |
+ *      +--------------------->|      Everything up to 0.
+ *      |         CACK:0       |
+ *      +--------------------->|      Duplicate, ignored.
+ *      |         data:3       |
+ *      |<---------------------+      Discarded.
+ *      |         CACK:0       |
+ *      +--------------------->|
+ *      |                      |
+ *      |                  (timeout)  Go back and re-send
+ *      |         data:1       |        1, 2 and 3.
+ *      |<---------------------+
+ *      |         data:2       |
+ *      |<---------------------+
+ *      |         data:3       |
+ *      |<---------------------+
+ *      |         CACK:3       |
+ *      +--------------------->|      Window slides to 4.
+ *      |                      |
+ *
  */
 
-int seq = 0;
-int recv_seq = -1;
+enum {
+	SLOT_FREE,
+	SLOT_SENT,	/* sent, waiting for an ACK */
+	SLOT_ACKED,	/* ACKed, but not yet at the base of the window */
+	SLOT_FULL,	/* received out of order, waiting to be returned */
+	SLOT_HELD	/* new, held until a batch is sent */
+};
 
-void reset_seq() {
-	recv_seq = -1;
+struct arq_slot {
+	size_t len;		/* header + data */
+	unsigned char state;
+	unsigned char num_resend;
+	unsigned char resent;	/* ever re-sent, RTT is ambiguous */
+	unsigned char tx;	/* transmission number, never 0 */
+	unsigned char fast;	/* fast retransmitted since its last timer */
+	unsigned char fec_left;	/* packets after it in its FEC block */
+	struct timespec sent;
+	struct timespec first;	/* when the first copy was sent */
+	struct arq_timer timer;	/* retransmit, in the session's wheel */
+	const char *ref;	/* the data sent, if it is not copied
+				   into 'pkt' (arq_session_send_ref()) */
+	uint32_t crc;		/* of the data, with arq_session_set_crc() */
+	struct arq_packet pkt;	/* last, the data goes on to the end
+				   of the slot for larger packets */
+};
+
+#define SLOT_DATA(slot) ((slot)->ref ? (slot)->ref : (slot)->pkt.data)
+
+/* the slot of a retransmit timer */
+#define TIMER_SLOT(t) ((struct arq_slot *) ((char *) (t) \
+			- offsetof(struct arq_slot, timer)))
+
+/*
+ * A window of slots indexed by sequence number.  The number of
+ * slots is a power of 2 so that it divides the sequence space
+ * and the index can be found with a mask.
+ */
+struct arq_window {
+	uint16_t base;		/* oldest sequence number in the window */
+	uint16_t next;		/* next sequence number to send, or
+				   the first one not yet received */
+	int size;
+	unsigned int mask;
+	size_t stride;		/* bytes from one slot to the next */
+	char *slots;
+};
+
+#define SLOT(w, s) ((struct arq_slot *) ((w)->slots \
+			+ ((s) & (w)->mask) * (w)->stride))
+
+/* the packet 'i' of a buffer of them, 'pkt_sz' bytes apart */
+#define PKT(s, buf, i) ((struct arq_packet *) ((buf) + (i) * (s)->pkt_sz))
+
+/* parity packets kept by a receiver for blocks it can not rebuild yet */
+#define FEC_IN (2 * FEC_MAX_M)
+
+/*
+ * The most that one datagram given to UDP GSO may be split into, and
+ * the most that one read with UDP GRO may hold.
+ */
+#define GSO_MAX_SEGS 64
+#define GSO_MAX_SZ 65507
+#define GRO_SZ 65536
+
+/*
+ * The receive buffers of an io_uring take about URING_MEM bytes,
+ * between URING_BUFS_MIN and URING_BUFS_MAX of them, and so do the
+ * copies of the datagrams on their way out, at least a batch of them.
+ */
+#define URING_MEM (4 << 20)
+#define URING_BUFS_MIN 16
+#define URING_BUFS_MAX 1024
+
+/*
+ * The data sizes a lost probe falls back to, from the MTU of jumbo
+ * frames and of Ethernet less the IPv6 and UDP headers.
+ */
+static const int probe_ladder[] = {
+	9000 - 48 - HEADER_SZ - FEC_SZ - CRC_SZ,
+	1500 - 48 - HEADER_SZ - FEC_SZ - CRC_SZ
+};
+
+/* the zeros a probe is padded with */
+static const char probe_pad[FEC_SZ + ARQ_MAX_MSS + CRC_SZ];
+
+struct arq_session {
+	int sockfd;
+	int mode;
+
+	/* where datagrams go instead of the socket, if anywhere */
+	int (*output)(void *arg, struct mmsghdr *msgs, unsigned int n);
+	void *output_arg;
+
+	struct arq_window snd;
+	struct arq_window rcv;
+
+	/*
+	 * The retransmit timers of the packets in flight, in ticks of
+	 * TIMER_TICK_US from 'start'.
+	 */
+	struct arq_wheel wheel;
+
+	/*
+	 * New packets carry up to 'mss' bytes of data.  Every buffer is
+	 * made for 'mss_max', 'pkt_sz' bytes for a packet of that size
+	 * or its parity.
+	 */
+	int mss;
+	int mss_max;
+	size_t pkt_sz;
+
+	/*
+	 * Path MTU probing.  A probe for 'probe' bytes of data (0 for
+	 * none) has been sent 'probe_tries' times, the last one times
+	 * out at 'probe_deadline'.  It is first sent once the RTT is
+	 * known.
+	 */
+	int probe;
+	int probe_tries;
+	struct timespec probe_deadline;
+
+	/* ARQ_GSO and ARQ_GRO, 'gro_on' once the socket has UDP_GRO */
+	int offload;
+	int gro_on;
+
+	/*
+	 * The io_uring with ARQ_URING, made when it is first needed for
+	 * the socket 'uring_fd'.  Sends only go through it if 'uring_tx'.
+	 */
+	struct arq_uring *uring;
+	int uring_fd;
+	int uring_tx;
+
+	/*
+	 * Retransmit timeout (RTO) estimate in milliseconds, using the
+	 * smoothed RTT and its variance as described by Jacobson and
+	 * Karels (RFC 6298).  'srtt' is 0 until the first measurement.
+	 */
+	double srtt;
+	double rttvar;
+	double rto;
+	double timeout;		/* starting value of 'rto' */
+
+	/*
+	 * The peer that data is sent to and received from.  Once
+	 * 'connected' anything from other addresses is ignored.
+	 */
+	struct sockaddr_storage peer;
+	socklen_t peer_len;
+	int connected;
+
+	/*
+	 * Datagrams are sent and received up to 'batch' at a time.
+	 * The newest 'held' packets of the send window have not been
+	 * sent yet, and ACKs wait in 'acks' until the datagrams that
+	 * were received with them have all been handled.  Each datagram
+	 * read has 'rx_sz' bytes of 'rx', and 'rx_tmp' is for an aligned
+	 * copy of a segment of one.
+	 */
+	int batch;
+	int held;
+	char *rx;
+	size_t rx_sz;
+	char *rx_tmp;
+	struct sockaddr_storage *rx_addr;
+	struct arq_ack {
+		unsigned char type;
+		unsigned char flags;
+		uint16_t seq;
+		uint16_t last;		/* TYPE_SACK only */
+		unsigned char map[SACK_BITS / 8];
+	} acks[ARQ_MAX_BATCH];
+	int nacks;
+
+	/* cumulative ACKs in a row that did not move the send window */
+	int dupacks;
+
+	/*
+	 * Congestion control, if 'cc' is set at most 'cwnd' packets
+	 * are in flight.  Losses of packets before 'recover' belong
+	 * to a loss that has already been handled.
+	 */
+	const struct arq_cc *cc;
+	struct arq_cc_state ccs;
+	uint16_t recover;
+	int recovering;
+
+	/* the window before the last loss, in case it was not one */
+	struct arq_cc_state undo;
+	uint16_t undo_seq;
+	int can_undo;
+	FILE *trace;
+	struct timespec start;
+
+	/*
+	 * The binary event trace, 'nev' records of 'ev' are waiting to
+	 * be written to 'events'.  'id' is the session in them.
+	 */
+	FILE *events;
+	struct arq_event *ev;
+	int nev;
+	uint32_t id;
+
+	/*
+	 * Pacing, new packets are sent 'pacing' bytes per second apart
+	 * (or ARQ_PACE_CWND), the next one at 'pace_next' ms after
+	 * 'start'.
+	 */
+	double pacing;
+	double pace_next;
+
+	/*
+	 * With delayed ACKs 'unacked' packets that arrived in order,
+	 * up to 'ack_seq', are still waiting for a cumulative ACK.  It
+	 * is sent after 'ack_every' of them or at 'ack_deadline'.
+	 * 'ooo' packets are buffered out of order (Selective Repeat).
+	 */
+	int ack_every;
+	double ack_delay;
+	int unacked;
+	uint16_t ack_seq;
+	unsigned char ack_echo;
+	struct timespec ack_deadline;
+	uint32_t ack_waited;	/* us, of the one being queued */
+	int ooo;
+
+	/*
+	 * Forward error correction.  The sender adds the first 'fec_n'
+	 * data packets of the block that starts at 'fec_first' into the
+	 * 'fec_m' parity packets 'fec_out', the longest so far has
+	 * 'fec_len' bytes.  The receiver keeps parity packets in 'fec_in'
+	 * ('fec_in_len' bytes, 0 if unused) until it has enough for the
+	 * packets that are missing, and rebuilds them in 'fec_tmp'.
+	 */
+	int fec_k;
+	int fec_m;
+	int fec_n;
+	uint16_t fec_first;
+	size_t fec_len;
+	char *fec_out;
+	char *fec_in;
+	size_t fec_in_len[FEC_IN];
+	int fec_next;		/* the one in 'fec_in' to replace next */
+	char *fec_tmp;
+
+	/*
+	 * With 'crc' every packet ends in a CRC32C.  The digests are of
+	 * the data sent and returned since the last EOF, 'crc_in' is of
+	 * the data of the packet being input.
+	 */
+	int crc;
+	uint32_t digest_out;
+	uint32_t digest_in;
+	uint32_t crc_in;
+
+	/* for the averages of arq_session_stats() */
+	struct arq_stats stats;
+	double rtt_sum;
+	double ack_delay_sum;
+};
+
+/* used by arq_sendto() and arq_recvfrom() */
+static struct arq_session *arq_default;
+
+/* the id of the last session created */
+static uint32_t last_id;
+
+/* distance from sequence number 'b' to 'a', negative if 'a' is older */
+static int seq_diff(uint16_t a, uint16_t b)
+{
+	return (int16_t) (a - b);
 }
 
-int arq_sendto(int sockfd, const void *buf, size_t len,
-		int flags, const struct sockaddr *dest_addr, socklen_t addrlen)
+static void ts_add_ms(struct timespec *ts, double ms)
 {
-	int n;
+	ts->tv_nsec += ms * 1000000;
+	ts->tv_sec += ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+/* microseconds from 'b' until 'a' */
+static long ts_diff_us(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000
+		+ (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+/* the tick of the timer wheel at 'ts' */
+static uint64_t wheel_tick(struct arq_session *s, const struct timespec *ts)
+{
+	return ts_diff_us(ts, &s->start) / TIMER_TICK_US;
+}
 
-	struct timeval tv;
-	fd_set rd_set;
+static int sockaddr_equal(const struct sockaddr *a, socklen_t alen,
+		const struct sockaddr *b, socklen_t blen)
+{
+	const struct sockaddr_in *a4, *b4;
+	const struct sockaddr_in6 *a6, *b6;
 
-	struct arq_packet ack_buf;
-	struct arq_packet sbuf;
-	size_t send_len, data_len;
+	if (a->sa_family != b->sa_family)
+		return 0;
 
-	unsigned char ack_recvd;
+	if (AF_INET == a->sa_family) {
+		a4 = (const struct sockaddr_in *) a;
+		b4 = (const struct sockaddr_in *) b;
+		return a4->sin_port == b4->sin_port
+			&& a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	} else if (AF_INET6 == a->sa_family) {
+		a6 = (const struct sockaddr_in6 *) a;
+		b6 = (const struct sockaddr_in6 *) b;
+		return a6->sin6_port == b6->sin6_port
+			&& 0 == memcmp(&a6->sin6_addr, &b6->sin6_addr,
+					sizeof(a6->sin6_addr));
+	}
 
-	unsigned char num_resend;
+	return alen == blen && 0 == memcmp(a, b, alen);
+}
 
-	/* build the ARQ packet to be sent */
-	send_len = HEADER_SZ + MIN(len, DATA_SZ);
-	memcpy(&sbuf.data, buf, MIN(len, DATA_SZ));
-	sbuf.seq = seq;
-	sbuf.type = TYPE_DATA;
-	/* 'send_len' might be less than the requested 'len' */
-
-	/* main loop to send the packet and wait for an ACK */
-	ack_recvd = 0;
-	num_resend = 0;
-	while (!ack_recvd) {
-
-		/* send the ARQ packet */
-		n = unreliable_sendto(sockfd, &sbuf, send_len, flags,
-				dest_addr, addrlen);
-		if (-1 == n) {
-			return -1;
-		}
-		/* 'n' might be less than the requested 'send_len' */
+static void set_peer(struct arq_session *s,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	memcpy(&s->peer, addr, MIN(addrlen, sizeof(s->peer)));
+	s->peer_len = MIN(addrlen, sizeof(s->peer));
+}
 
-		data_len = n - HEADER_SZ;
-		/* Actual amount of data sent minus headers,
-		 * used for the return value on success.
-		 */
+/*
+ * Write out the events that are waiting, all the way to the file so
+ * that a process that is killed leaves whole blocks behind.
+ */
+static void events_flush(struct arq_session *s)
+{
+	if (s->nev) {
+		fwrite(s->ev, sizeof(*s->ev), s->nev, s->events);
+		fflush(s->events);
+	}
+	s->nev = 0;
+}
 
-		/* wait for data or a time out */
+/* record an event, if they are being traced */
+static void trace_event(struct arq_session *s, int type, uint16_t seq,
+		uint32_t arg, size_t len)
+{
+	struct arq_event *ev;
+	struct timespec now;
 
-		FD_ZERO(&rd_set);
-		FD_SET(sockfd, &rd_set);
+	if (NULL == s->events)
+		return;
 
-		tv.tv_sec = 0;
-		tv.tv_usec = TIMEOUT_MS*1000;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ev = &s->ev[s->nev];
+	ev->us = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	ev->session = s->id;
+	ev->type = type;
+	ev->seq = seq;
+	ev->arg = arg;
+	ev->len = len;
+	if (++s->nev == ARQ_EV_BUF)
+		events_flush(s);
+}
 
-		n = select(sockfd+1, &rd_set, NULL, NULL, &tv);
-		if (-1 == n) {
-			return -1;
-		} else if (0 == n) { /* timeout */
+static void rtt_sample(struct arq_session *s, uint16_t seq, double r)
+{
+	double err, k;
 
-			if (++num_resend > MAX_RESEND)
-				return 0;  /* give up */
+	if (0 == s->stats.rtt_samples++ || r < s->stats.rtt_min_ms)
+		s->stats.rtt_min_ms = r;
+	if (r > s->stats.rtt_max_ms)
+		s->stats.rtt_max_ms = r;
+	s->rtt_sum += r;
+	trace_event(s, ARQ_EV_RTT, seq, r * 1000, 0);
 
-			continue;  /* retry */
-		}
+	/*
+	 * The gains are meant for one sample per RTT, with a window
+	 * there is one for every packet.  Spread them over the samples
+	 * expected in one RTT (RFC 7323, appendix G) or the variance
+	 * is forgotten within a single RTT.
+	 */
+	k = (uint16_t) (s->snd.next - s->snd.base) / 2;
+	if (k < 1)
+		k = 1;
 
-		n = recvfrom(sockfd, (void *) &ack_buf, ACK_SZ, 0, NULL, NULL);
-		if (-1 == n) {
-			return -1;
-		}
+	if (0 == s->srtt) {
+		s->srtt = r;
+		s->rttvar = r / 2;
+	} else {
+		err = (s->srtt > r) ? s->srtt - r : r - s->srtt;
+		s->rttvar += (err - s->rttvar) / (4 * k);
+		s->srtt += (r - s->srtt) / (8 * k);
+	}
 
-		if (n >= HEADER_SZ && ack_buf.type == TYPE_ACK
-				&& ack_buf.seq == seq) {
-			/* ACK confirmed */
+	s->rto = s->srtt + 4 * s->rttvar;
+	if (s->rto < RTO_MIN_MS)
+		s->rto = RTO_MIN_MS;
+	if (s->rto > RTO_MAX_MS)
+		s->rto = RTO_MAX_MS;
+}
 
-			seq = (seq) ? 0 : 1;
+/* the most packets that may be in flight */
+static int snd_limit(struct arq_session *s)
+{
+	if (NULL == s->cc || s->ccs.cwnd >= s->snd.size)
+		return s->snd.size;
 
-			ack_recvd = 1;
-		}
-		/* else data is wrong, ignore */
+	return (s->ccs.cwnd < 1) ? 1 : (int) s->ccs.cwnd;
+}
+
+static double now_ms(struct arq_session *s)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ts_diff_us(&now, &s->start) / 1000.0;
+}
+
+static void cc_trace(struct arq_session *s, double ms, const char *event)
+{
+	if (s->trace)
+		fprintf(s->trace, "%.3f,%.2f,%.2f,%s\n", ms,
+				s->ccs.cwnd, s->ccs.ssthresh, event);
+}
+
+/* 'acked' packets were ACKed */
+static void cc_ack(struct arq_session *s, int acked)
+{
+	double ms;
+
+	if (NULL == s->cc)
+		return;
+
+	if (s->recovering && seq_diff(s->snd.base, s->recover) >= 0)
+		s->recovering = 0;
+
+	if (0 == acked)
+		return;
+
+	ms = now_ms(s);
+	s->cc->ack(&s->ccs, acked, ms, s->srtt);
+
+	/* it can not grow past what the window allows */
+	if (s->ccs.cwnd > s->snd.size)
+		s->ccs.cwnd = s->snd.size;
+
+	cc_trace(s, ms, "ack");
+}
+
+/* the packet 'seq' was lost, found by a timeout or fast retransmit */
+static void cc_loss(struct arq_session *s, int timeout, uint16_t seq)
+{
+	double ms;
+
+	if (NULL == s->cc)
+		return;
+
+	/* only once for everything that was in flight at the time */
+	if (s->recovering && seq_diff(seq, s->recover) < 0)
+		return;
+
+	s->recovering = 1;
+	s->recover = s->snd.next;
+	s->undo = s->ccs;
+	s->undo_seq = seq;
+	s->can_undo = 1;
+
+	ms = now_ms(s);
+	s->cc->loss(&s->ccs, timeout, ms);
+	cc_trace(s, ms, timeout ? "timeout" : "fast");
+}
+
+/*
+ * The ACK of the packet 'seq' echoed the transmission number 'echo'
+ * of an earlier copy than the last one.  If it was taken as lost, it
+ * was only late and the window goes back to where it was (Eifel,
+ * RFC 3522).
+ */
+static void cc_undo(struct arq_session *s, uint16_t seq)
+{
+	if (NULL == s->cc || !s->can_undo || seq != s->undo_seq)
+		return;
+
+	s->ccs = s->undo;
+	s->recovering = 0;
+	s->can_undo = 0;
+	cc_trace(s, now_ms(s), "undo");
+}
+
+/* bytes for a packet with up to 'mss' bytes of data, or its parity */
+static size_t pkt_size(int mss)
+{
+	return (HEADER_SZ + FEC_SZ + mss + CRC_SZ + 7) & ~(size_t) 7;
+}
+
+/* the CRC at the end of a packet, of its data ('crc') then its header */
+static uint32_t pkt_crc(uint32_t crc, const void *hdr)
+{
+	return htonl(arq_crc32c(crc, hdr, HEADER_SZ));
+}
+
+/* the CRC at the end of a packet as it is, which may not be aligned */
+static uint32_t load_crc(const char *p)
+{
+	uint32_t crc;
+
+	memcpy(&crc, p, sizeof(crc));
+	return crc;
+}
+
+/* add the CRC of the data of a packet to a digest */
+static uint32_t digest_add(uint32_t digest, uint32_t crc)
+{
+	unsigned char b[4];
+
+	b[0] = crc >> 24;
+	b[1] = crc >> 16;
+	b[2] = crc >> 8;
+	b[3] = crc;
+
+	return arq_crc32c(digest, b, sizeof(b));
+}
+
+static int window_alloc(struct arq_window *w, int size, int mss)
+{
+	size_t stride;
+	char *slots;
+	unsigned int n;
+
+	for (n = 1; n < (unsigned int) size; n <<= 1)
+		;
+
+	stride = offsetof(struct arq_slot, pkt) + pkt_size(mss);
+	if (stride < sizeof(struct arq_slot))
+		stride = sizeof(struct arq_slot);
+
+	slots = calloc(n, stride);
+	if (NULL == slots)
+		return -1;
+
+	free(w->slots);
+	w->slots = slots;
+	w->mask = n - 1;
+	w->size = size;
+	w->stride = stride;
+
+	return 0;
+}
+
+struct arq_session *arq_session_new(int sockfd,
+		const struct sockaddr *peer, socklen_t peerlen)
+{
+	struct arq_session *s;
+
+	s = calloc(1, sizeof(*s));
+	if (NULL == s)
+		return NULL;
+
+	s->sockfd = sockfd;
+	s->mode = ARQ_SR;
+	s->timeout = TIMEOUT_MS;
+	s->rto = s->timeout;
+	s->ack_every = 1;
+	s->ack_delay = ACK_DELAY_MS;
+	s->mss = s->mss_max = DATA_SZ;
+	s->pkt_sz = pkt_size(s->mss_max);
+	s->id = __sync_add_and_fetch(&last_id, 1);
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+	arq_wheel_init(&s->wheel, 0);
+
+	/* the windows start out with a size of 1, Stop and Wait */
+	if (-1 == window_alloc(&s->snd, 1, s->mss_max)
+			|| -1 == window_alloc(&s->rcv, 1, s->mss_max)
+			|| -1 == arq_session_set_batch(s, 1)) {
+		arq_session_free(s);
+		return NULL;
 	}
 
-	return data_len;
+	if (peer != NULL) {
+		set_peer(s, peer, peerlen);
+		s->connected = 1;
+	}
+
+	return s;
 }
 
-int arq_recvfrom(int sockfd, void *buf, size_t len,
-		int flags, struct sockaddr *src_addr, socklen_t *addrlen)
+void arq_session_free(struct arq_session *s)
 {
-	int n;
-	struct arq_packet ack_buf;
+	if (NULL == s)
+		return;
+
+	arq_session_set_events(s, NULL);
+	arq_uring_free(s->uring);
+	free(s->snd.slots);
+	free(s->rcv.slots);
+	free(s->rx);
+	free(s->rx_addr);
+	free(s->fec_out);
+	free(s->fec_in);
+	free(s->fec_tmp);
+	free(s);
+}
 
-	struct sockaddr cliaddr;
-	socklen_t cliaddr_len;
+void arq_session_reset(struct arq_session *s)
+{
+	struct timespec now;
 
-	struct arq_packet rbuf;
-	size_t recv_len, data_len;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	arq_wheel_init(&s->wheel, wheel_tick(s, &now));
+	memset(s->snd.slots, 0, (s->snd.mask + 1) * s->snd.stride);
+	memset(s->rcv.slots, 0, (s->rcv.mask + 1) * s->rcv.stride);
+	s->snd.base = s->snd.next = 0;
+	s->rcv.base = s->rcv.next = 0;
+	s->held = 0;
+	s->nacks = 0;
+	s->unacked = 0;
+	s->ooo = 0;
+	s->dupacks = 0;
+	s->recovering = 0;
+	s->can_undo = 0;
+	if (s->cc)
+		s->cc->init(&s->ccs);
+	s->fec_n = 0;
+	memset(s->fec_in_len, 0, sizeof(s->fec_in_len));
+	s->digest_out = 0;
+	s->digest_in = 0;
 
-	unsigned char data_recvd;
+	s->srtt = 0;
+	s->rttvar = 0;
+	s->rto = s->timeout;
+}
 
-	recv_len = 0;
-	data_len = 0;
+/* are there packets in flight or waiting to be returned? */
+static int arq_busy(struct arq_session *s)
+{
+	unsigned int i;
 
-	data_recvd = 0;
-	while (!data_recvd) {
-		if (src_addr != NULL) {
-			memcpy(&cliaddr, src_addr, *addrlen);
-			cliaddr_len = *addrlen;
-		} else {
-			cliaddr_len = sizeof(cliaddr);
-		}
+	if (s->snd.base != s->snd.next)
+		return 1;
 
-		recv_len = HEADER_SZ + MIN(len, DATA_SZ);
+	for (i = 0; i <= s->rcv.mask; i++) {
+		if (SLOT_FULL == SLOT(&s->rcv, i)->state)
+			return 1;
+	}
 
-		n = recvfrom(sockfd, &rbuf, recv_len, flags,
-				&cliaddr, &cliaddr_len);
-		if (-1 == n) {
+	return 0;
+}
+
+int arq_session_set_window(struct arq_session *s, int window)
+{
+	if (window < 1 || window > ARQ_MAX_WINDOW) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (arq_busy(s)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (-1 == window_alloc(&s->snd, window, s->mss_max))
+		return -1;
+	if (-1 == window_alloc(&s->rcv, window, s->mss_max))
+		return -1;
+
+	return 0;
+}
+
+int arq_session_set_mode(struct arq_session *s, int mode)
+{
+	if (ARQ_SR != mode && ARQ_GBN != mode) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (arq_busy(s)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	s->mode = mode;
+	s->rcv.next = s->rcv.base;
+
+	return 0;
+}
+
+int arq_session_set_batch(struct arq_session *s, int batch)
+{
+	struct sockaddr_storage *rx_addr;
+	size_t rx_sz;
+	char *rx;
+
+	if (batch < 1 || batch > ARQ_MAX_BATCH) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* once GRO is on the socket can return a whole run of segments */
+	rx_sz = ((s->offload & ARQ_GRO) || s->gro_on) ? GRO_SZ : s->pkt_sz;
+	rx = malloc(batch * rx_sz + s->pkt_sz);
+	rx_addr = malloc(batch * sizeof(*rx_addr));
+	if (NULL == rx || NULL == rx_addr) {
+		free(rx);
+		free(rx_addr);
+		return -1;
+	}
+
+	free(s->rx);
+	free(s->rx_addr);
+	arq_uring_free(s->uring);
+	s->uring = NULL;
+	s->rx = rx;
+	s->rx_sz = rx_sz;
+	s->rx_tmp = rx + batch * rx_sz;
+	s->rx_addr = rx_addr;
+	s->batch = batch;
+
+	return 0;
+}
+
+int arq_session_set_timeout(struct arq_session *s, double ms)
+{
+	if (ms < RTO_MIN_MS || ms > RTO_MAX_MS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	s->timeout = ms;
+	if (0 == s->srtt)
+		s->rto = ms;
+
+	return 0;
+}
+
+int arq_session_set_delack(struct arq_session *s, int every, double ms)
+{
+	if (every < 1 || every > ARQ_MAX_WINDOW || ms < 0 || ms > RTO_MAX_MS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	s->ack_every = every;
+	s->ack_delay = ms;
+
+	return 0;
+}
+
+void arq_session_set_cc(struct arq_session *s, const struct arq_cc *cc)
+{
+	s->cc = cc;
+	s->recovering = 0;
+	s->can_undo = 0;
+	if (cc)
+		cc->init(&s->ccs);
+}
+
+int arq_session_set_pacing(struct arq_session *s, double rate)
+{
+	if (rate < 0 && ARQ_PACE_CWND != rate) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	s->pacing = rate;
+	s->pace_next = 0;
+
+	return 0;
+}
+
+int arq_session_set_fec(struct arq_session *s, int k, int m)
+{
+	char *out = NULL;
+
+	/* no parity packets only if there are no blocks either */
+	if (k < 0 || k > FEC_MAX_K || m < 0 || m > FEC_MAX_M
+			|| (k && 0 == m)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (k) {
+		out = calloc(m, s->pkt_sz);
+		if (NULL == out)
 			return -1;
-		}
+	}
 
-		/* assign initial recv_seq number */
-		if (-1 == recv_seq) {
-			recv_seq = rbuf.seq ? 0 : 1;
-		}
+	free(s->fec_out);
+	s->fec_out = out;
+	s->fec_k = k;
+	s->fec_m = m;
+	s->fec_n = 0;
 
-		if (n >= HEADER_SZ && rbuf.type == TYPE_DATA
-				&& rbuf.seq != recv_seq) {
-			/* received a valid packet */
+	return 0;
+}
 
-			/* save the data */
-			data_len = n - HEADER_SZ;
-			memcpy(buf, rbuf.data, data_len);
+int arq_session_set_mss(struct arq_session *s, int mss, int probe)
+{
+	size_t pkt_sz, old;
+	char *out = NULL;
 
-			/* next sequence number */
-			recv_seq = recv_seq ? 0 : 1;
+	if (mss < DATA_SZ || mss > ARQ_MAX_MSS) {
+		errno = EINVAL;
+		return -1;
+	}
 
-			data_recvd = 1;
-		}
+	if (arq_busy(s)) {
+		errno = EBUSY;
+		return -1;
+	}
 
-		/* send an ACK */
-		ack_buf.seq = rbuf.seq;
-		ack_buf.type = TYPE_ACK;
-		n = unreliable_sendto(sockfd, &ack_buf, ACK_SZ, 0,
-				&cliaddr, cliaddr_len);
-		if (-1 == n) {
+	pkt_sz = pkt_size(mss);
+	if (s->fec_k) {
+		out = calloc(s->fec_m, pkt_sz);
+		if (NULL == out)
 			return -1;
-		}
 	}
 
-	/* update the receive addresses */
-	if (src_addr != NULL) {
-		memcpy(src_addr, &cliaddr, sizeof(cliaddr));
-		*addrlen = cliaddr_len;
+	if (-1 == window_alloc(&s->snd, s->snd.size, mss)
+			|| -1 == window_alloc(&s->rcv, s->rcv.size, mss)) {
+		free(out);
+		return -1;
 	}
 
-	return data_len;
+	old = s->pkt_sz;
+	s->pkt_sz = pkt_sz;
+	if (-1 == arq_session_set_batch(s, s->batch)) {
+		s->pkt_sz = old;
+		free(out);
+		return -1;
+	}
+
+	if (s->fec_k) {
+		free(s->fec_out);
+		s->fec_out = out;
+		s->fec_n = 0;
+	}
+	free(s->fec_in);
+	free(s->fec_tmp);
+	s->fec_in = s->fec_tmp = NULL;
+	memset(s->fec_in_len, 0, sizeof(s->fec_in_len));
+
+	s->mss_max = mss;
+	s->mss = probe ? DATA_SZ : mss;
+	s->probe = (probe && mss > DATA_SZ) ? mss : 0;
+	s->probe_tries = 0;
+
+	return 0;
+}
+
+int arq_session_set_offload(struct arq_session *s, int flags)
+{
+	int old = s->offload;
+
+	if (flags & ~(ARQ_GSO | ARQ_GRO | ARQ_URING | ARQ_SQPOLL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	s->offload = flags;
+	if (-1 == arq_session_set_batch(s, s->batch)) {
+		s->offload = old;
+		return -1;
+	}
+
+	return 0;
+}
+
+int arq_session_set_crc(struct arq_session *s, int on)
+{
+	if (arq_busy(s)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	s->crc = !!on;
+	s->digest_out = 0;
+	s->digest_in = 0;
+
+	return 0;
+}
+
+void arq_session_set_trace(struct arq_session *s, FILE *fp)
+{
+	s->trace = fp;
+}
+
+void arq_session_set_events(struct arq_session *s, FILE *fp)
+{
+	if (s->events)
+		events_flush(s);
+
+	if (fp && NULL == s->ev) {
+		s->ev = malloc(ARQ_EV_BUF * sizeof(*s->ev));
+		if (NULL == s->ev)
+			fp = NULL;
+	} else if (NULL == fp) {
+		free(s->ev);
+		s->ev = NULL;
+	}
+	s->events = fp;
+}
+
+void arq_session_stats(struct arq_session *s, struct arq_stats *st)
+{
+	*st = s->stats;
+	if (st->rtt_samples)
+		st->rtt_avg_ms = s->rtt_sum / st->rtt_samples;
+	if (st->acks_delayed)
+		st->ack_delay_avg_ms = s->ack_delay_sum / st->acks_delayed;
+	st->srtt_ms = s->srtt;
+	st->rto_ms = s->rto;
+}
+
+void arq_session_set_output(struct arq_session *s,
+		int (*output)(void *arg, struct mmsghdr *msgs, unsigned int n),
+		void *arg)
+{
+	s->output = output;
+	s->output_arg = arg;
+}
+
+/*
+ * uring_get()
+ *
+ * The io_uring of the session with ARQ_URING, made for the socket
+ * (again, if it is another one) with buffers for datagrams as large
+ * as those read from it.  If it can not be made the session goes on
+ * without one.
+ *
+ * Returns: the ring, or NULL if there is none.
+ */
+static struct arq_uring *uring_get(struct arq_session *s)
+{
+	int nbufs, nsend;
+
+	if (!(s->offload & ARQ_URING) || s->output)
+		return NULL;
+	if (s->uring && s->uring_fd == s->sockfd)
+		return s->uring;
+
+	arq_uring_free(s->uring);
+	for (nbufs = URING_BUFS_MIN; nbufs < URING_BUFS_MAX
+			&& (size_t) nbufs * 2 * s->rx_sz <= URING_MEM;
+			nbufs *= 2)
+		;
+	nsend = MIN(URING_BUFS_MAX, URING_MEM / s->pkt_sz);
+	if (nsend < ARQ_MAX_BATCH)
+		nsend = ARQ_MAX_BATCH;
+	s->uring = arq_uring_new(s->sockfd, s->offload & ARQ_SQPOLL,
+			nbufs, s->rx_sz, nsend, s->pkt_sz, &s->stats.syscalls);
+	if (NULL == s->uring) {
+		s->offload &= ~(ARQ_URING | ARQ_SQPOLL);
+		return NULL;
+	}
+	s->uring_fd = s->sockfd;
+	s->uring_tx = unreliable_transparent();
+
+	return s->uring;
+}
+
+/* send datagrams on the socket, or hand them to the output or ring */
+static int msgs_send(struct arq_session *s, struct mmsghdr *msgs,
+		unsigned int n, int flags)
+{
+	struct arq_uring *u;
+
+	if (s->output) {
+		s->stats.syscalls++;
+		return s->output(s->output_arg, msgs, n);
+	}
+
+	/* the ring counts its own system calls */
+	u = uring_get(s);
+	if (u && s->uring_tx)
+		return arq_uring_send(u, msgs, n);
+
+	s->stats.syscalls++;
+	return unreliable_sendmmsg(s->sockfd, msgs, n, flags);
+}
+
+static int fec_add(struct arq_session *s, struct arq_slot *slot, int flags);
+
+/*
+ * iov_send()
+ *
+ * Send 'n' datagrams (at most ARQ_MAX_BATCH) of 'niov' parts each
+ * in 'iov' to the peer with one system call.  With GSO a run of
+ * datagrams of the same length, the last of which may be shorter, is
+ * given to the kernel as one to be split into segments of that length.
+ * If GSO turns out not to work it is turned off and they are sent
+ * again without it.  Datagrams sent through an io_uring are copied
+ * into buffers of one packet each, and already cost no system call.
+ */
+static int iov_send(struct arq_session *s, struct iovec *iov, int niov,
+		int n, int flags)
+{
+	struct mmsghdr msgs[ARQ_MAX_BATCH];
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		size_t align;	/* as a struct cmsghdr */
+	} ctl[ARQ_MAX_BATCH];
+	size_t len[ARQ_MAX_BATCH];
+	struct cmsghdr *cmsg;
+	uint16_t seg;
+	size_t total;
+	int i, j, m;
+	int gso;
+
+	gso = (s->offload & ARQ_GSO) && !(uring_get(s) && s->uring_tx);
+	for (i = 0; i < n; i++) {
+		len[i] = 0;
+		for (j = 0; j < niov; j++)
+			len[i] += iov[i * niov + j].iov_len;
+	}
+
+	memset(msgs, 0, n * sizeof(*msgs));
+	for (i = 0, m = 0; i < n; i = j, m++) {
+		total = len[i];
+		for (j = i + 1; gso && j < n
+				&& j - i < GSO_MAX_SEGS
+				&& len[j] <= len[i]
+				&& total + len[j] <= GSO_MAX_SZ; j++) {
+			total += len[j];
+			if (len[j] < len[i]) {
+				j++;
+				break;
+			}
+		}
+
+		msgs[m].msg_hdr.msg_name = &s->peer;
+		msgs[m].msg_hdr.msg_namelen = s->peer_len;
+		msgs[m].msg_hdr.msg_iov = &iov[i * niov];
+		msgs[m].msg_hdr.msg_iovlen = (j - i) * niov;
+		if (j - i > 1) {
+			seg = len[i];
+			msgs[m].msg_hdr.msg_control = ctl[m].buf;
+			msgs[m].msg_hdr.msg_controllen = sizeof(ctl[m].buf);
+			cmsg = CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(seg));
+			memcpy(CMSG_DATA(cmsg), &seg, sizeof(seg));
+		}
+	}
+
+	if (-1 == msgs_send(s, msgs, m, flags)) {
+		/* no GSO in this kernel or for this device */
+		if (m < n && (EINVAL == errno || EIO == errno
+				|| ENOPROTOOPT == errno
+				|| EOPNOTSUPP == errno)) {
+			s->offload &= ~ARQ_GSO;
+			return iov_send(s, iov, niov, n, flags);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * slots_send()
+ *
+ * Send up to 'batch' slots with one system call.  The header and
+ * the data of each are apart, the data may be the caller's.
+ */
+static int slots_send(struct arq_session *s, struct arq_slot **slots,
+		int n, int flags)
+{
+	struct iovec iov[3 * ARQ_MAX_BATCH];
+	uint32_t crc[ARQ_MAX_BATCH];
+	struct timespec now;
+	uint64_t tick;
+	int i, k = s->crc ? 3 : 2;
+
+	for (i = 0; i < n; i++) {
+		if (0 == ++slots[i]->tx)
+			slots[i]->tx = 1;
+		if (slots[i]->resent) {
+			s->stats.packets_resent++;
+			s->stats.bytes_resent += slots[i]->len - HEADER_SZ;
+		}
+		s->stats.packets_sent++;
+		slots[i]->pkt.flags = slots[i]->tx;
+
+		iov[k * i].iov_base = &slots[i]->pkt;
+		iov[k * i].iov_len = HEADER_SZ;
+		iov[k * i + 1].iov_base = (void *) SLOT_DATA(slots[i]);
+		iov[k * i + 1].iov_len = slots[i]->len - HEADER_SZ;
+		if (s->crc) {
+			/* only the header changes from one copy to the next */
+			crc[i] = pkt_crc(slots[i]->crc, &slots[i]->pkt);
+			iov[k * i + 2].iov_base = &crc[i];
+			iov[k * i + 2].iov_len = CRC_SZ;
+		}
+	}
+
+	if (-1 == iov_send(s, iov, k, n, flags))
+		return -1;
+
+	/*
+	 * Every re-send of a packet doubles its timeout.  An empty
+	 * wheel may have been left behind, it reaches only so far.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	tick = wheel_tick(s, &now);
+	if (0 == s->wheel.count)
+		s->wheel.now = tick;
+	for (i = 0; i < n; i++) {
+		slots[i]->state = SLOT_SENT;
+		slots[i]->sent = now;
+		if (1 == slots[i]->tx)
+			slots[i]->first = now;
+		trace_event(s, slots[i]->resent ? ARQ_EV_RESEND : ARQ_EV_SEND,
+				ntohs(slots[i]->pkt.seq), slots[i]->tx,
+				slots[i]->len - HEADER_SZ);
+		arq_timer_add(&s->wheel, &slots[i]->timer, tick
+				+ (MIN(s->rto * (1 << slots[i]->num_resend),
+					RTO_MAX_MS) * 1000 + TIMER_TICK_US - 1)
+				/ TIMER_TICK_US);
+	}
+
+	/* the first copy of new data goes into the parity of its block */
+	for (i = 0; s->fec_k && i < n; i++) {
+		if (1 == slots[i]->tx && !slots[i]->resent
+				&& slots[i]->len > HEADER_SZ
+				&& TYPE_DATA == slots[i]->pkt.type
+				&& -1 == fec_add(s, slots[i], flags))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* the pacing rate in bytes per ms, 0 for none */
+static double pace_rate(struct arq_session *s)
+{
+	if (ARQ_PACE_CWND != s->pacing)
+		return s->pacing / 1000;
+
+	/*
+	 * A little faster than one window per RTT, so that pacing
+	 * itself does not hold the window back.  Twice as fast in slow
+	 * start, where the window doubles every RTT.
+	 */
+	if (0 == s->srtt)
+		return 0;
+	return ((s->cc && s->ccs.cwnd < s->ccs.ssthresh) ? 2 : 1.2)
+		* snd_limit(s) * (HEADER_SZ + s->mss) / s->srtt;
+}
+
+/*
+ * pace()
+ *
+ * Returns: how many of the 'n' packets may be sent now, the pacing
+ * clock is moved past them.  A sender that is late may catch up by
+ * at most a batch.
+ */
+static int pace(struct arq_session *s, struct arq_slot **slots, int n)
+{
+	double rate, now, early;
+	int i;
+
+	rate = pace_rate(s);
+	if (rate <= 0)
+		return n;
+
+	now = now_ms(s);
+	early = now - s->batch * (HEADER_SZ + s->mss) / rate;
+	if (s->pace_next < early)
+		s->pace_next = early;
+
+	for (i = 0; i < n && s->pace_next <= now; i++)
+		s->pace_next += slots[i]->len / rate;
+
+	return i;
+}
+
+/* send the parity packets of the block so far and start a new one */
+static int fec_send(struct arq_session *s, int flags)
+{
+	struct iovec iov[2 * FEC_MAX_M];
+	uint32_t crc[FEC_MAX_M];
+	struct arq_packet *pkt;
+	double rate;
+	size_t len;
+	int j, k = s->crc ? 2 : 1;
+
+	len = HEADER_SZ + FEC_SZ + s->fec_len;
+	for (j = 0; j < s->fec_m; j++) {
+		pkt = PKT(s, s->fec_out, j);
+		pkt->type = TYPE_FEC;
+		pkt->flags = j;
+		pkt->seq = htons(s->fec_first);
+		pkt->data[0] = s->fec_n;
+		pkt->data[1] = 0;
+
+		iov[k * j].iov_base = pkt;
+		iov[k * j].iov_len = len;
+		if (s->crc) {
+			crc[j] = pkt_crc(arq_crc32c(0, pkt->data,
+						len - HEADER_SZ), pkt);
+			iov[k * j + 1].iov_base = &crc[j];
+			iov[k * j + 1].iov_len = CRC_SZ;
+		}
+	}
+	s->fec_n = 0;
+
+	/* parity takes its share of the pacing rate */
+	rate = pace_rate(s);
+	if (rate > 0)
+		s->pace_next += s->fec_m * len / rate;
+
+	s->stats.fec_sent += s->fec_m;
+
+	return iov_send(s, iov, k, s->fec_m, flags);
+}
+
+/*
+ * fec_add()
+ *
+ * Add the data of a new packet into the parity of its block,
+ * sending the parity once the block is full.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ */
+static int fec_add(struct arq_session *s, struct arq_slot *slot, int flags)
+{
+	struct arq_packet *pkt;
+	unsigned char len[2];
+	unsigned char c;
+	uint16_t seq;
+	size_t n;
+	int j;
+
+	/* a block is made of packets in a row, start over if not */
+	seq = ntohs(slot->pkt.seq);
+	if (s->fec_n && seq != (uint16_t) (s->fec_first + s->fec_n))
+		s->fec_n = 0;
+
+	if (0 == s->fec_n) {
+		for (j = 0; j < s->fec_m; j++)
+			memset(PKT(s, s->fec_out, j)->data, 0,
+					FEC_SZ + s->mss_max);
+		s->fec_first = seq;
+		s->fec_len = 0;
+	}
+
+	n = slot->len - HEADER_SZ;
+	len[0] = n >> 8;
+	len[1] = n & 0xff;
+	for (j = 0; j < s->fec_m; j++) {
+		c = arq_fec_coef(j, s->fec_n);
+		pkt = PKT(s, s->fec_out, j);
+		arq_fec_mul_add((unsigned char *) pkt->data + 2,
+				len, c, sizeof(len));
+		arq_fec_mul_add((unsigned char *) pkt->data + FEC_SZ,
+				(const unsigned char *) SLOT_DATA(slot), c, n);
+	}
+	if (n > s->fec_len)
+		s->fec_len = n;
+	/* unless the block is too long to be in flight at once */
+	if (s->fec_k <= s->snd.size)
+		slot->fec_left = s->fec_k - 1 - s->fec_n;
+
+	if (++s->fec_n == s->fec_k)
+		return fec_send(s, flags);
+
+	return 0;
+}
+
+/*
+ * No more data is coming before an EOF, so the last block is sent
+ * as far as it goes, after the packets in it.
+ */
+static int fec_finish(struct arq_session *s)
+{
+	if (s->fec_n && 0 == s->held)
+		return fec_send(s, 0);
+
+	return 0;
+}
+
+/* send the new packets that are held for a batch */
+static int snd_flush(struct arq_session *s, int flags)
+{
+	struct arq_slot *slots[ARQ_MAX_BATCH];
+	uint16_t seq;
+	int i, n;
+
+	while (s->held) {
+		n = MIN(s->held, s->batch);
+		seq = s->snd.next - s->held;
+		for (i = 0; i < n; i++)
+			slots[i] = SLOT(&s->snd, seq + i);
+
+		n = pace(s, slots, n);
+		if (0 == n)
+			break;  /* the rest when pacing lets them go */
+
+		if (-1 == slots_send(s, slots, n, flags))
+			return -1;
+		s->held -= n;
+	}
+
+	return 0;
+}
+
+/* send the ACKs for the datagrams that have been received */
+static int acks_flush(struct arq_session *s)
+{
+	struct iovec iov[2 * ARQ_MAX_BATCH];
+	uint32_t crc[ARQ_MAX_BATCH];
+	int i, n, k = s->crc ? 2 : 1;
+
+	n = s->nacks;
+	if (0 == n)
+		return 0;
+	s->nacks = 0;
+
+	for (i = 0; i < n; i++) {
+		iov[k * i].iov_base = &s->acks[i];
+		iov[k * i].iov_len = (TYPE_SACK == s->acks[i].type)
+			? SACK_SZ : ACK_SZ;
+		if (s->crc) {
+			crc[i] = pkt_crc(arq_crc32c(0,
+					(char *) &s->acks[i] + HEADER_SZ,
+					iov[k * i].iov_len - HEADER_SZ),
+					&s->acks[i]);
+			iov[k * i + 1].iov_base = &crc[i];
+			iov[k * i + 1].iov_len = CRC_SZ;
+		}
+	}
+
+	s->stats.acks_sent += n;
+
+	return iov_send(s, iov, k, n, 0);
+}
+
+/* queue an ACK, they are sent a batch at a time */
+static int ack_queue(struct arq_session *s, unsigned char type,
+		uint16_t seq, unsigned char echo)
+{
+	struct arq_ack *ack;
+
+	ack = &s->acks[s->nacks];
+	ack->type = type;
+	ack->flags = echo;
+	ack->seq = htons(seq);
+	trace_event(s, ARQ_EV_ACK_SENT, seq, s->ack_waited, 0);
+	s->ack_waited = 0;
+	if (++s->nacks == s->batch)
+		return acks_flush(s);
+
+	return 0;
+}
+
+/*
+ * Queue a selective ACK for the packet 'seq': everything received
+ * in order, and a bitmap of what was received after that.
+ */
+static int sack_queue(struct arq_session *s, uint16_t seq,
+		unsigned char echo)
+{
+	struct arq_window *rcv = &s->rcv;
+	struct arq_ack *ack;
+	uint16_t cum = rcv->next - 1;
+	uint16_t i;
+
+	ack = &s->acks[s->nacks];
+	ack->type = TYPE_SACK;
+	ack->flags = echo;
+	ack->seq = htons(cum);
+	ack->last = htons(seq);
+	memset(ack->map, 0, sizeof(ack->map));
+	for (i = 0; i < SACK_BITS
+			&& (uint16_t) (cum + 1 + i - rcv->base) < rcv->size; i++) {
+		if (SLOT_FULL == SLOT(rcv, cum + 1 + i)->state)
+			ack->map[i / 8] |= 1 << (i % 8);
+	}
+	trace_event(s, ARQ_EV_ACK_SENT, cum, 0, 0);
+	if (++s->nacks == s->batch)
+		return acks_flush(s);
+
+	return 0;
+}
+
+/* the delayed ACK is going out, count how long it waited */
+static void ack_delayed(struct arq_session *s)
+{
+	struct timespec now;
+	double ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = ts_diff_us(&now, &s->ack_deadline) / 1000.0 + s->ack_delay;
+	s->unacked = 0;
+	s->ack_waited = ms * 1000;
+	s->stats.acks_delayed++;
+	s->ack_delay_sum += ms;
+	if (ms > s->stats.ack_delay_max_ms)
+		s->stats.ack_delay_max_ms = ms;
+}
+
+/* send the delayed ACK if its time has come */
+static int ack_expire(struct arq_session *s)
+{
+	struct timespec now;
+
+	if (0 == s->unacked)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_diff_us(&s->ack_deadline, &now) > 0)
+		return 0;
+
+	ack_delayed(s);
+	if (-1 == ack_queue(s, TYPE_CACK, s->ack_seq, s->ack_echo))
+		return -1;
+
+	return acks_flush(s);
+}
+
+static int probe_lower(struct arq_session *s);
+
+/*
+ * probe_send()
+ *
+ * Send a probe for 'probe' bytes of data, as large as a parity packet
+ * with that much.  It must not be fragmented on the way, so the socket
+ * sets DF and ignores the path MTU it knows of (IP_PMTUDISC_PROBE).
+ * A probe too large for the first link is lost at once.
+ */
+static int probe_send(struct arq_session *s)
+{
+	struct mmsghdr msg;
+	struct iovec iov[2];
+	struct arq_ack hdr;
+	int val = IP_PMTUDISC_PROBE;
+
+	if (0 == s->probe_tries) {
+		if (AF_INET6 == s->peer.ss_family)
+			setsockopt(s->sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER,
+					&val, sizeof(val));
+		else
+			setsockopt(s->sockfd, IPPROTO_IP, IP_MTU_DISCOVER,
+					&val, sizeof(val));
+	}
+
+	hdr.type = TYPE_PROBE;
+	hdr.flags = 0;
+	hdr.seq = htons(s->probe);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = HEADER_SZ;
+	iov[1].iov_base = (void *) probe_pad;
+	iov[1].iov_len = FEC_SZ + s->probe + (s->crc ? CRC_SZ : 0);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_hdr.msg_name = &s->peer;
+	msg.msg_hdr.msg_namelen = s->peer_len;
+	msg.msg_hdr.msg_iov = iov;
+	msg.msg_hdr.msg_iovlen = 2;
+
+	clock_gettime(CLOCK_MONOTONIC, &s->probe_deadline);
+	ts_add_ms(&s->probe_deadline,
+			MIN(s->rto * (1 << s->probe_tries), RTO_MAX_MS));
+	s->probe_tries++;
+
+	if (-1 == msgs_send(s, &msg, 1, 0)) {
+		if (EMSGSIZE != errno)
+			return -1;
+		return probe_lower(s);
+	}
+
+	return 0;
+}
+
+/* probe for 'mss' bytes of data, unless that is no more than now */
+static int probe_start(struct arq_session *s, int mss)
+{
+	s->probe = (mss > s->mss) ? mss : 0;
+	s->probe_tries = 0;
+	if (0 == s->probe)
+		return 0;
+
+	return probe_send(s);
+}
+
+/* the probe was lost, try the next size down the ladder */
+static int probe_lower(struct arq_session *s)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(probe_ladder) / sizeof(*probe_ladder); i++) {
+		if (probe_ladder[i] < s->probe)
+			return probe_start(s, probe_ladder[i]);
+	}
+
+	return probe_start(s, 0);
+}
+
+/* send the probe again, or a smaller one, if its time has come */
+static int probe_expire(struct arq_session *s)
+{
+	struct timespec now;
+
+	if (0 == s->probe || 0 == s->probe_tries)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_diff_us(&s->probe_deadline, &now) > 0)
+		return 0;
+
+	if (s->probe_tries < PROBE_TRIES)
+		return probe_send(s);
+
+	return probe_lower(s);
+}
+
+/*
+ * The peer got a probe with 'mss' bytes of data, or can take no
+ * more than that.  A size larger than the probe now is from one
+ * that was given up on too soon.
+ */
+static int probe_ack(struct arq_session *s, int mss)
+{
+	if (0 == s->probe || 0 == s->probe_tries || mss > s->mss_max)
+		return 0;
+
+	if (mss >= s->probe) {
+		s->mss = mss;
+		s->probe = 0;
+		return 0;
+	}
+
+	return probe_start(s, mss);
+}
+
+/* mark a sent slot as ACKed, returns 1 if it was not already */
+static int slot_ack(struct arq_session *s, struct arq_slot *slot)
+{
+	if (SLOT_SENT != slot->state)
+		return 0;
+
+	slot->state = SLOT_ACKED;
+	arq_timer_del(&s->wheel, &slot->timer);
+
+	return 1;
+}
+
+/* slide the send window past everything that has been ACKed */
+static void snd_slide(struct arq_session *s)
+{
+	struct arq_window *snd = &s->snd;
+
+	while (snd->base != snd->next
+			&& SLOT_ACKED == SLOT(snd, snd->base)->state) {
+		SLOT(snd, snd->base)->state = SLOT_FREE;
+		snd->base++;
+	}
+}
+
+/*
+ * snd_ack()
+ *
+ * Returns: the number of packets that were newly ACKed.
+ */
+static int snd_ack(struct arq_session *s, uint16_t seq, int cumulative,
+		unsigned char echo)
+{
+	struct arq_window *snd = &s->snd;
+	struct timespec now;
+	struct arq_slot *slot;
+	int acked = 0;
+	uint16_t i, sent;
+
+	if (seq_diff(seq, snd->base) < 0 || seq_diff(seq, snd->next) >= 0)
+		return 0;  /* not in the window, old duplicate */
+
+	slot = SLOT(snd, seq);
+	if (slot_ack(s, slot)) {
+		acked++;
+
+		/*
+		 * Karn's rule, the ACK of a packet that has been re-sent
+		 * could belong to any of the copies, so it is not used.
+		 * Unless it echoes the transmission number of the last
+		 * copy, then there is no doubt.
+		 */
+		if (echo ? echo == slot->tx : !slot->resent) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			rtt_sample(s, seq,
+					ts_diff_us(&now, &slot->sent) / 1000.0);
+		} else if (echo) {
+			/*
+			 * An earlier copy arrived, the re-send was not
+			 * needed.  The first copy can still be measured,
+			 * or a timeout below the RTT would never be.
+			 */
+			if (1 == echo) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				rtt_sample(s, seq, ts_diff_us(&now,
+						&slot->first) / 1000.0);
+			}
+			cc_undo(s, seq);
+		}
+	}
+
+	/*
+	 * A cumulative ACK covers everything before it too, as far as
+	 * it has been sent.  Packets still held were never sent, so an
+	 * old or forged ACK must not free them.
+	 */
+	sent = snd->next - s->held;
+	for (i = snd->base; cumulative && i != seq && i != sent; i++)
+		acked += slot_ack(s, SLOT(snd, i));
+
+	snd_slide(s);
+
+	return acked;
+}
+
+/*
+ * A selective ACK.  The packet that caused it is ACKed (and
+ * measured) on its own, then everything up to the cumulative
+ * ACK and the packets in the bitmap after it.
+ */
+static int snd_sack(struct arq_session *s, struct arq_packet *pkt)
+{
+	struct arq_window *snd = &s->snd;
+	unsigned char *map;
+	uint16_t cum, last, seq, sent;
+	int acked;
+	int i;
+
+	cum = ntohs(pkt->seq);
+	memcpy(&last, pkt->data, sizeof(last));
+	map = (unsigned char *) pkt->data + sizeof(last);
+
+	acked = snd_ack(s, ntohs(last), 0, pkt->flags);
+
+	if (seq_diff(cum, snd->next) >= 0)
+		return acked;  /* nonsense, more than was ever sent */
+
+	/* as far as it has been sent, held packets were not */
+	sent = snd->next - s->held;
+	for (seq = snd->base; seq != sent && seq_diff(seq, cum) <= 0; seq++)
+		acked += slot_ack(s, SLOT(snd, seq));
+
+	for (i = 0; i < SACK_BITS; i++) {
+		seq = cum + 1 + i;
+		if (seq_diff(seq, snd->base) < 0 || seq_diff(seq, snd->next) >= 0)
+			continue;
+		if (map[i / 8] & (1 << (i % 8)))
+			acked += slot_ack(s, SLOT(snd, seq));
+	}
+
+	snd_slide(s);
+
+	return acked;
+}
+
+/*
+ * snd_fast()
+ *
+ * Fast retransmit, re-send the packets that are known to be lost
+ * without waiting for their timers.  Each is re-sent this way only
+ * once, if that copy is lost too its timer takes over.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ */
+static int snd_fast(struct arq_session *s)
+{
+	struct arq_window *snd = &s->snd;
+	struct arq_slot *slots[ARQ_MAX_BATCH];
+	struct arq_slot *slot;
+	uint16_t lost;
+	int above = 0;
+	int n = 0;
+	uint16_t i;
+
+	if (snd->base == snd->next)
+		return 0;
+
+	/*
+	 * Cumulative ACKs that repeat themselves mean the first packet
+	 * was lost.  Go-Back-N re-sends everything after it too.
+	 */
+	if (s->dupacks >= DUPACK_THRESH) {
+		s->dupacks = 0;
+		slot = SLOT(snd, snd->base);
+		if (SLOT_SENT == slot->state && !slot->fast) {
+			for (i = snd->base; i != snd->next && n < s->batch; i++) {
+				slot = SLOT(snd, i);
+				if (SLOT_SENT != slot->state)
+					continue;
+				slot->fast = 1;
+				slot->resent = 1;
+				slots[n++] = slot;
+				if (ARQ_GBN != s->mode)
+					break;
+			}
+		}
+	}
+
+	/*
+	 * Otherwise any packet with DUPACK_THRESH packets after it
+	 * ACKed (one at a time or by a SACK) was lost.
+	 */
+	for (i = snd->next; i != snd->base && n < s->batch; ) {
+		slot = SLOT(snd, --i);
+		if (SLOT_ACKED == slot->state) {
+			above++;
+		} else if (SLOT_SENT == slot->state && !slot->fast
+				&& above >= DUPACK_THRESH + slot->fec_left) {
+			/* the receiver may still rebuild it from the parity */
+			slot->fast = 1;
+			slot->resent = 1;
+			slots[n++] = slot;
+		}
+	}
+
+	if (0 == n)
+		return 0;
+
+	/* the oldest packet lost */
+	s->stats.fast_resends += n;
+	lost = ntohs(slots[0]->pkt.seq);
+	for (i = 0; i < n; i++) {
+		trace_event(s, ARQ_EV_FAST, ntohs(slots[i]->pkt.seq), 0, 0);
+		if (seq_diff(ntohs(slots[i]->pkt.seq), lost) < 0)
+			lost = ntohs(slots[i]->pkt.seq);
+	}
+	cc_loss(s, 0, lost);
+
+	return slots_send(s, slots, n, 0);
+}
+
+static int rcv_data(struct arq_session *s, struct arq_packet *pkt,
+		size_t len);
+
+/*
+ * rcv_fec()
+ *
+ * A parity packet.  If packets of its block are missing and there
+ * is parity for as many of them, rebuild them and take them in as if
+ * they had arrived.  Packets of the block that were returned already
+ * are used as long as their slots have not been taken by new ones.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ */
+static int rcv_fec(struct arq_session *s, struct arq_packet *pkt,
+		size_t len)
+{
+	struct arq_window *rcv = &s->rcv;
+	struct arq_slot *data[FEC_MAX_K];
+	struct arq_packet *par[FEC_MAX_M];
+	int pari[FEC_MAX_M];
+	struct arq_packet *in, *out;
+	unsigned char lost[FEC_MAX_M];
+	unsigned char a[FEC_MAX_M * FEC_MAX_M];
+	unsigned char *sym;
+	unsigned char lenb[2];
+	struct arq_slot *slot;
+	unsigned char *p;
+	uint16_t first, seq;
+	size_t plen, n;
+	int missing = 0;
+	int e = 0, np = 0;
+	int i, j, k, r, t, d;
+
+	if (ARQ_SR != s->mode)
+		return 0;
+
+	first = ntohs(pkt->seq);
+	k = (unsigned char) pkt->data[0];
+	plen = len - HEADER_SZ - FEC_SZ;
+	if (0 == k || k > FEC_MAX_K || pkt->flags >= FEC_MAX_M
+			|| plen > (size_t) s->mss_max)
+		return 0;
+
+	/* the packets of the block that are here, and the ones that are not */
+	for (i = 0; i < k; i++) {
+		seq = first + i;
+		slot = SLOT(rcv, seq);
+		d = seq_diff(seq, rcv->base);
+		if ((SLOT_FULL == slot->state
+				|| (d < 0 && slot->len >= HEADER_SZ))
+				&& ntohs(slot->pkt.seq) == seq) {
+			if (slot->len - HEADER_SZ > plen)
+				return 0;  /* not the data of this parity */
+			data[i] = slot;
+			continue;
+		}
+
+		if (d >= rcv->size || e == FEC_MAX_M)
+			return 0;  /* no room for it, or too many to rebuild */
+		data[i] = NULL;
+		lost[e++] = i;
+		if (d >= 0)
+			missing++;
+	}
+	if (0 == missing)
+		return 0;
+
+	if (NULL == s->fec_in) {
+		s->fec_in = malloc(FEC_IN * s->pkt_sz);
+		s->fec_tmp = malloc(2 * s->pkt_sz);
+		if (NULL == s->fec_in || NULL == s->fec_tmp) {
+			free(s->fec_in);
+			free(s->fec_tmp);
+			s->fec_in = s->fec_tmp = NULL;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < FEC_IN; i++) {
+		in = PKT(s, s->fec_in, i);
+		if (s->fec_in_len[i] == len && in->seq == pkt->seq
+				&& in->data[0] == pkt->data[0]
+				&& in->flags == pkt->flags)
+			return 0;  /* a duplicate */
+	}
+	memcpy(PKT(s, s->fec_in, s->fec_next), pkt, len);
+	s->fec_in_len[s->fec_next] = len;
+	s->fec_next = (s->fec_next + 1) % FEC_IN;
+
+	for (i = 0; i < FEC_IN && np < e; i++) {
+		in = PKT(s, s->fec_in, i);
+		if (s->fec_in_len[i] == len && in->seq == pkt->seq
+				&& in->data[0] == pkt->data[0]) {
+			pari[np] = i;
+			par[np++] = in;
+		}
+	}
+	if (np < e)
+		return 0;  /* wait for more parity */
+
+	/*
+	 * Take the data that is here out of each parity packet, what is
+	 * left is a sum of the lost data with known coefficients.
+	 */
+	for (t = 0; t < e; t++) {
+		p = (unsigned char *) par[t]->data + 2;
+		j = par[t]->flags;
+		for (i = 0; i < k; i++) {
+			if (NULL == data[i])
+				continue;
+			n = data[i]->len - HEADER_SZ;
+			lenb[0] = n >> 8;
+			lenb[1] = n & 0xff;
+			arq_fec_mul_add(p, lenb, arq_fec_coef(j, i), 2);
+			arq_fec_mul_add(p + 2,
+					(unsigned char *) data[i]->pkt.data,
+					arq_fec_coef(j, i), n);
+		}
+		for (r = 0; r < e; r++)
+			a[t * e + r] = arq_fec_coef(j, lost[r]);
+		s->fec_in_len[pari[t]] = 0;
+	}
+
+	if (-1 == arq_fec_invert(a, e))
+		return 0;
+
+	out = (struct arq_packet *) s->fec_tmp;
+	sym = (unsigned char *) s->fec_tmp + s->pkt_sz;
+	for (r = 0; r < e; r++) {
+		seq = first + lost[r];
+		if (seq_diff(seq, rcv->base) < 0)
+			continue;  /* returned already */
+
+		memset(sym, 0, 2 + plen);
+		for (t = 0; t < e; t++)
+			arq_fec_mul_add(sym, (unsigned char *) par[t]->data + 2,
+					a[r * e + t], 2 + plen);
+
+		/* an EOF is never coded, so a length of 0 is nonsense too */
+		n = (sym[0] << 8) | sym[1];
+		if (0 == n || n > plen)
+			continue;
+
+		out->type = TYPE_DATA;
+		out->flags = 0;
+		out->seq = htons(seq);
+		memcpy(out->data, sym + 2, n);
+		if (s->crc)
+			s->crc_in = arq_crc32c(0, out->data, n);
+		s->stats.fec_recovered++;
+		if (-1 == rcv_data(s, out, HEADER_SZ + n))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int rcv_data(struct arq_session *s, struct arq_packet *pkt,
+		size_t len)
+{
+	struct arq_window *rcv = &s->rcv;
+	struct arq_slot *slot;
+	unsigned char type;
+	uint16_t seq, ack;
+	int fresh = 0;
+	int d;
+
+	seq = ntohs(pkt->seq);
+	trace_event(s, ARQ_EV_RECV, seq, pkt->flags, len - HEADER_SZ);
+
+	if (ARQ_GBN == s->mode) {
+		/*
+		 * Only the next packet in order is accepted, and only if
+		 * there is room for it.  Anything else is discarded and
+		 * the last packet accepted is ACKed again.
+		 */
+		if (seq == rcv->next
+				&& (uint16_t) (rcv->next - rcv->base) < rcv->size) {
+			slot = SLOT(rcv, seq);
+			memcpy(&slot->pkt, pkt, len);
+			slot->len = len;
+			slot->crc = s->crc_in;
+			slot->state = SLOT_FULL;
+			rcv->next++;
+			fresh = 1;
+		}
+
+		type = TYPE_CACK;
+		ack = rcv->next - 1;
+	} else {
+		d = seq_diff(seq, rcv->base);
+
+		if (d >= rcv->size)
+			return 0;  /* beyond the window, drop it without an ACK */
+
+		if (d >= 0) {
+			slot = SLOT(rcv, seq);
+			if (SLOT_FREE == slot->state) {
+				memcpy(&slot->pkt, pkt, len);
+				slot->len = len;
+				slot->crc = s->crc_in;
+				slot->state = SLOT_FULL;
+
+				/* keep track of the first one still missing */
+				if (seq != rcv->next) {
+					s->ooo++;
+				} else {
+					fresh = 1;
+					rcv->next++;
+					while ((uint16_t) (rcv->next - rcv->base)
+							< rcv->size
+							&& SLOT_FULL == SLOT(rcv,
+							rcv->next)->state) {
+						rcv->next++;
+						s->ooo--;
+						fresh = 0;
+					}
+				}
+			}
+		}
+		/* else already returned, the ACK must have been lost */
+
+		type = TYPE_ACK;
+		ack = seq;
+	}
+
+	/*
+	 * Delay the ACK of a new packet in order, as long as nothing
+	 * is missing before it, until 'ack_every' of them have arrived
+	 * and one cumulative ACK can cover them all.  Anything else,
+	 * such as a gap, a duplicate or an EOF, is ACKed at once.
+	 */
+	if (s->ack_every > 1 && fresh && 0 == s->ooo && len > HEADER_SZ) {
+		s->ack_seq = seq;
+		s->ack_echo = pkt->flags;
+		if (1 == ++s->unacked) {
+			clock_gettime(CLOCK_MONOTONIC, &s->ack_deadline);
+			ts_add_ms(&s->ack_deadline, s->ack_delay);
+		}
+		if (s->unacked < s->ack_every)
+			return 0;
+
+		ack_delayed(s);
+		type = TYPE_CACK;
+	} else if (s->unacked) {
+		ack_delayed(s);
+		if (-1 == ack_queue(s, TYPE_CACK, s->ack_seq, s->ack_echo))
+			return -1;
+	}
+
+	/* while something is missing, say what has arrived after it */
+	if (ARQ_SR == s->mode && s->ooo)
+		return sack_queue(s, seq, pkt->flags);
+
+	/*
+	 * Echo the transmission number if this packet is the one
+	 * being ACKed.  The ACK is sent along with the others from
+	 * this batch.
+	 */
+	return ack_queue(s, type, ack, (ack == seq) ? pkt->flags : 0);
+}
+
+/*
+ * arq_input()
+ *
+ * Dispatch a received packet to the send window (ACKs) or
+ * the receive window (data).  Either kind may arrive while
+ * sending or receiving.
+ */
+static int arq_input(struct arq_session *s, struct arq_packet *pkt, int n,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	uint16_t base, seq;
+	int acked;
+
+	if (n < HEADER_SZ)
+		return 0;  /* runt, ignore */
+
+	/* too large for this end, only a probe may be */
+	if ((size_t) n > s->pkt_sz && TYPE_PROBE != pkt->type)
+		return 0;
+
+	/*
+	 * A packet damaged on the way is as good as lost.  A probe is
+	 * not read whole, and is only zeros anyway.
+	 */
+	if (s->crc) {
+		if (n < HEADER_SZ + CRC_SZ)
+			return 0;
+		n -= CRC_SZ;
+		if (TYPE_PROBE != pkt->type) {
+			s->crc_in = arq_crc32c(0, pkt->data, n - HEADER_SZ);
+			if (pkt_crc(s->crc_in, pkt) != load_crc(pkt->data
+						+ n - HEADER_SZ)) {
+				s->stats.crc_errors++;
+				trace_event(s, ARQ_EV_CRC, ntohs(pkt->seq),
+						0, 0);
+				return 0;
+			}
+		}
+	}
+
+	if (s->connected) {
+		if (!sockaddr_equal(addr, addrlen,
+				(struct sockaddr *) &s->peer, s->peer_len))
+			return 0;  /* some other peer, ignore */
+	} else if (TYPE_DATA == pkt->type || TYPE_EOF == pkt->type) {
+		/* the ACKs so far belong to the old peer */
+		if (-1 == acks_flush(s))
+			return -1;
+		set_peer(s, addr, addrlen);
+		if (s != arq_default)
+			s->connected = 1;
+	}
+
+	if (TYPE_ACK == pkt->type || TYPE_CACK == pkt->type) {
+		base = s->snd.base;
+		seq = ntohs(pkt->seq);
+		acked = snd_ack(s, seq, TYPE_CACK == pkt->type, pkt->flags);
+		s->stats.acks_recv++;
+		trace_event(s, ARQ_EV_ACK, seq, acked, 0);
+		cc_ack(s, acked);
+
+		if (base != s->snd.base) {
+			s->dupacks = 0;
+		} else if (TYPE_CACK == pkt->type && base != s->snd.next) {
+			s->dupacks++;
+			s->stats.dupacks++;
+			trace_event(s, ARQ_EV_DUPACK, seq, s->dupacks, 0);
+		}
+
+		/*
+		 * An ACK past the base of the window, or a cumulative ACK
+		 * that keeps repeating, means something may be missing.
+		 */
+		if (seq_diff(seq, s->snd.base) > 0
+				|| s->dupacks >= DUPACK_THRESH)
+			return snd_fast(s);
+
+		return 0;
+	} else if (TYPE_SACK == pkt->type) {
+		if (n < SACK_SZ)
+			return 0;  /* runt, ignore */
+
+		base = s->snd.base;
+		acked = snd_sack(s, pkt);
+		s->stats.acks_recv++;
+		trace_event(s, ARQ_EV_ACK, ntohs(pkt->seq), acked, 0);
+		cc_ack(s, acked);
+		if (base != s->snd.base)
+			s->dupacks = 0;
+		return snd_fast(s);
+	} else if (TYPE_DATA == pkt->type || TYPE_EOF == pkt->type) {
+		return rcv_data(s, pkt, n);
+	} else if (TYPE_FEC == pkt->type) {
+		if (n < HEADER_SZ + FEC_SZ)
+			return 0;  /* runt, ignore */
+
+		return rcv_fec(s, pkt, n);
+	} else if (TYPE_PROBE == pkt->type) {
+		if (n < HEADER_SZ + FEC_SZ || 0 == s->peer_len)
+			return 0;
+
+		/* as much as arrived, or as much as this end can take */
+		seq = MIN(ntohs(pkt->seq), n - HEADER_SZ - FEC_SZ);
+		return ack_queue(s, TYPE_PROBE_ACK, MIN(seq, s->mss_max), 0);
+	} else if (TYPE_PROBE_ACK == pkt->type) {
+		return probe_ack(s, ntohs(pkt->seq));
+	}
+
+	return 0;
+}
+
+int arq_session_deadline(struct arq_session *s, struct timespec *ts)
+{
+	struct timespec *first;
+	struct timespec paced;
+	struct timespec timer;
+	uint64_t tick;
+
+	/* packets held for a batch are due now, or when paced */
+	if (s->held && pace_rate(s) <= 0) {
+		clock_gettime(CLOCK_MONOTONIC, ts);
+		return 1;
+	}
+
+	/* find the earliest retransmit timer, or the delayed ACK */
+	first = s->unacked ? &s->ack_deadline : NULL;
+	if (s->held) {
+		paced = s->start;
+		ts_add_ms(&paced, s->pace_next);
+		if (NULL == first || ts_diff_us(&paced, first) < 0)
+			first = &paced;
+	}
+	if (s->probe && s->probe_tries && (NULL == first
+			|| ts_diff_us(&s->probe_deadline, first) < 0))
+		first = &s->probe_deadline;
+	if (arq_wheel_next(&s->wheel, &tick)) {
+		timer = s->start;
+		ts_add_ms(&timer, tick * (TIMER_TICK_US / 1000.0));
+		if (NULL == first || ts_diff_us(&timer, first) < 0)
+			first = &timer;
+	}
+	if (NULL == first)
+		return 0;
+
+	*ts = *first;
+
+	return 1;
+}
+
+/* expired timers that were not dealt with, again at the next tick */
+static void timers_again(struct arq_session *s, struct arq_timer *t)
+{
+	struct arq_timer *next;
+
+	for (; t; t = next) {
+		next = t->next;
+		arq_timer_add(&s->wheel, t, 0);
+	}
+}
+
+/*
+ * snd_expire()
+ *
+ * Re-send every packet whose timer has expired, or with Go-Back-N
+ * everything from the first of them on.
+ *
+ * Returns: 1 if all is well, 0 if a packet has been re-sent
+ * more than MAX_RESEND times, -1 on error.
+ */
+static int snd_expire(struct arq_session *s, int flags)
+{
+	struct arq_window *snd = &s->snd;
+	struct arq_slot *slots[ARQ_MAX_BATCH];
+	struct arq_timer *expired, *t, *next;
+	struct timespec now;
+	struct arq_slot *slot;
+	uint16_t first = 0, seq;
+	int lost = 0;
+	int n = 0;
+
+	if (-1 == snd_flush(s, flags))
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	expired = arq_wheel_expire(&s->wheel, wheel_tick(s, &now));
+	if (NULL == expired)
+		return 1;
+
+	/* the oldest of them is the loss, with Go-Back-N the only one */
+	for (t = expired; t; t = t->next) {
+		seq = ntohs(TIMER_SLOT(t)->pkt.seq);
+		s->stats.timeouts++;
+		trace_event(s, ARQ_EV_TIMEOUT, seq,
+				TIMER_SLOT(t)->num_resend, 0);
+		if (!lost || seq_diff(seq, first) < 0)
+			first = seq;
+		lost = 1;
+	}
+
+	for (t = expired; t; t = t->next) {
+		slot = TIMER_SLOT(t);
+		if ((ARQ_SR == s->mode || ntohs(slot->pkt.seq) == first)
+				&& slot->num_resend >= MAX_RESEND) {
+			/* give up, until the caller starts them over */
+			s->stats.give_ups++;
+			trace_event(s, ARQ_EV_GIVEUP, ntohs(slot->pkt.seq),
+					0, 0);
+			timers_again(s, expired);
+			return 0;
+		}
+	}
+
+	/*
+	 * Until the first ACK is measured a timeout below the RTT
+	 * re-sends every packet, and then Karn's rule never lets it be
+	 * measured.  Back off the starting value, once for each time
+	 * the oldest packet in flight times out.
+	 */
+	if (0 == s->srtt) {
+		for (seq = snd->base; seq != first
+				&& SLOT_SENT != SLOT(snd, seq)->state; seq++)
+			;
+		if (seq == first)
+			s->rto = MIN(2 * s->rto, RTO_MAX_MS);
+	}
+
+	if (ARQ_GBN == s->mode) {
+		timers_again(s, expired);
+		SLOT(snd, first)->num_resend++;
+		for (seq = first; seq != snd->next; seq++) {
+			slot = SLOT(snd, seq);
+			if (SLOT_SENT != slot->state)
+				continue;
+
+			slot->resent = 1;
+			slot->fast = 0;
+			slots[n++] = slot;
+			if (n == s->batch) {
+				if (-1 == slots_send(s, slots, n, flags))
+					return -1;
+				n = 0;
+			}
+		}
+	} else {
+		for (t = expired; t; t = next) {
+			next = t->next;
+			arq_timer_add(&s->wheel, t, 0);
+			slot = TIMER_SLOT(t);
+			slot->num_resend++;
+			slot->resent = 1;
+			slot->fast = 0;
+			slots[n++] = slot;
+			if (n == s->batch) {
+				if (-1 == slots_send(s, slots, n, flags)) {
+					timers_again(s, next);
+					return -1;
+				}
+				n = 0;
+			}
+		}
+	}
+
+	cc_loss(s, 1, first);
+
+	if (n && -1 == slots_send(s, slots, n, flags))
+		return -1;
+
+	return 1;
+}
+
+/*
+ * dgram_input()
+ *
+ * Input the datagram of 'len' bytes at 'buf', or the segments of
+ * 'seg' bytes it holds with GRO.
+ */
+static int dgram_input(struct arq_session *s, char *buf, int len, int seg,
+		struct sockaddr *addr, socklen_t addrlen)
+{
+	char *pkt;
+	int off;
+
+	if (seg <= 0)
+		seg = len;
+
+	for (off = 0; off < len; off += seg) {
+		pkt = buf + off;
+		/* a segment of an odd size leaves the next unaligned */
+		if (off & 1) {
+			memcpy(s->rx_tmp, pkt, MIN((size_t) seg, s->pkt_sz));
+			pkt = s->rx_tmp;
+		}
+		if (-1 == arq_input(s, (struct arq_packet *) pkt,
+					MIN(seg, len - off), addr, addrlen))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * uring_rx()
+ *
+ * Read up to 'batch' datagrams that arrived in the io_uring, the
+ * same as arq_rx() does from the socket.  Their buffers are given
+ * back once they have been input.
+ */
+static int uring_rx(struct arq_session *s, struct arq_uring *u, int flags)
+{
+	struct arq_dgram d[ARQ_MAX_BATCH];
+	struct timespec now = { 0, 0 };
+	int i, n, r = 0;
+
+	n = arq_uring_recv(u, d, s->batch,
+			(flags & MSG_DONTWAIT) ? &now : NULL);
+	if (-1 == n)
+		return -1;
+
+	for (i = 0; i < n && r != -1; i++) {
+		r = dgram_input(s, d[i].data, d[i].len, d[i].seg,
+				d[i].addr, d[i].addrlen);
+	}
+	arq_uring_done(u, d, n);
+	if (-1 == r)
+		return -1;
+
+	if (-1 == acks_flush(s))
+		return -1;
+
+	return n;
+}
+
+/*
+ * arq_rx()
+ *
+ * Read up to 'batch' datagrams with one system call and input
+ * them, then send their ACKs.  Only the first one is waited for,
+ * or none of them with MSG_DONTWAIT.  With GRO a datagram read may
+ * hold several segments of the same size, which are input one by
+ * one.  The length is the real one (MSG_TRUNC) so that a datagram
+ * too large for the buffer is known.
+ *
+ * Returns: the number of datagrams read, -1 on error with errno set.
+ */
+static int arq_rx(struct arq_session *s, int flags)
+{
+	struct mmsghdr msgs[ARQ_MAX_BATCH];
+	struct iovec iov[ARQ_MAX_BATCH];
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		size_t align;	/* as a struct cmsghdr */
+	} ctl[ARQ_MAX_BATCH];
+	struct cmsghdr *cmsg;
+	struct arq_uring *u;
+	int seg, len;
+	int on = 1;
+	int i, n;
+
+	if ((s->offload & ARQ_GRO) && !s->gro_on) {
+		if (-1 == setsockopt(s->sockfd, SOL_UDP, UDP_GRO,
+					&on, sizeof(on)))
+			s->offload &= ~ARQ_GRO;
+		else
+			s->gro_on = 1;
+	}
+
+	u = uring_get(s);
+	if (u) {
+		n = uring_rx(s, u, flags);
+		if (n != -1 || errno != EOPNOTSUPP)
+			return n;
+		/* no multishot recvmsg, the socket is read instead */
+		s->offload &= ~ARQ_URING;
+	}
+
+	memset(msgs, 0, s->batch * sizeof(*msgs));
+	for (i = 0; i < s->batch; i++) {
+		iov[i].iov_base = s->rx + i * s->rx_sz;
+		iov[i].iov_len = s->rx_sz;
+		msgs[i].msg_hdr.msg_name = &s->rx_addr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(s->rx_addr[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (s->gro_on) {
+			msgs[i].msg_hdr.msg_control = ctl[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctl[i].buf);
+		}
+	}
+
+	s->stats.syscalls++;
+	n = recvmmsg(s->sockfd, msgs, s->batch,
+			flags | MSG_WAITFORONE | MSG_TRUNC, NULL);
+	if (-1 == n)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		len = msgs[i].msg_len;
+		seg = len;
+		for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+				cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+			if (SOL_UDP == cmsg->cmsg_level
+					&& UDP_GRO == cmsg->cmsg_type)
+				memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+		}
+		if (-1 == dgram_input(s, s->rx + i * s->rx_sz, len, seg,
+					(struct sockaddr *) &s->rx_addr[i],
+					msgs[i].msg_hdr.msg_namelen))
+			return -1;
+	}
+
+	if (-1 == acks_flush(s))
+		return -1;
+
+	return n;
+}
+
+/*
+ * snd_wait()
+ *
+ * Wait for ACKs or for the earliest retransmit timer to expire,
+ * re-sending any packets whose timer has expired.
+ *
+ * Returns: 1 if progress was made, 0 if a packet has been re-sent
+ * more than MAX_RESEND times, -1 on error.
+ */
+static int snd_wait(struct arq_session *s, int flags)
+{
+	struct timespec now;
+	struct timespec first;
+	struct timespec wait;
+	struct pollfd pfd;
+	int n;
+
+	if (-1 == snd_flush(s, flags))
+		return -1;
+
+	if (!arq_session_deadline(s, &first))
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/*
+	 * Wait for data or a time out.  The timeout is kept to the
+	 * nanosecond since pacing needs much finer steps than a
+	 * retransmit timer.
+	 */
+	if (first.tv_sec > now.tv_sec || (first.tv_sec == now.tv_sec
+			&& first.tv_nsec > now.tv_nsec)) {
+		wait.tv_sec = first.tv_sec - now.tv_sec;
+		wait.tv_nsec = first.tv_nsec - now.tv_nsec;
+		if (wait.tv_nsec < 0) {
+			wait.tv_sec--;
+			wait.tv_nsec += 1000000000;
+		}
+
+		if (uring_get(s)) {
+			if (-1 == arq_uring_wait(s->uring, &wait))
+				return -1;
+		} else {
+			pfd.fd = s->sockfd;
+			pfd.events = POLLIN;
+
+			s->stats.syscalls++;
+			n = ppoll(&pfd, 1, &wait, NULL);
+			if (-1 == n)
+				return -1;
+		}
+	}
+
+	/*
+	 * Drain every ACK that is waiting before deciding what
+	 * has timed out, otherwise a slow reader re-sends
+	 * packets that have already been ACKed.  A short batch
+	 * means the socket is empty.  Reading stops once there is
+	 * data to return, otherwise a small receive window has to
+	 * throw away the data behind it.
+	 */
+	do {
+		n = arq_rx(s, MSG_DONTWAIT);
+		if (-1 == n) {
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			return -1;
+		}
+	} while (n == s->batch
+			&& SLOT_FULL != SLOT(&s->rcv, s->rcv.base)->state);
+
+	if (-1 == ack_expire(s) || -1 == probe_expire(s))
+		return -1;
+
+	return snd_expire(s, flags);
+}
+
+/* give everything in flight a fresh set of resends */
+static void snd_renew(struct arq_session *s)
+{
+	uint16_t i;
+
+	for (i = s->snd.base; i != s->snd.next; i++)
+		SLOT(&s->snd, i)->num_resend = 0;
+}
+
+/* the total length of the buffers in 'iov' */
+static size_t iov_total(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	return len;
+}
+
+/* gather the first 'n' bytes of 'iov' into 'dst' */
+static void iov_get(char *dst, const struct iovec *iov, size_t n)
+{
+	size_t m;
+
+	for (; n; iov++) {
+		m = MIN(n, iov->iov_len);
+		memcpy(dst, iov->iov_base, m);
+		dst += m;
+		n -= m;
+	}
+}
+
+/*
+ * iov_put()
+ *
+ * Scatter 'n' bytes of 'src' into 'iov' starting at offset '*off' of
+ * buffer '*i', and move both past them.
+ */
+static void iov_put(const struct iovec *iov, int *i, size_t *off,
+		const char *src, size_t n)
+{
+	size_t m;
+
+	while (n) {
+		m = MIN(n, iov[*i].iov_len - *off);
+		memcpy((char *) iov[*i].iov_base + *off, src, m);
+		src += m;
+		n -= m;
+		*off += m;
+		if (*off == iov[*i].iov_len) {
+			(*i)++;
+			*off = 0;
+		}
+	}
+}
+
+/*
+ * snd_queue()
+ *
+ * Put the next packet in the window and send it, as either a copy
+ * of the start of 'iov' or with 'ref' set a reference to the first
+ * buffer.
+ */
+static int snd_queue(struct arq_session *s, const struct iovec *iov,
+		int iovcnt, int flags, int ref)
+{
+	struct arq_window *snd = &s->snd;
+	struct arq_slot *slot;
+	size_t len = iov_total(iov, iovcnt);
+	size_t data_len;
+	uint32_t digest = s->digest_out;
+	int n;
+
+	if (0 == s->peer_len) {
+		errno = EDESTADDRREQ;
+		return -1;
+	}
+
+	/* without blocking there must be room for it right now */
+	if (flags & MSG_DONTWAIT) {
+		if ((uint16_t) (snd->next - snd->base) >= snd_limit(s)
+				|| (0 == len && snd->next != snd->base)) {
+			/* nothing more is coming for this batch */
+			if (-1 == snd_flush(s, 0))
+				return -1;
+			if (0 == len && -1 == fec_finish(s))
+				return -1;
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	/*
+	 * Everything before an EOF must be ACKed first, just as it
+	 * would have been with Stop and Wait.  On a give up the EOF
+	 * is not in the window yet, so there is nothing to take back.
+	 */
+	while (0 == len && snd->next != snd->base) {
+		if (-1 == snd_flush(s, flags) || -1 == fec_finish(s))
+			return -1;
+
+		n = snd_wait(s, flags);
+		if (-1 == n)
+			return -1;
+
+		if (0 == n) {
+			snd_renew(s);
+			errno = ETIMEDOUT;
+			return 0;
+		}
+	}
+
+	/* the EOF is never coded, the next data starts a new block */
+	if (0 == len)
+		s->fec_n = 0;
+
+	/* the first probe waits for the RTT, which times it out */
+	if (s->probe && 0 == s->probe_tries && s->srtt > 0
+			&& -1 == probe_send(s))
+		return -1;
+
+	/* build the ARQ packet to be sent */
+	data_len = MIN(len, (size_t) s->mss);
+	slot = SLOT(snd, snd->next);
+	slot->pkt.type = TYPE_DATA;
+	slot->pkt.flags = 0;
+	slot->pkt.seq = htons(snd->next);
+	slot->ref = (ref && data_len) ? iov->iov_base : NULL;
+	if (!ref)
+		iov_get(slot->pkt.data, iov, data_len);
+	slot->len = HEADER_SZ + data_len;
+	if (s->crc && 0 == len) {
+		/* the digest of everything since the last EOF */
+		slot->pkt.type = TYPE_EOF;
+		slot->crc = htonl(s->digest_out);
+		memcpy(slot->pkt.data, &slot->crc, CRC_SZ);
+		slot->len += CRC_SZ;
+		slot->crc = arq_crc32c(0, slot->pkt.data, CRC_SZ);
+		s->digest_out = 0;
+	} else if (s->crc) {
+		slot->crc = arq_crc32c(0, SLOT_DATA(slot), data_len);
+		s->digest_out = digest_add(s->digest_out, slot->crc);
+	}
+	slot->state = SLOT_HELD;
+	slot->num_resend = 0;
+	slot->resent = 0;
+	slot->fast = 0;
+	slot->fec_left = 0;
+	slot->tx = 0;
+	snd->next++;
+	s->held++;
+	s->stats.bytes_sent += data_len;
+	/* 'data_len' might be less than the requested 'len' */
+
+	/*
+	 * The packet is in the window now, so it must not fail with
+	 * EAGAIN on a full socket buffer.  A short block is fine.
+	 */
+	if (s->held >= s->batch && -1 == snd_flush(s, flags & ~MSG_DONTWAIT))
+		return -1;
+
+	if (flags & MSG_DONTWAIT)
+		return data_len;
+
+	/*
+	 * Wait while the window is full, or for an EOF,
+	 * until everything has been ACKed.
+	 */
+	while ((uint16_t) (snd->next - snd->base) >= snd_limit(s)
+			|| (0 == len && snd->next != snd->base)) {
+		n = snd_wait(s, flags);
+		if (-1 == n)
+			return -1;
+
+		if (0 == n) {
+			/*
+			 * Give up.  Take this packet back out of the
+			 * window so the caller can send it again, and
+			 * give the others a fresh set of resends.  It
+			 * may still be held by pacing.
+			 */
+			snd->next--;
+			if (SLOT_HELD == slot->state)
+				s->held--;
+			arq_timer_del(&s->wheel, &slot->timer);
+			slot->state = SLOT_FREE;
+			s->stats.bytes_sent -= data_len;
+			s->digest_out = digest;
+			snd_renew(s);
+			errno = ETIMEDOUT;
+
+			return 0;
+		}
+	}
+
+	return data_len;
+}
+
+int arq_session_send(struct arq_session *s, const void *buf, size_t len,
+		int flags)
+{
+	struct iovec iov = { (void *) buf, len };
+
+	return snd_queue(s, &iov, 1, flags, 0);
+}
+
+int arq_session_send_ref(struct arq_session *s, const void *buf, size_t len,
+		int flags)
+{
+	struct iovec iov = { (void *) buf, len };
+
+	return snd_queue(s, &iov, 1, flags, 1);
+}
+
+int arq_session_sendv(struct arq_session *s, const struct iovec *iov,
+		int iovcnt, int flags)
+{
+	if (iovcnt < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return snd_queue(s, iov, iovcnt, flags, 0);
+}
+
+/*
+ * rcv_take()
+ *
+ * Take the packet at the base of the receive window, whose data has
+ * been returned, and add it to the digest.
+ *
+ * Returns: 0, or -1 with errno EBADMSG for an EOF whose digest is
+ * not the one of the data.
+ */
+static int rcv_take(struct arq_session *s, struct arq_slot *slot,
+		size_t data_len)
+{
+	uint32_t digest;
+	int ok = 1;
+
+	slot->state = SLOT_FREE;
+	s->stats.bytes_recv += data_len;
+	s->rcv.base++;
+
+	if (TYPE_EOF == slot->pkt.type && s->crc) {
+		memcpy(&digest, slot->pkt.data, sizeof(digest));
+		ok = (ntohl(digest) == s->digest_in);
+		s->digest_in = 0;
+	} else if (s->crc) {
+		s->digest_in = digest_add(s->digest_in, slot->crc);
+	}
+
+	if (!ok) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the data of a packet that was received, none for an EOF */
+static size_t rcv_len(struct arq_slot *slot)
+{
+	if (TYPE_EOF == slot->pkt.type)
+		return 0;
+
+	return slot->len - HEADER_SZ;
+}
+
+/*
+ * rcv_wait()
+ *
+ * Wait until the next packet in order has arrived.
+ *
+ * Returns: 0 once it is there, -1 on error.
+ */
+static int rcv_wait(struct arq_session *s, int flags)
+{
+	struct arq_window *rcv = &s->rcv;
+	int n;
+
+	/* receive until the next packet in order is available */
+	while (SLOT_FULL != SLOT(rcv, rcv->base)->state) {
+
+		/* only what has already been given to arq_session_input() */
+		if (flags & MSG_DONTWAIT) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		/*
+		 * Packets that were sent but not yet ACKed, such as a
+		 * request, must still be re-sent while waiting for data.
+		 */
+		if (s->snd.base != s->snd.next) {
+			n = snd_wait(s, 0);
+			if (-1 == n)
+				return -1;
+			if (0 == n)
+				snd_renew(s);
+			continue;
+		}
+
+		/*
+		 * A delayed ACK must be sent in time, so only wait for
+		 * data until then, unless some is already waiting.
+		 */
+		if (s->unacked) {
+			n = arq_rx(s, MSG_DONTWAIT);
+			if (-1 == n) {
+				if (EAGAIN != errno && EWOULDBLOCK != errno)
+					return -1;
+				if (-1 == snd_wait(s, 0))
+					return -1;
+			}
+			continue;
+		}
+
+		if (-1 == arq_rx(s, flags))
+			return -1;
+	}
+
+	return 0;
+}
+
+int arq_session_recv(struct arq_session *s, void *buf, size_t len,
+		int flags)
+{
+	struct arq_window *rcv = &s->rcv;
+	struct arq_slot *slot;
+	size_t data_len;
+
+	if (-1 == rcv_wait(s, flags))
+		return -1;
+
+	/* save the data, and go on to the next sequence number */
+	slot = SLOT(rcv, rcv->base);
+	data_len = MIN(len, rcv_len(slot));
+	memcpy(buf, slot->pkt.data, data_len);
+	if (-1 == rcv_take(s, slot, data_len))
+		return -1;
+
+	return data_len;
+}
+
+int arq_session_recvv(struct arq_session *s, const struct iovec *iov,
+		int iovcnt, int flags)
+{
+	struct arq_window *rcv = &s->rcv;
+	struct arq_slot *slot;
+	size_t len, data_len;
+	size_t total = 0;
+	size_t off = 0;
+	int i = 0;
+
+	if (iovcnt < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	len = iov_total(iov, iovcnt);
+
+	if (-1 == rcv_wait(s, flags))
+		return -1;
+
+	/*
+	 * Everything that is here in order and fits, but after some
+	 * data the EOF is left for the next call to return.
+	 */
+	do {
+		slot = SLOT(rcv, rcv->base);
+		data_len = rcv_len(slot);
+		if (total && (0 == data_len || data_len > len - total))
+			break;
+		data_len = MIN(data_len, len - total);
+
+		iov_put(iov, &i, &off, slot->pkt.data, data_len);
+		if (-1 == rcv_take(s, slot, data_len))
+			return -1;
+		total += data_len;
+	} while (data_len && total < len
+			&& SLOT_FULL == SLOT(rcv, rcv->base)->state);
+
+	return total;
+}
+
+int arq_session_input(struct arq_session *s, const void *buf, size_t len,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	/* a copy that can be changed, and is aligned */
+	memcpy(s->rx, buf, MIN(len, s->pkt_sz));
+
+	if (-1 == arq_input(s, (struct arq_packet *) s->rx, len, addr, addrlen))
+		return -1;
+
+	return acks_flush(s);
+}
+
+int arq_session_flush(struct arq_session *s)
+{
+	return snd_flush(s, 0);
+}
+
+int arq_session_expire(struct arq_session *s)
+{
+	int n;
+
+	if (-1 == ack_expire(s) || -1 == probe_expire(s))
+		return -1;
+
+	n = snd_expire(s, 0);
+	if (0 == n)
+		snd_renew(s);
+
+	return n;
+}
+
+int arq_session_pending(struct arq_session *s)
+{
+	return (uint16_t) (s->snd.next - s->snd.base);
+}
+
+int arq_session_mss(struct arq_session *s)
+{
+	return s->mss;
+}
+
+int arq_session_peer(struct arq_session *s,
+		struct sockaddr *addr, socklen_t *addrlen)
+{
+	if (0 == s->peer_len) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	memcpy(addr, &s->peer, MIN(*addrlen, s->peer_len));
+	*addrlen = s->peer_len;
+
+	return 0;
+}
+
+/*
+ * The original interface uses a single session for the whole
+ * process which is created the first time it is needed.
+ */
+static int arq_init()
+{
+	if (NULL == arq_default)
+		arq_default = arq_session_new(-1, NULL, 0);
+
+	return (NULL == arq_default) ? -1 : 0;
+}
+
+void reset_seq() {
+	if (arq_init())
+		return;
+
+	arq_session_reset(arq_default);
+}
+
+int arq_set_window(int window)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_window(arq_default, window);
+}
+
+int arq_set_mode(int mode)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_mode(arq_default, mode);
+}
+
+int arq_set_delack(int every, double ms)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_delack(arq_default, every, ms);
+}
+
+int arq_set_pacing(double rate)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_pacing(arq_default, rate);
+}
+
+int arq_set_fec(int k, int m)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_fec(arq_default, k, m);
+}
+
+int arq_set_mss(int mss, int probe)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_mss(arq_default, mss, probe);
+}
+
+int arq_set_offload(int flags)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_offload(arq_default, flags);
+}
+
+int arq_set_crc(int on)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	return arq_session_set_crc(arq_default, on);
+}
+
+int arq_sendto(int sockfd, const void *buf, size_t len,
+		int flags, const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	arq_default->sockfd = sockfd;
+	set_peer(arq_default, dest_addr, addrlen);
+
+	return arq_session_send(arq_default, buf, len, flags);
+}
+
+int arq_sendv(int sockfd, const struct iovec *iov, int iovcnt,
+		int flags, const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	if (-1 == arq_init())
+		return -1;
+
+	arq_default->sockfd = sockfd;
+	set_peer(arq_default, dest_addr, addrlen);
+
+	return arq_session_sendv(arq_default, iov, iovcnt, flags);
+}
+
+int arq_recvfrom(int sockfd, void *buf, size_t len,
+		int flags, struct sockaddr *src_addr, socklen_t *addrlen)
+{
+	int n;
+
+	if (-1 == arq_init())
+		return -1;
+
+	arq_default->sockfd = sockfd;
+
+	n = arq_session_recv(arq_default, buf, len, flags);
+	if (-1 == n)
+		return -1;
+
+	/* update the receive addresses */
+	if (src_addr != NULL)
+		arq_session_peer(arq_default, src_addr, addrlen);
+
+	return n;
+}
+
+int arq_recvv(int sockfd, const struct iovec *iov, int iovcnt,
+		int flags, struct sockaddr *src_addr, socklen_t *addrlen)
+{
+	int n;
+
+	if (-1 == arq_init())
+		return -1;
+
+	arq_default->sockfd = sockfd;
+
+	n = arq_session_recvv(arq_default, iov, iovcnt, flags);
+	if (-1 == n)
+		return -1;
+
+	if (src_addr != NULL)
+		arq_session_peer(arq_default, src_addr, addrlen);
+
+	return n;
 }
@@ -5,15 +5,113 @@
  * the functions provided here makes it reliable by using an
  * Automatic Repeat Request (ARQ) scheme.
  *
- * The ARQ scheme uses a 1 bit sequence number and no sliding window.
- * Every send must get an ACK with the expected sequence number otherwise
+ * The ARQ scheme is Selective Repeat with a 16 bit sequence number
+ * and a sliding window.  Up to 'window' packets may be in flight at
+ * once, each with its own retransmit timer, and the receiver buffers
+ * packets that arrive out of order until the gap before them is filled.
+ * Every packet must get an ACK with its sequence number otherwise
  * it will be re-sent.
  *
- * The timeout between re-sends without an ACK can be configured using
- * the TIMEOUT_MS define.  There is some optimal value which is dependent
- * upon the network being used.  If it is too small, too many resends
- * will be made, which will increase traffic and reduce throughput. If
- * it is too large the timeout will cause it to be slow.
+ * With a window of 1 (the default) this is the original Stop and Wait
+ * scheme, every send waits for its ACK before returning.
+ *
+ *   arq_set_window(32);
+ *
+ * Go-Back-N can be used instead of Selective Repeat.  The receiver
+ * then only accepts packets in order and sends cumulative ACKs, and
+ * the sender re-sends everything after a lost packet.  This needs no
+ * buffering on the receiver, which can use a window of 1 while the
+ * sender still keeps its whole window in flight.
+ *
+ *   arq_set_mode(ARQ_GBN);
+ *
+ * All of the state for a transfer (sequence numbers, windows, timers
+ * and the peer address) is kept in a session.  The arq_session_*()
+ * functions only use the session they are given, so different
+ * sessions can be used from different threads.  Many sessions can
+ * share a socket, each one talks to a single peer.
+ *
+ *   s = arq_session_new(sockfd, res->ai_addr, res->ai_addrlen);
+ *   arq_session_set_window(s, 32);
+ *   n = arq_session_send(s, buf, len, 0);
+ *   n = arq_session_recv(s, buf, sizeof(buf), 0);
+ *   arq_session_free(s);
+ *
+ * The original arq_sendto()/arq_recvfrom() interface uses one
+ * session for the whole process and is not reentrant.
+ *
+ * With a window, datagrams can be sent and received in batches to
+ * save system calls.  New packets are held until 'batch' of them can
+ * be sent with one sendmmsg(), and ACKs are read with one recvmmsg().
+ *
+ *   arq_session_set_batch(s, 16);
+ *
+ * The receiver can also delay its ACKs and send one cumulative ACK
+ * for every few packets that arrive in order, which saves datagrams
+ * and system calls on the way back.
+ *
+ *   arq_session_set_delack(s, 2, ACK_DELAY_MS);
+ *
+ * The timeout between re-sends without an ACK adapts to the network
+ * being used.  If it is too small, too many resends will be made, which
+ * will increase traffic and reduce throughput.  If it is too large the
+ * timeout will cause it to be slow.  The round trip time (RTT) of every
+ * ACK is measured and the timeout is the smoothed RTT plus four times
+ * its variance (Jacobson/Karels).  Packets that have been re-sent are
+ * not measured (Karn's rule) and every timeout doubles the timeout
+ * until the next measurement.  TIMEOUT_MS is only the starting value
+ * and the timeout is kept between RTO_MIN_MS and RTO_MAX_MS.
+ *
+ * While there is a gap in the data received, Selective Repeat sends
+ * selective ACKs (SACK) that carry the cumulative ACK and a bitmap of
+ * the packets received after it.  A packet is re-sent at once when
+ * DUPACK_THRESH packets after it are known to have arrived, so a burst
+ * of losses is repaired in about one RTT instead of one timeout each.
+ *
+ * The window is only the most that may be in flight.  A congestion
+ * control algorithm can keep less in flight (the congestion window,
+ * cwnd) to find out what the path can take, growing it as ACKs
+ * arrive and shrinking it on a loss.
+ *
+ *   arq_session_set_cc(s, &arq_cc_cubic);
+ *
+ * New packets can be paced, sent evenly spread out at a given rate
+ * or at the rate of one congestion window per RTT, instead of as a
+ * burst that overflows the queues along the way.
+ *
+ *   arq_session_set_pacing(s, ARQ_PACE_CWND);
+ *
+ * A loss still costs at least a round trip before the packet is
+ * re-sent.  With forward error correction (FEC) the sender follows
+ * every block of k data packets with m parity packets, and a
+ * Selective Repeat receiver rebuilds up to m lost packets of the
+ * block from them without waiting for a re-send.
+ *
+ *   arq_session_set_fec(s, 16, 2);
+ *
+ * Packets carry up to DATA_SZ bytes of data unless a larger maximum
+ * is set.  The sender then probes the path for the largest packet
+ * that arrives whole and that the receiver can take.  On Linux a run
+ * of packets can also be given to the kernel as one large datagram to
+ * be split up (UDP GSO), and read back as one (UDP GRO).
+ *
+ *   arq_session_set_mss(s, ARQ_MAX_MSS, 1);
+ *   arq_session_set_offload(s, ARQ_GSO | ARQ_GRO);
+ *
+ * Damaged packets are normally only caught by the UDP checksum.  With
+ * a CRC32C at the end of every packet they are caught end to end and
+ * dropped as if they were lost, and the EOF checks a digest of all of
+ * the data since the last one.
+ *
+ *   arq_session_set_crc(s, 1);
+ *
+ * Each batch still costs a system call, or two with the wait for it.
+ * Through an io_uring the datagrams that arrive are read into a ring
+ * of buffers without being asked for, and a batch of sends is queued
+ * and given to the kernel with one call, or none with a kernel thread.
+ * It is used if the kernel has it (Linux 6.0) and the socket otherwise.
+ *
+ *   arq_session_set_offload(s, ARQ_URING);
  *
  * Author:
  *
@@ -32,48 +130,866 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "unreliable_sendto.h"
 
 #define TIMEOUT_MS 0.5
+#define RTO_MIN_MS 0.2
+#define RTO_MAX_MS 1000
+
+/* below RTO_MIN_MS, a delayed ACK alone never causes a re-send */
+#define ACK_DELAY_MS 0.1
 
 #define MAXLINE 1300
-#define HEADER_SZ	2
+#define HEADER_SZ	4
 #define ACK_SZ		HEADER_SZ
-#define DATA_SZ		MAXLINE - HEADER_SZ
+#define SACK_BITS	64
+#define SACK_SZ		(HEADER_SZ + 2 + SACK_BITS / 8)
+#define DATA_SZ		(MAXLINE - HEADER_SZ)
+/*
+ * The data of a parity packet starts with the number of data packets
+ * in its block and a 0, then the parity of the (uint16_t) length in
+ * network byte order and of the data, padded with zeros to the
+ * longest one.
+ */
+#define FEC_SZ		4
 #define MAXDATA		DATA_SZ
 
+/* the CRC32C at the end of every packet, see arq_session_set_crc() */
+#define CRC_SZ		4
+
+/* the most data a packet can carry, its parity fills a UDP datagram */
+#define ARQ_MAX_MSS	(65507 - HEADER_SZ - FEC_SZ - CRC_SZ)
+
 struct arq_packet {
 	/* header */
 	unsigned char type;
-	unsigned char seq;
-	/* data */
-	char data[DATA_SZ];
+	unsigned char flags;	/* transmission number of data,
+				   echoed by its ACK (0 for none) */
+	uint16_t seq;		/* network byte order */
+	/* data, parity packets (TYPE_FEC) have FEC_SZ more, and either
+	   may go on past the end with a larger maximum */
+	char data[DATA_SZ + FEC_SZ];
 };
 
 enum {
 	TYPE_ACK,
-	TYPE_DATA
+	TYPE_DATA,
+	TYPE_CACK,	/* cumulative ACK, everything up to seq */
+	TYPE_SACK,	/* cumulative ACK up to seq, then in the data the
+			   (uint16_t) seq of the packet that caused it and a
+			   bitmap of the SACK_BITS packets after seq */
+	TYPE_FEC,	/* parity 'flags' of the block starting at seq,
+			   see FEC_SZ */
+	TYPE_PROBE,	/* FEC_SZ + seq bytes of zeros, is a packet with
+			   seq bytes of data too large for the path? */
+	TYPE_PROBE_ACK,	/* a probe arrived with seq bytes of data, or
+			   this end takes no more than seq */
+	TYPE_EOF	/* the EOF with a CRC, the data is the digest */
+};
+
+enum {
+	ARQ_GSO = 1,	/* UDP generic segmentation offload */
+	ARQ_GRO = 2,	/* UDP generic receive offload */
+	ARQ_URING = 4,	/* datagrams through an io_uring */
+	ARQ_SQPOLL = 8	/* with a kernel thread taking the sends */
+};
+
+enum {
+	ARQ_SR,		/* Selective Repeat */
+	ARQ_GBN		/* Go-Back-N */
 };
 
 #define MIN(a, b) ( ((a) < (b)) ? (a) : (b))
 
-extern int seq;
-extern int recv_seq;
+/*
+ * The window must stay below half of the 16 bit sequence space
+ * so that a new packet can never be mistaken for an old one.
+ */
+#define ARQ_MAX_WINDOW 4096
 
 #define MAX_RESEND 3
 
+/*
+ * A packet is re-sent without waiting for its timer once this many
+ * packets sent after it have been ACKed, or this many cumulative
+ * ACKs in a row did not move the window (fast retransmit).
+ */
+#define DUPACK_THRESH 3
+
+/* a probe is sent this many times before a smaller one is tried */
+#define PROBE_TRIES 3
+
+/* most datagrams sent or received with one system call */
+#define ARQ_MAX_BATCH 64
+
+struct arq_stats {
+	unsigned long syscalls;		/* send, receive and poll calls */
+	unsigned long long bytes_sent;	/* data sent, not counting resends */
+	unsigned long long bytes_recv;	/* data received */
+	unsigned long packets_sent;	/* data packets, every copy */
+	unsigned long packets_resent;	/* copies after the first */
+	unsigned long acks_sent;	/* ACK datagrams */
+	unsigned long fec_sent;		/* parity packets */
+	unsigned long fec_recovered;	/* data packets rebuilt from them */
+	unsigned long crc_errors;	/* packets dropped for their CRC */
+	unsigned long long bytes_resent;	/* data in the copies after
+						   the first */
+	unsigned long acks_recv;	/* ACK datagrams */
+	unsigned long dupacks;		/* cumulative ACKs that did not
+					   move the window */
+	unsigned long timeouts;		/* retransmit timers expired */
+	unsigned long fast_resends;	/* packets found lost by ACKs */
+	unsigned long give_ups;		/* a packet was re-sent MAX_RESEND
+					   times without an ACK */
+	unsigned long rtt_samples;	/* ACKs whose RTT was measured */
+	double rtt_min_ms;		/* of the samples */
+	double rtt_avg_ms;
+	double rtt_max_ms;
+	double srtt_ms;			/* smoothed, as it is now */
+	double rto_ms;			/* the timeout, as it is now */
+	unsigned long acks_delayed;	/* delayed cumulative ACKs */
+	double ack_delay_avg_ms;	/* from the first packet they cover */
+	double ack_delay_max_ms;
+};
+
+/*
+ * A record of the binary event trace (arq_session_set_events()).
+ * The file is a sequence of them in the byte order of the host,
+ * arq-trace prints it as CSV.
+ */
+struct arq_event {
+	uint64_t us;		/* CLOCK_MONOTONIC */
+	uint32_t session;	/* numbered as they are created, from 1 */
+	uint16_t type;		/* ARQ_EV_* */
+	uint16_t seq;
+	uint32_t arg;		/* depends on the type */
+	uint32_t len;		/* data in the packet */
+};
+
+enum {
+	ARQ_EV_SEND = 1,	/* a new data packet, 'arg' is 1 */
+	ARQ_EV_RESEND,		/* a copy, 'arg' its transmission number */
+	ARQ_EV_TIMEOUT,		/* its timer expired */
+	ARQ_EV_FAST,		/* fast retransmit found it lost */
+	ARQ_EV_GIVEUP,		/* re-sent MAX_RESEND times */
+	ARQ_EV_ACK,		/* an ACK, 'arg' packets it newly ACKed */
+	ARQ_EV_DUPACK,		/* a cumulative ACK that did not move */
+	ARQ_EV_RTT,		/* an RTT sample, 'arg' in us */
+	ARQ_EV_RECV,		/* a data packet, 'arg' its transmission */
+	ARQ_EV_ACK_SENT,	/* 'arg' us it was delayed, if it was */
+	ARQ_EV_CRC		/* a packet dropped for its CRC */
+};
+
+/* events a session keeps before writing them out */
+#define ARQ_EV_BUF 256
+
+/*
+ * A congestion control algorithm.  It is told how many packets each
+ * ACK covered and of every loss, either found by fast retransmit or
+ * by a timeout, and changes 'cwnd' (in packets) to suit.  Only one
+ * loss is reported for each window of data.  'priv' is for the
+ * algorithm's own use.
+ */
+struct arq_cc_state {
+	double cwnd;
+	double ssthresh;
+	double priv[4];
+};
+
+struct arq_cc {
+	const char *name;
+	void (*init)(struct arq_cc_state *cc);
+	void (*ack)(struct arq_cc_state *cc, int acked, double now_ms,
+			double srtt_ms);
+	void (*loss)(struct arq_cc_state *cc, int timeout, double now_ms);
+};
+
+/* starting congestion window, in packets (RFC 6928) */
+#define CWND_INIT 10
+
+extern const struct arq_cc arq_cc_reno;
+extern const struct arq_cc arq_cc_cubic;
+
+/*
+ * arq_cc_find()
+ *
+ * Returns: the algorithm called 'name' ("reno" or "cubic"),
+ * or NULL if there is none.
+ */
+const struct arq_cc *arq_cc_find(const char *name);
+
+/*
+ * Forward error correction uses a systematic Reed-Solomon code over
+ * GF(2^8) built from a Cauchy matrix.  Parity packet 'j' of a block is
+ * the sum of every data packet 'i' times arq_fec_coef(j, i), and any
+ * e lost packets can be found from e parity packets by inverting the
+ * e x e matrix of their coefficients.  The coefficients of parity 0
+ * are all 1, it is a plain XOR.
+ */
+#define FEC_MAX_K 128
+#define FEC_MAX_M 16
+
+unsigned char arq_fec_coef(int j, int i);
+
+/*
+ * arq_fec_mul_add()
+ *
+ * Add 'len' bytes of 'src' times 'c' to 'dst'.
+ */
+void arq_fec_mul_add(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len);
+
+/*
+ * arq_fec_invert()
+ *
+ * Invert the 'n' x 'n' matrix 'a' (by rows) in place, 'n' is at
+ * most FEC_MAX_M.
+ *
+ * Returns: 0 on success, -1 if it has no inverse.
+ */
+int arq_fec_invert(unsigned char *a, int n);
+
+/*
+ * arq_crc32c()
+ *
+ * Continue the CRC32C 'crc' (0 to start) over 'len' bytes of 'buf'.
+ */
+uint32_t arq_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * The retransmit timers of a session are kept in a hierarchical
+ * timing wheel of WHEEL_LEVELS levels of WHEEL_SIZE slots, with a
+ * tick of TIMER_TICK_US.  Adding, removing and expiring a timer take
+ * the same few steps however many there are.  It counts in ticks of
+ * any length and can be used on its own,
+ *
+ *   arq_wheel_init(&w, 0);
+ *   arq_timer_add(&w, &t, 100);
+ *   if (arq_wheel_next(&w, &tick))
+ *     (wait until 'tick', then)
+ *     for (e = arq_wheel_expire(&w, tick); e; e = e->next)
+ *       (the timer 'e' has expired)
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+/* a timer fires at most this late, but never early */
+#define TIMER_TICK_US 20
+
+struct arq_timer {
+	struct arq_timer *next;
+	struct arq_timer **pprev;	/* NULL unless it is in the wheel */
+	uint64_t expires;		/* tick */
+	unsigned short slot;		/* level * WHEEL_SIZE + index */
+};
+
+struct arq_wheel {
+	uint64_t now;			/* the next tick to expire */
+	unsigned int count;		/* timers in the wheel */
+	uint64_t pending[WHEEL_LEVELS];	/* slots that are not empty */
+	struct arq_timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+/*
+ * arq_wheel_init()
+ *
+ * Start an empty wheel at tick 'now'.  While it is empty its 'now'
+ * can also be moved on directly.
+ */
+void arq_wheel_init(struct arq_wheel *w, uint64_t now);
+
+/*
+ * arq_timer_add()
+ * arq_timer_del()
+ *
+ * Schedule the timer 't' (which must be zeroed at first) to expire
+ * at tick 'expires', moving it if it already is.  One in the past
+ * expires at the next tick, and one farther ahead than the wheel
+ * reaches (WHEEL_SIZE^WHEEL_LEVELS ticks) as far as it does.
+ * arq_timer_del() cancels it, if it is scheduled.
+ */
+void arq_timer_add(struct arq_wheel *w, struct arq_timer *t,
+		uint64_t expires);
+void arq_timer_del(struct arq_wheel *w, struct arq_timer *t);
+
+/*
+ * arq_wheel_next()
+ *
+ * Find a tick no later than the first timer, when the wheel should
+ * be expired again.  It is that of the timer itself unless it is
+ * still on a higher level, then it is when it comes down a level.
+ *
+ * Returns: 1 if 'tick' was set, 0 if the wheel is empty.
+ */
+int arq_wheel_next(const struct arq_wheel *w, uint64_t *tick);
+
+/*
+ * arq_wheel_expire()
+ *
+ * Move the wheel on to tick 'now'.
+ *
+ * Returns: the timers that have expired, linked by 'next', and
+ * no longer in the wheel.
+ */
+struct arq_timer *arq_wheel_expire(struct arq_wheel *w, uint64_t now);
+
+/*
+ * arq_uring_new()
+ *
+ * An io_uring for the datagrams of the UDP socket 'sockfd', with a
+ * kernel thread polling for sends if 'sqpoll'.  Datagrams of up to
+ * 'buf_sz' bytes are read into 'nbufs' buffers (a power of 2), each
+ * until it is given back, and up to 'nsend' datagrams of 'send_sz'
+ * bytes can be in flight.  Every io_uring_enter() adds to
+ * '*syscalls'.  Sessions create one themselves with ARQ_URING.
+ *
+ * Returns: the ring, NULL on error with errno set.
+ *
+ * ENOSYS or EOPNOTSUPP if the kernel does not have what it needs,
+ * EPERM if io_uring is turned off, and ENOMEM.
+ */
+struct arq_uring;
+struct arq_uring *arq_uring_new(int sockfd, int sqpoll, int nbufs,
+		size_t buf_sz, int nsend, size_t send_sz,
+		unsigned long *syscalls);
+
+/* Wait for what is still in flight and free the ring. */
+void arq_uring_free(struct arq_uring *u);
+
+/*
+ * arq_uring_send()
+ *
+ * Queue 'n' datagrams like sendmmsg(2) and submit them.  Each one is
+ * copied, so 'msgs' can be reused at once.  It only waits if every
+ * send buffer is still in flight.
+ *
+ * Returns: 'n', -1 on error with errno set.
+ *
+ * EMSGSIZE for a datagram larger than 'send_sz'.
+ */
+struct mmsghdr;
+int arq_uring_send(struct arq_uring *u, struct mmsghdr *msgs,
+		unsigned int n);
+
+/* a datagram read through an io_uring */
+struct arq_dgram {
+	char *data;
+	int len;		/* the real length, it may be truncated */
+	int seg;		/* length of each segment with GRO */
+	struct sockaddr *addr;
+	socklen_t addrlen;
+	unsigned short id;	/* its buffer */
+};
+
+/*
+ * arq_uring_recv()
+ * arq_uring_done()
+ *
+ * Get up to 'n' datagrams that have arrived, waiting for the first
+ * until 'timeout' (forever if NULL, not at all if 0).  Their buffers
+ * belong to the caller until they are given back with
+ * arq_uring_done().
+ *
+ * Returns: the number of datagrams, -1 on error with errno set.
+ *
+ * EAGAIN if none arrived in time, EOPNOTSUPP if the kernel can not
+ * read them this way (the socket can then be read instead).
+ */
+int arq_uring_recv(struct arq_uring *u, struct arq_dgram *d, int n,
+		const struct timespec *timeout);
+void arq_uring_done(struct arq_uring *u, const struct arq_dgram *d, int n);
+
+/*
+ * arq_uring_wait()
+ *
+ * Submit what is queued and wait until a datagram arrives or
+ * 'timeout' passes, like poll(2) on the socket.
+ *
+ * Returns: 0, -1 on error with errno set.
+ */
+int arq_uring_wait(struct arq_uring *u, const struct timespec *timeout);
+
+struct arq_session;
+
+/*
+ * arq_session_new()
+ *
+ * Create a session for the transfer of data with 'peer' over
+ * 'sockfd'.  If 'peer' is NULL, as for a server, the session
+ * belongs to the first peer that sends it data.
+ *
+ * Returns: the session, or NULL on error with errno set.
+ */
+struct arq_session *arq_session_new(int sockfd,
+		const struct sockaddr *peer, socklen_t peerlen);
+
+/*
+ * arq_session_free()
+ *
+ * Free a session and anything that is still in its windows.
+ * The socket is not closed.
+ */
+void arq_session_free(struct arq_session *s);
+
+/*
+ * arq_session_reset()
+ *
+ * Empty both windows and start again from sequence number 0
+ * with the initial timeout.  The peer is kept.
+ */
+void arq_session_reset(struct arq_session *s);
+
+/*
+ * arq_session_set_window()
+ * arq_session_set_mode()
+ *
+ * The same as arq_set_window() and arq_set_mode() for a session.
+ */
+int arq_session_set_window(struct arq_session *s, int window);
+int arq_session_set_mode(struct arq_session *s, int mode);
+
+/*
+ * arq_session_set_batch()
+ *
+ * Set the number of datagrams that are sent or received with one
+ * system call.  New packets are held in the window until 'batch' of
+ * them are ready, or until the sender has to wait, see also
+ * arq_session_flush().  The default of 1 sends every packet at once.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL if the batch is not between 1 and ARQ_MAX_BATCH, and ENOMEM.
+ */
+int arq_session_set_batch(struct arq_session *s, int batch);
+
+/*
+ * arq_session_set_timeout()
+ *
+ * Set the timeout (in ms) that is used until the round trip time
+ * has been measured, TIMEOUT_MS by default.
+ *
+ * Returns: 0 on success, -1 with errno EINVAL if it is not between
+ * RTO_MIN_MS and RTO_MAX_MS.
+ */
+int arq_session_set_timeout(struct arq_session *s, double ms);
+
+/*
+ * arq_session_set_delack()
+ *
+ * Delay the ACKs of data that arrives in order, and send one
+ * cumulative ACK after 'every' packets or 'ms' after the first of
+ * them, whichever comes first.  Packets out of order, duplicates
+ * and EOF are ACKed at once.  The sender should have a window of
+ * more than 'every' packets, otherwise every ACK waits for 'ms'.
+ * The default of 1 ACKs every packet.
+ *
+ * Returns: 0 on success, -1 with errno EINVAL if 'every' is not
+ * between 1 and ARQ_MAX_WINDOW or 'ms' is not between 0 and
+ * RTO_MAX_MS.
+ */
+int arq_session_set_delack(struct arq_session *s, int every, double ms);
+
+/*
+ * arq_session_set_cc()
+ *
+ * Use the congestion control algorithm 'cc', or none (the default)
+ * if it is NULL, and then the whole window is kept in flight.
+ */
+void arq_session_set_cc(struct arq_session *s, const struct arq_cc *cc);
+
+/*
+ * arq_session_set_pacing()
+ *
+ * Send new packets 'rate' bytes per second apart, or at a little more
+ * than one window per RTT with ARQ_PACE_CWND (the congestion window
+ * if there is one).  0 (the default) sends them as soon as they may
+ * be sent.  Packets that are held by pacing are not sent by
+ * arq_session_flush() early, arq_session_deadline() tells when.
+ * Re-sent packets are not paced.
+ *
+ * Returns: 0 on success, -1 with errno EINVAL for a negative rate.
+ */
+#define ARQ_PACE_CWND (-1)
+
+int arq_session_set_pacing(struct arq_session *s, double rate);
+
+/*
+ * arq_session_set_fec()
+ *
+ * Send 'm' parity packets after every 'k' new data packets, or
+ * after the ones before an EOF.  With an 'm' of 1 the parity is a
+ * plain XOR.  A 'k' of 0 (the default) turns it off.  Any receiver
+ * understands them, but only Selective Repeat with a window of at
+ * least 'k' can use them.  Packets that could be rebuilt by the
+ * receiver are not fast retransmitted until packets after their
+ * block have been ACKed.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL if 'k' is not between 0 and FEC_MAX_K or 'm' is not
+ * between 1 and FEC_MAX_M (or 0, with a 'k' of 0), and ENOMEM.
+ */
+int arq_session_set_fec(struct arq_session *s, int k, int m);
+
+/*
+ * arq_session_set_mss()
+ *
+ * Allow packets with up to 'mss' bytes of data, both ways.  With
+ * 'probe' new packets carry DATA_SZ until a probe of the path and
+ * the peer finds how much more it can take, sent along with the data
+ * once the RTT is known.  A lost probe is tried PROBE_TRIES times and
+ * then with less, down to the MTU of jumbo frames and of Ethernet.
+ * Without it 'mss' is used at once, and must suit the path and the
+ * peer, for which a packet too large is lost.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL if 'mss' is not between DATA_SZ and ARQ_MAX_MSS, EBUSY if
+ * packets are still in flight, and ENOMEM.
+ */
+int arq_session_set_mss(struct arq_session *s, int mss, int probe);
+
+/*
+ * arq_session_set_offload()
+ *
+ * With ARQ_GSO every run of packets of the same size that is sent at
+ * once goes to the kernel as one datagram with UDP_SEGMENT, up to 64
+ * of them.  With ARQ_GRO the socket is set to UDP_GRO the first time
+ * the session reads it, and the runs that are read back as one are
+ * split up again.  Either is turned off if the kernel can not do it.
+ *
+ * With ARQ_URING the datagrams go through an io_uring of the session
+ * (arq_uring_new()) instead of sendmmsg() and recvmmsg(), and the
+ * waits for them are on it too.  Sends only go through it while the
+ * channel does nothing to packets (unreliable_transparent()), since
+ * they would not be impaired.  ARQ_SQPOLL adds a kernel thread that
+ * takes the sends from the ring, at the cost of a CPU while it polls.
+ * Once the session reads through the ring the socket itself has
+ * nothing left to read, so one driven from an event loop that reads
+ * the socket only sends through it.
+ * If the kernel has no io_uring the socket is used as before.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL for unknown flags and ENOMEM.
+ */
+int arq_session_set_offload(struct arq_session *s, int flags);
+
+/*
+ * arq_session_set_crc()
+ *
+ * With 'on' every packet ends in CRC_SZ more bytes, the CRC32C of its
+ * data and then its header, and a packet whose CRC is wrong is dropped
+ * as if it was lost.  The EOF carries a digest of the data since the
+ * last EOF (the CRC32C of the CRC32C of the data of each packet), and
+ * arq_session_recv() returns the EOF only if it matches, otherwise it
+ * fails with EBADMSG.  Both ends must agree on it.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EBUSY if packets are still in flight.
+ */
+int arq_session_set_crc(struct arq_session *s, int on);
+
+/*
+ * arq_session_set_trace()
+ *
+ * Write a line of CSV to 'fp' every time the congestion window
+ * changes, or stop if it is NULL.
+ *
+ *   ms,cwnd,ssthresh,event
+ *
+ * The time is since the session was created and the event is one of
+ * ack, fast (retransmit), timeout or undo (the loss was not one).
+ */
+void arq_session_set_trace(struct arq_session *s, FILE *fp);
+
+/*
+ * arq_session_set_events()
+ *
+ * Record what happens to every packet (struct arq_event) and write
+ * the records to 'fp' ARQ_EV_BUF at a time, or stop if it is NULL.
+ * What is left is written when it is changed or the session is
+ * freed.  Several sessions can share a file, their blocks of records
+ * are then interleaved.  Without it a session only counts.
+ */
+void arq_session_set_events(struct arq_session *s, FILE *fp);
+
+/*
+ * arq_session_stats()
+ *
+ * Copy the counters of the session, such as the number of system
+ * calls made, the amount of data transferred, the packets lost and
+ * the RTTs measured.
+ */
+void arq_session_stats(struct arq_session *s, struct arq_stats *st);
+
+/*
+ * arq_session_send()
+ *
+ * Works the same as arq_sendto() but sends to the peer of
+ * the session.
+ *
+ * Returns: the amount of data sent, 0 if the peer quit
+ * responding (send it again) or -1 on error with errno set.
+ * An EOF returns 0 when it is ACKed as well, if the peer quit
+ * errno is then ETIMEDOUT.
+ */
+int arq_session_send(struct arq_session *s, const void *buf, size_t len,
+		int flags);
+
+/*
+ * arq_session_send_ref()
+ *
+ * Works the same as arq_session_send() except that the data is not
+ * copied, the packets refer to 'buf' until they are ACKed.  It must
+ * not be changed or freed until then, such as after the EOF has
+ * been sent or the session freed.  A file can be sent this way from
+ * a mmap() of it without any copies.
+ */
+int arq_session_send_ref(struct arq_session *s, const void *buf, size_t len,
+		int flags);
+
+/*
+ * arq_session_sendv()
+ *
+ * Works the same as arq_session_send() but gathers the data from
+ * 'iovcnt' buffers, which are taken as one.  Only as much as fits
+ * in a packet is sent, the return value tells how much that was.
+ */
+int arq_session_sendv(struct arq_session *s, const struct iovec *iov,
+		int iovcnt, int flags);
+
+/*
+ * arq_session_recv()
+ *
+ * Works the same as arq_recvfrom() but only accepts packets from
+ * the peer of the session, anything else read from the socket
+ * is ignored.
+ */
+int arq_session_recv(struct arq_session *s, void *buf, size_t len,
+		int flags);
+
+/*
+ * arq_session_recvv()
+ *
+ * Works the same as arq_session_recv() but scatters the data into
+ * 'iovcnt' buffers, and after the first packet also takes every
+ * other one that has already arrived in order and still fits whole.
+ * One call can return a whole batch this way, ready for writev().
+ * The EOF is only returned (as 0) by a call of its own.
+ */
+int arq_session_recvv(struct arq_session *s, const struct iovec *iov,
+		int iovcnt, int flags);
+
+/*
+ * Sessions can also be driven from an event loop (select, epoll)
+ * that reads the socket itself, without ever blocking.
+ *
+ *   n = recvfrom(sockfd, buf, sizeof(buf), 0, &addr, &addrlen);
+ *   (find the session for 'addr')
+ *   arq_session_input(s, buf, n, &addr, addrlen);
+ *   n = arq_session_recv(s, rbuf, sizeof(rbuf), MSG_DONTWAIT);
+ *   n = arq_session_send(s, sbuf, len, MSG_DONTWAIT);
+ *
+ *   arq_session_flush(s);
+ *
+ *   if (arq_session_deadline(s, &ts))
+ *     (wait until 'ts', then)
+ *     arq_session_expire(s);
+ *
+ * With MSG_DONTWAIT arq_session_send() fails with EAGAIN instead
+ * of waiting for room in the window, and arq_session_recv() fails
+ * with EAGAIN unless data has already been input.  The socket is
+ * never read from in this case.
+ *
+ * A caller that also writes the datagrams itself, such as through
+ * io_uring or a socket of its own per flow, gives the session an
+ * output instead (arq_session_set_output()).  The session then
+ * never touches a socket at all and can be created with -1.
+ */
+
+/*
+ * arq_session_set_output()
+ *
+ * Hand every datagram of the session to 'output' instead of sending
+ * it on the socket, or to the socket again if it is NULL.  'output'
+ * is called with 'arg' like sendmmsg(2) on 'n' datagrams, which may
+ * be for UDP GSO (a UDP_SEGMENT cmsg) with ARQ_GSO.  They are only
+ * valid until it returns, so one that is sent later must be copied.
+ *
+ * It returns -1 with errno set on error, anything else is taken as
+ * all of them sent.  A datagram that it drops, say on EAGAIN, is
+ * simply lost and re-sent like any other.
+ */
+void arq_session_set_output(struct arq_session *s,
+		int (*output)(void *arg, struct mmsghdr *msgs, unsigned int n),
+		void *arg);
+
+/*
+ * arq_session_input()
+ *
+ * Give the session a datagram that was read from its socket.
+ * ACKs are sent for any data.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ */
+int arq_session_input(struct arq_session *s, const void *buf, size_t len,
+		const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * arq_session_flush()
+ *
+ * Send the new packets that are being held for a batch, as far
+ * as pacing allows.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ */
+int arq_session_flush(struct arq_session *s);
+
+/*
+ * arq_session_deadline()
+ *
+ * Find when the earliest retransmit timer, or the delayed ACK,
+ * expires (CLOCK_MONOTONIC).  Packets held for a batch are due now,
+ * or when pacing lets them go.
+ *
+ * Returns: 1 if 'ts' was set, 0 if nothing is waiting for an ACK.
+ */
+int arq_session_deadline(struct arq_session *s, struct timespec *ts);
+
+/*
+ * arq_session_expire()
+ *
+ * Re-send the packets whose retransmit timer has expired,
+ * along with any packets held for a batch, and send a delayed
+ * ACK that is due.
+ *
+ * Returns: 1 on success, -1 on error, or 0 if a packet has been
+ * re-sent more than MAX_RESEND times.  Nothing is taken out of
+ * the window in that case, the resends simply start over and it
+ * is up to the caller to decide if the peer is gone.
+ */
+int arq_session_expire(struct arq_session *s);
+
+/*
+ * arq_session_pending()
+ *
+ * Returns: the number of packets sent but not yet ACKed.
+ */
+int arq_session_pending(struct arq_session *s);
+
+/*
+ * arq_session_mss()
+ *
+ * Returns: the most data a new packet carries now, a read of a
+ * multiple of it fills every packet.
+ */
+int arq_session_mss(struct arq_session *s);
+
+/*
+ * arq_session_peer()
+ *
+ * Copy the address of the peer, like getpeername().
+ *
+ * Returns: 0 on success, -1 with errno ENOTCONN if the peer
+ * is not yet known.
+ */
+int arq_session_peer(struct arq_session *s,
+		struct sockaddr *addr, socklen_t *addrlen);
+
 /*
  * reset_seq()
  *
- * The sequence number must be reset with new connections otherwise
- * it may collide with the wrong sequence number and prevent any
- * transfer of data.
+ * The sequence numbers must be reset with new connections otherwise
+ * they may collide with the wrong sequence number and prevent any
+ * transfer of data.  Both the send and the receive windows are
+ * emptied and start again from sequence number 0, and the timeout
+ * goes back to TIMEOUT_MS.
  */
 void reset_seq();
 
+/*
+ * arq_set_window()
+ *
+ * Set the number of packets that may be outstanding (sent but not
+ * yet ACKed) and the number of out of order packets that will be
+ * buffered by the receiver.
+ *
+ *   arq_set_window(32);
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL if the window is not between 1 and ARQ_MAX_WINDOW,
+ * EBUSY if packets are still in flight, and ENOMEM.
+ */
+int arq_set_window(int window);
+
+/*
+ * arq_set_mode()
+ *
+ * Choose between Selective Repeat (ARQ_SR, the default) and
+ * Go-Back-N (ARQ_GBN).  The mode decides how this end re-sends
+ * and acknowledges packets.  ACKs of either kind are understood
+ * so the two ends do not have to agree.
+ *
+ * Returns: 0 on success, -1 on error with errno set.
+ *
+ * EINVAL for an unknown mode, EBUSY if packets are still in flight.
+ */
+int arq_set_mode(int mode);
+
+/*
+ * arq_set_delack()
+ *
+ * Delay the ACKs sent by arq_recvfrom(), the same as
+ * arq_session_set_delack().
+ */
+int arq_set_delack(int every, double ms);
+
+/*
+ * arq_set_pacing()
+ *
+ * Pace the packets sent by arq_sendto(), the same as
+ * arq_session_set_pacing().
+ */
+int arq_set_pacing(double rate);
+
+/*
+ * arq_set_fec()
+ *
+ * Add parity to the packets sent by arq_sendto(), the same as
+ * arq_session_set_fec().
+ */
+int arq_set_fec(int k, int m);
+
+/*
+ * arq_set_mss()
+ * arq_set_offload()
+ *
+ * Allow larger packets and offload them for arq_sendto() and
+ * arq_recvfrom(), the same as arq_session_set_mss() and
+ * arq_session_set_offload().
+ */
+int arq_set_mss(int mss, int probe);
+int arq_set_offload(int flags);
+
+/*
+ * arq_set_crc()
+ *
+ * Check arq_sendto() and arq_recvfrom() end to end, the same as
+ * arq_session_set_crc().
+ */
+int arq_set_crc(int on);
+
 /*
  * arq_sendto()
  *
@@ -81,9 +997,15 @@ void reset_seq();
  * unreliable_sendto() function and it uses ARQ
  * methods to make it reliable again.
  *
+ * The packet is placed in the send window and the call only
+ * blocks while the window is full.  A zero length packet (EOF)
+ * is only sent after every outstanding packet has been ACKed
+ * and then blocks until the EOF itself is ACKed.
+ *
  * In the event that the other end quits responding it will
  * give up trying to resend after MAX_RESEND times.
  * And it will return 0 indicating that no data was sent.
+ * The same data should then be sent again.
  */
 int arq_sendto(int sockfd, const void *buf, size_t len,
 		int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
@@ -93,8 +1015,20 @@ int arq_sendto(int sockfd, const void *buf, size_t len,
  *
  * Works identically to recvfrom() except that it will return an
  * ACK for each data packet according to the ARQ scheme used here.
+ * Data is always returned in the order it was sent.
  */
 int arq_recvfrom(int sockfd, void *buf, size_t len,
 		int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 
+/*
+ * arq_sendv(), arq_recvv()
+ *
+ * Work the same as arq_sendto() and arq_recvfrom() but with the
+ * buffers of arq_session_sendv() and arq_session_recvv().
+ */
+int arq_sendv(int sockfd, const struct iovec *iov, int iovcnt,
+		int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
+int arq_recvv(int sockfd, const struct iovec *iov, int iovcnt,
+		int flags, struct sockaddr *src_addr, socklen_t *addrlen);
+
 #endif /* _ARQ_H */
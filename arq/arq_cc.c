@@ -0,0 +1,150 @@
+/*
+ * arq_cc.c
+ *
+ * Congestion control algorithms for the ARQ sender, see
+ * struct arq_cc in arq.h.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "arq.h"
+
+/* the smallest window after a loss, other than a timeout */
+#define CWND_MIN 2
+
+static void slow_start_init(struct arq_cc_state *cc)
+{
+	memset(cc, 0, sizeof(*cc));
+	cc->cwnd = CWND_INIT;
+	cc->ssthresh = ARQ_MAX_WINDOW;
+}
+
+/*
+ * Reno (RFC 5681).  The window grows by one packet for every packet
+ * ACKed in slow start, and by one packet per window after that.  A
+ * loss halves it, a timeout starts over from one packet.
+ */
+
+static void reno_ack(struct arq_cc_state *cc, int acked, double now_ms,
+		double srtt_ms)
+{
+	(void) now_ms;
+	(void) srtt_ms;
+
+	if (cc->cwnd < cc->ssthresh)
+		cc->cwnd += acked;
+	else
+		cc->cwnd += (double) acked / cc->cwnd;
+}
+
+static void reno_loss(struct arq_cc_state *cc, int timeout, double now_ms)
+{
+	(void) now_ms;
+
+	cc->ssthresh = cc->cwnd / 2;
+	if (cc->ssthresh < CWND_MIN)
+		cc->ssthresh = CWND_MIN;
+	cc->cwnd = timeout ? 1 : cc->ssthresh;
+}
+
+const struct arq_cc arq_cc_reno = {
+	"reno",
+	slow_start_init,
+	reno_ack,
+	reno_loss
+};
+
+/*
+ * CUBIC (RFC 8312).  After a loss the window grows along a cubic
+ * function of the time since, back to where the loss happened
+ * ('w_max') and then beyond it, independent of the RTT.  It grows
+ * at least as fast as Reno would, which matters for short RTTs.
+ */
+
+#define CUBIC_C		0.4
+#define CUBIC_BETA	0.7
+
+#define w_max	priv[0]		/* window before the last loss */
+#define epoch	priv[1]		/* time of the last loss, ms */
+#define cubic_k	priv[2]		/* seconds to get back to 'w_max' */
+#define w_est	priv[3]		/* the window Reno would have */
+
+static void cubic_ack(struct arq_cc_state *cc, int acked, double now_ms,
+		double srtt_ms)
+{
+	double t, target;
+
+	if (cc->cwnd < cc->ssthresh) {
+		cc->cwnd += acked;
+		return;
+	}
+
+	if (0 == cc->epoch) {
+		/* no loss yet, grow from here */
+		cc->epoch = now_ms;
+		cc->w_max = cc->cwnd;
+		cc->cubic_k = 0;
+		cc->w_est = cc->cwnd;
+	}
+
+	/* Reno with the same decrease, 3(1 - beta)/(1 + beta) per RTT */
+	cc->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA)
+		* acked / cc->cwnd;
+
+	/* where the window should be one RTT from now */
+	t = (now_ms + srtt_ms - cc->epoch) / 1000.0 - cc->cubic_k;
+	target = CUBIC_C * t * t * t + cc->w_max;
+	if (target < cc->w_est)
+		target = cc->w_est;
+
+	if (target > cc->cwnd)
+		cc->cwnd += (target - cc->cwnd) * acked / cc->cwnd;
+	else
+		cc->cwnd += 0.01 * acked / cc->cwnd;
+}
+
+static void cubic_loss(struct arq_cc_state *cc, int timeout, double now_ms)
+{
+	cc->w_max = cc->cwnd;
+	cc->epoch = now_ms;
+	cc->cubic_k = cbrt(cc->w_max * (1 - CUBIC_BETA) / CUBIC_C);
+
+	cc->ssthresh = cc->cwnd * CUBIC_BETA;
+	if (cc->ssthresh < CWND_MIN)
+		cc->ssthresh = CWND_MIN;
+	cc->cwnd = timeout ? 1 : cc->ssthresh;
+	cc->w_est = cc->cwnd;
+}
+
+#undef w_max
+#undef epoch
+#undef cubic_k
+#undef w_est
+
+const struct arq_cc arq_cc_cubic = {
+	"cubic",
+	slow_start_init,
+	cubic_ack,
+	cubic_loss
+};
+
+const struct arq_cc *arq_cc_find(const char *name)
+{
+	if (0 == strcmp(name, arq_cc_reno.name))
+		return &arq_cc_reno;
+	if (0 == strcmp(name, arq_cc_cubic.name))
+		return &arq_cc_cubic;
+
+	return NULL;
+}
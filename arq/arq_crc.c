@@ -0,0 +1,174 @@
+/*
+ * arq_crc.c
+ *
+ * CRC32C (Castagnoli) of the packets of the ARQ sessions, see
+ * arq_crc32c() in arq.h.
+ *
+ * Without hardware support it is computed 8 bytes at a time with
+ * eight tables (slice-by-8).  With SSE4.2 (checked at run time) the
+ * crc32 instruction does it, on three parts of the data at once to
+ * hide its latency.  The three are then joined with tables of what
+ * the register becomes after the zeros of one and two parts.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "arq.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC_X86
+#include <nmmintrin.h>
+#endif
+
+/* x^32 + x^28 + x^27 + ... + 1, bit reversed */
+#define CRC_POLY 0x82f63b78
+
+/* bytes in each of the three parts done at once */
+#define CRC_PART 128
+
+static uint32_t crc_table[8][256];
+static uint32_t shift1[4][256];	/* after CRC_PART zeros */
+static uint32_t shift2[4][256];	/* after 2 * CRC_PART zeros */
+static int has_sse42;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* the register after 'n' zero bytes, one at a time */
+static uint32_t crc_zeros(uint32_t crc, size_t n)
+{
+	while (n--)
+		crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+/*
+ * Zeros change the register linearly, so a table for each byte of it
+ * is made from what they do to each of its bits.
+ */
+static void shift_init(uint32_t t[4][256], size_t n)
+{
+	uint32_t bit[32];
+	int i, k, v;
+
+	for (i = 0; i < 32; i++)
+		bit[i] = crc_zeros((uint32_t) 1 << i, n);
+
+	for (k = 0; k < 4; k++) {
+		for (v = 0; v < 256; v++) {
+			t[k][v] = 0;
+			for (i = 0; i < 8; i++)
+				if (v & (1 << i))
+					t[k][v] ^= bit[8 * k + i];
+		}
+	}
+}
+
+static void crc_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (CRC_POLY & -(c & 1));
+		crc_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			c = crc_table[j - 1][i];
+			crc_table[j][i] = crc_table[0][c & 0xff] ^ (c >> 8);
+		}
+	}
+
+	shift_init(shift1, CRC_PART);
+	shift_init(shift2, 2 * CRC_PART);
+
+#ifdef CRC_X86
+	__builtin_cpu_init();
+	has_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint32_t lo;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16
+				| (uint32_t) p[3] << 24);
+		crc = crc_table[7][lo & 0xff]
+			^ crc_table[6][(lo >> 8) & 0xff]
+			^ crc_table[5][(lo >> 16) & 0xff]
+			^ crc_table[4][lo >> 24]
+			^ crc_table[3][p[4]] ^ crc_table[2][p[5]]
+			^ crc_table[1][p[6]] ^ crc_table[0][p[7]];
+	}
+	for (; len; len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef CRC_X86
+static uint32_t crc_shift(uint32_t t[4][256], uint32_t crc)
+{
+	return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff]
+		^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t a = crc, b, c;
+	size_t i;
+
+	for (; len >= 3 * CRC_PART; len -= 3 * CRC_PART, p += 3 * CRC_PART) {
+		b = c = 0;
+		for (i = 0; i < CRC_PART; i += 8) {
+			a = _mm_crc32_u64(a, load64(p + i));
+			b = _mm_crc32_u64(b, load64(p + CRC_PART + i));
+			c = _mm_crc32_u64(c, load64(p + 2 * CRC_PART + i));
+		}
+		a = crc_shift(shift2, a) ^ crc_shift(shift1, b) ^ c;
+	}
+	for (; len >= 8; len -= 8, p += 8)
+		a = _mm_crc32_u64(a, load64(p));
+
+	crc = a;
+	for (; len; len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+#endif
+
+uint32_t arq_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+
+#ifdef CRC_X86
+	if (has_sse42)
+		return ~crc_sse42(~crc, buf, len);
+#endif
+	return ~crc_sw(~crc, buf, len);
+}
@@ -0,0 +1,214 @@
+/*
+ * arq_fec.c
+ *
+ * Arithmetic over GF(2^8) for the forward error correction of the
+ * ARQ sessions, see arq_fec_coef() in arq.h.
+ *
+ * Multiplying a whole packet by a constant uses two tables of 16
+ * products, one for the low and one for the high 4 bits of every
+ * byte.  With SSSE3 (checked at run time) pshufb looks up 16 bytes
+ * at once in them, and XOR works on 16 bytes at once with SSE2.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "arq.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FEC_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+/* x^8 + x^4 + x^3 + x^2 + 1 */
+#define GF_POLY 0x11d
+
+static unsigned char gf_exp[2 * 255];
+static unsigned char gf_log[256];
+static int has_ssse3;
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+static void gf_init(void)
+{
+	unsigned int x = 1;
+	int i;
+
+	for (i = 0; i < 255; i++) {
+		gf_exp[i] = gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= GF_POLY;
+	}
+
+#ifdef FEC_X86
+	__builtin_cpu_init();
+	has_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+	if (0 == a || 0 == b)
+		return 0;
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_div(unsigned char a, unsigned char b)
+{
+	if (0 == a)
+		return 0;
+	return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+unsigned char arq_fec_coef(int j, int i)
+{
+	unsigned char x = j, y = 128 + i;
+
+	pthread_once(&gf_once, gf_init);
+
+	/*
+	 * A Cauchy matrix 1/(x + y) has no square submatrix that can
+	 * not be inverted, as long as no x equals a y.  Each column is
+	 * scaled by its y so that the first parity is a plain XOR.
+	 */
+	return gf_div(y, x ^ y);
+}
+
+#ifdef FEC_X86
+static size_t xor_sse2(unsigned char *dst, const unsigned char *src,
+		size_t len)
+{
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		a = _mm_loadu_si128((const __m128i *) (dst + i));
+		b = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(a, b));
+	}
+
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t mul_add_ssse3(unsigned char *dst, const unsigned char *src,
+		const unsigned char *lo, const unsigned char *hi, size_t len)
+{
+	__m128i tlo, thi, mask, s, d, p;
+	size_t i;
+
+	tlo = _mm_loadu_si128((const __m128i *) lo);
+	thi = _mm_loadu_si128((const __m128i *) hi);
+	mask = _mm_set1_epi8(0x0f);
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *) (src + i));
+		d = _mm_loadu_si128((const __m128i *) (dst + i));
+		p = _mm_xor_si128(
+			_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+			_mm_shuffle_epi8(thi,
+				_mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(d, p));
+	}
+
+	return i;
+}
+#endif
+
+void arq_fec_mul_add(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	unsigned char lo[16], hi[16];
+	size_t i = 0;
+	int x;
+
+	if (0 == c)
+		return;
+
+	if (1 == c) {
+#ifdef FEC_X86
+		i = xor_sse2(dst, src, len);
+#endif
+		for (; i < len; i++)
+			dst[i] ^= src[i];
+		return;
+	}
+
+	pthread_once(&gf_once, gf_init);
+
+	for (x = 0; x < 16; x++) {
+		lo[x] = gf_mul(c, x);
+		hi[x] = gf_mul(c, x << 4);
+	}
+
+#ifdef FEC_X86
+	if (has_ssse3)
+		i = mul_add_ssse3(dst, src, lo, hi, len);
+#endif
+	for (; i < len; i++)
+		dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+int arq_fec_invert(unsigned char *a, int n)
+{
+	unsigned char inv[FEC_MAX_M * FEC_MAX_M];
+	unsigned char t;
+	int row, col, i;
+
+	pthread_once(&gf_once, gf_init);
+
+	memset(inv, 0, n * n);
+	for (i = 0; i < n; i++)
+		inv[i * n + i] = 1;
+
+	/* Gauss-Jordan, in GF(2^8) subtraction is also XOR */
+	for (col = 0; col < n; col++) {
+		for (row = col; row < n && 0 == a[row * n + col]; row++)
+			;
+		if (row == n)
+			return -1;
+
+		if (row != col) {
+			for (i = 0; i < n; i++) {
+				t = a[row * n + i];
+				a[row * n + i] = a[col * n + i];
+				a[col * n + i] = t;
+				t = inv[row * n + i];
+				inv[row * n + i] = inv[col * n + i];
+				inv[col * n + i] = t;
+			}
+		}
+
+		t = a[col * n + col];
+		for (i = 0; i < n; i++) {
+			a[col * n + i] = gf_div(a[col * n + i], t);
+			inv[col * n + i] = gf_div(inv[col * n + i], t);
+		}
+
+		for (row = 0; row < n; row++) {
+			t = a[row * n + col];
+			if (row == col || 0 == t)
+				continue;
+			for (i = 0; i < n; i++) {
+				a[row * n + i] ^= gf_mul(t, a[col * n + i]);
+				inv[row * n + i] ^= gf_mul(t, inv[col * n + i]);
+			}
+		}
+	}
+
+	memcpy(a, inv, n * n);
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * arq_timer.c
+ *
+ * A hierarchical timing wheel for the retransmit timers of the ARQ
+ * sessions, see arq_wheel_init() in arq.h.
+ *
+ * Level 0 has a slot for each of the next WHEEL_SIZE ticks, every
+ * level above it a slot for WHEEL_SIZE times as many as the one
+ * below.  A timer goes into the lowest level that reaches its tick,
+ * so adding and removing one is a few steps whatever the number of
+ * timers.  When level 0 comes around again the next slot of level 1
+ * is spread out over it, and so on up (a cascade), so a timer only
+ * moves down a level at a time until it expires.
+ *
+ * A bitmap per level of the slots that are not empty finds the next
+ * slot to look at without going through the empty ones, and lets
+ * the wheel jump over ticks where nothing happens.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#include <string.h>
+
+#include "arq.h"
+
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+/* the ticks that a slot of 'level' covers, as a shift */
+#define LEVEL_SHIFT(level) ((level) * WHEEL_BITS)
+
+/* the most ticks ahead a timer can be, farther ones are brought in */
+#define WHEEL_SPAN ((uint64_t) 1 << LEVEL_SHIFT(WHEEL_LEVELS))
+
+void arq_wheel_init(struct arq_wheel *w, uint64_t now)
+{
+	memset(w, 0, sizeof(*w));
+	w->now = now;
+}
+
+void arq_timer_add(struct arq_wheel *w, struct arq_timer *t,
+		uint64_t expires)
+{
+	uint64_t delta;
+	int level, idx;
+
+	arq_timer_del(w, t);
+
+	if (expires < w->now)
+		expires = w->now;
+	if (expires - w->now >= WHEEL_SPAN)
+		expires = w->now + WHEEL_SPAN - 1;
+	t->expires = expires;
+
+	delta = expires - w->now;
+	for (level = 0; level < WHEEL_LEVELS - 1
+			&& delta >> LEVEL_SHIFT(level + 1); level++)
+		;
+	idx = (expires >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+
+	t->slot = level * WHEEL_SIZE + idx;
+	t->next = w->slots[level][idx];
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = &w->slots[level][idx];
+	w->slots[level][idx] = t;
+	w->pending[level] |= (uint64_t) 1 << idx;
+	w->count++;
+}
+
+void arq_timer_del(struct arq_wheel *w, struct arq_timer *t)
+{
+	int level = t->slot / WHEEL_SIZE;
+	int idx = t->slot % WHEEL_SIZE;
+
+	if (NULL == t->pprev)
+		return;
+
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = NULL;
+	t->next = NULL;
+
+	if (NULL == w->slots[level][idx])
+		w->pending[level] &= ~((uint64_t) 1 << idx);
+	w->count--;
+}
+
+/* the next slot of 'level' from 'idx' on that is not empty, or -1 */
+static int slot_next(const struct arq_wheel *w, int level, int idx)
+{
+	uint64_t map = w->pending[level];
+
+	if (0 == map)
+		return -1;
+
+	/* turned so that 'idx' is bit 0 */
+	map = (map >> idx) | (idx ? map << (WHEEL_SIZE - idx) : 0);
+
+	return (idx + __builtin_ctzll(map)) & WHEEL_MASK;
+}
+
+int arq_wheel_next(const struct arq_wheel *w, uint64_t *tick)
+{
+	uint64_t span, start, first = 0;
+	int level, idx, found = 0;
+
+	if (0 == w->count)
+		return 0;
+
+	/* level 0 has the exact tick */
+	idx = slot_next(w, 0, w->now & WHEEL_MASK);
+	if (idx != -1) {
+		first = w->now + ((idx - w->now) & WHEEL_MASK);
+		found = 1;
+	}
+
+	/* above it, when the slot is cascaded, from the next time it can be */
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		span = (uint64_t) 1 << LEVEL_SHIFT(level);
+		start = (w->now + span - 1) & ~(span - 1);
+		idx = slot_next(w, level, (start >> LEVEL_SHIFT(level))
+				& WHEEL_MASK);
+		if (-1 == idx)
+			continue;
+
+		start += (((uint64_t) idx - (start >> LEVEL_SHIFT(level)))
+				& WHEEL_MASK) << LEVEL_SHIFT(level);
+		if (!found || start < first)
+			first = start;
+		found = 1;
+	}
+
+	*tick = first;
+	return 1;
+}
+
+/* take the timers out of a slot and add them again, a level lower */
+static void cascade(struct arq_wheel *w, int level, int idx)
+{
+	struct arq_timer *t, *next;
+
+	t = w->slots[level][idx];
+	w->slots[level][idx] = NULL;
+	w->pending[level] &= ~((uint64_t) 1 << idx);
+
+	for (; t; t = next) {
+		next = t->next;
+		t->pprev = NULL;
+		w->count--;
+		arq_timer_add(w, t, t->expires);
+	}
+}
+
+struct arq_timer *arq_wheel_expire(struct arq_wheel *w, uint64_t now)
+{
+	struct arq_timer *expired = NULL;
+	struct arq_timer *t, *next;
+	uint64_t tick;
+	int level, idx;
+
+	while (w->now <= now) {
+		/* nothing happens until then */
+		if (!arq_wheel_next(w, &tick) || tick > now) {
+			w->now = now + 1;
+			break;
+		}
+		w->now = tick;
+
+		for (level = 1; level < WHEEL_LEVELS
+				&& 0 == (w->now & (((uint64_t) 1
+						<< LEVEL_SHIFT(level)) - 1));
+				level++)
+			cascade(w, level, (w->now >> LEVEL_SHIFT(level))
+					& WHEEL_MASK);
+
+		idx = w->now & WHEEL_MASK;
+		for (t = w->slots[0][idx]; t; t = next) {
+			next = t->next;
+			t->pprev = NULL;
+			t->next = expired;
+			expired = t;
+			w->count--;
+		}
+		w->slots[0][idx] = NULL;
+		w->pending[0] &= ~((uint64_t) 1 << idx);
+
+		w->now++;
+	}
+
+	return expired;
+}
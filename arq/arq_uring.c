@@ -0,0 +1,717 @@
+/*
+ * arq_uring.c
+ *
+ * An io_uring for the datagrams of an ARQ session (ARQ_URING), see
+ * arq_uring_new() in arq.h.  It is driven with the system calls
+ * themselves, without liburing.
+ *
+ * One multishot recvmsg takes every datagram that arrives into a
+ * ring of provided buffers and posts a completion for it, so reading
+ * what has arrived is a look at the completion queue, not a system
+ * call.  Sends are copied into buffers of their own and queued, and
+ * the queue is submitted once for all of them (or picked up by the
+ * kernel's polling thread with ARQ_SQPOLL, without any call at all).
+ * The same io_uring_enter() that waits for data submits the sends
+ * still queued.
+ *
+ * Without io_uring, or without the provided buffer rings and
+ * multishot recvmsg (Linux 6.0), creating it fails and the session
+ * goes on with the socket.
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arq.h"
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#ifdef IORING_RECV_MULTISHOT
+
+/* the user_data of what is not a send, which are their buffer + 1 */
+#define RECV_TAG (~(uint64_t) 0)
+#define CANCEL_TAG (~(uint64_t) 1)
+
+/* the kernel's polling thread sleeps after this many ms without work */
+#define SQPOLL_IDLE_MS 10
+
+/* how long arq_uring_free() waits for what is still in flight */
+#define FREE_WAIT_MS 1000
+
+struct send_buf {
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_storage addr;
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		size_t align;	/* as a struct cmsghdr */
+	} ctl;
+	int next;		/* free list */
+};
+
+struct arq_uring {
+	int fd;
+	int sockfd;
+	int sqpoll;
+	unsigned long *syscalls;
+
+	/* the rings shared with the kernel */
+	void *ring;
+	size_t ring_sz;
+	void *cring;		/* the completion ring, if apart */
+	size_t cring_sz;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_flags;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_next;	/* our tail, published on submit */
+	unsigned int sq_done;	/* the tail the kernel has been told of */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/*
+	 * Receiving, 'nbufs' buffers of 'buf_sz' after room for the
+	 * header, address and control data that recvmsg puts first,
+	 * made when it first reads.  Datagrams that have been read wait in 'rxq'.
+	 */
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	unsigned short br_tail;
+	char *bufs;
+	size_t buf_sz;
+	size_t buf_hdr;
+	int nbufs;
+	struct msghdr rmsg;
+	int armed;		/* the recvmsg is still going */
+	int broken;		/* there is no multishot recvmsg */
+	struct {
+		unsigned short id;
+		int len;
+	} *rxq;
+	int rx_head;
+	int rx_n;
+
+	/* sending */
+	struct send_buf *sb;
+	char *sdata;
+	size_t send_sz;
+	int nsend;
+	int sb_free;
+	int inflight;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_register(int fd, unsigned int op, void *arg,
+		unsigned int nr)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/*
+ * Submit what has been queued, and wait for 'wait' completions
+ * until 'ts' (forever if NULL).
+ *
+ * Returns: 0, 1 if it timed out, -1 on error with errno set.
+ */
+static int uring_enter(struct arq_uring *u, unsigned int wait,
+		const struct timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec kts;
+	unsigned int flags = 0;
+	unsigned int submit;
+	int n;
+
+	__atomic_store_n(u->sq_tail, u->sq_next, __ATOMIC_RELEASE);
+	submit = u->sq_next - u->sq_done;
+
+	if (u->sqpoll) {
+		/* the thread takes them, unless it has gone to sleep */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED)
+				& IORING_SQ_NEED_WAKEUP)
+			flags |= IORING_ENTER_SQ_WAKEUP;
+		u->sq_done = u->sq_next;
+		submit = 0;
+	}
+
+	if (0 == submit && 0 == wait && !(flags & IORING_ENTER_SQ_WAKEUP))
+		return 0;
+
+	memset(&arg, 0, sizeof(arg));
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (ts) {
+			kts.tv_sec = ts->tv_sec;
+			kts.tv_nsec = ts->tv_nsec;
+			arg.ts = (uint64_t) (uintptr_t) &kts;
+			arg.sigmask_sz = _NSIG / 8;
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+	}
+
+	(*u->syscalls)++;
+	n = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags,
+			(flags & IORING_ENTER_EXT_ARG) ? (void *) &arg : NULL,
+			(flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+	if (-1 == n) {
+		if (ETIME == errno)
+			return 1;
+		return -1;
+	}
+	if (!u->sqpoll)
+		u->sq_done += n;
+
+	return 0;
+}
+
+/* the next free submission entry, submitting the queue if it is full */
+static struct io_uring_sqe *uring_sqe(struct arq_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	while (u->sq_next - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)
+			>= u->sq_entries) {
+		if (-1 == uring_enter(u, 0, NULL) && EINTR != errno
+				&& EAGAIN != errno && EBUSY != errno)
+			return NULL;
+	}
+
+	idx = u->sq_next & u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->sq_next++;
+
+	return sqe;
+}
+
+/* give a receive buffer back to the kernel */
+static void buf_put(struct arq_uring *u, unsigned short id)
+{
+	struct io_uring_buf *b;
+
+	b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+	b->addr = (uint64_t) (uintptr_t) (u->bufs
+			+ (size_t) id * (u->buf_hdr + u->buf_sz));
+	b->len = u->buf_hdr + u->buf_sz;
+	b->bid = id;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* take in the completions there are, without waiting */
+static void uring_reap(struct arq_uring *u)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int i;
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &u->cqes[head & u->cq_mask];
+
+		if (RECV_TAG == cqe->user_data) {
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				i = (u->rx_head + u->rx_n) % u->nbufs;
+				u->rxq[i].id = cqe->flags
+					>> IORING_CQE_BUFFER_SHIFT;
+				u->rxq[i].len = cqe->res;
+				if (cqe->res >= 0)
+					u->rx_n++;
+				else
+					buf_put(u, u->rxq[i].id);
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				/* out of buffers (ENOBUFS), armed again */
+				u->armed = 0;
+				if (-EINVAL == cqe->res
+						|| -EOPNOTSUPP == cqe->res)
+					u->broken = 1;
+			}
+		} else if (CANCEL_TAG != cqe->user_data) {
+			/* a send, whether it worked or not the copy is done */
+			i = cqe->user_data - 1;
+			u->sb[i].next = u->sb_free;
+			u->sb_free = i;
+			u->inflight--;
+		}
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* start the multishot recvmsg, unless it is going */
+static int uring_arm(struct arq_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	int i;
+
+	if (u->armed || u->broken)
+		return 0;
+
+	/* the buffers are only needed by a ring that reads */
+	if (NULL == u->bufs) {
+		u->bufs = malloc(u->nbufs * (u->buf_hdr + u->buf_sz));
+		u->rxq = malloc(u->nbufs * sizeof(*u->rxq));
+		if (NULL == u->bufs || NULL == u->rxq) {
+			free(u->bufs);
+			free(u->rxq);
+			u->bufs = NULL;
+			u->rxq = NULL;
+			return -1;
+		}
+		for (i = 0; i < u->nbufs; i++)
+			buf_put(u, i);
+	}
+
+	sqe = uring_sqe(u);
+	if (NULL == sqe)
+		return -1;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = u->sockfd;
+	sqe->addr = (uint64_t) (uintptr_t) &u->rmsg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_TRUNC;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = RECV_TAG;
+	u->armed = 1;
+
+	return 0;
+}
+
+struct arq_uring *arq_uring_new(int sockfd, int sqpoll, int nbufs,
+		size_t buf_sz, int nsend, size_t send_sz,
+		unsigned long *syscalls)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	struct arq_uring *u;
+	size_t cq_sz;
+	int i;
+
+	/* the buffer ring is indexed with a mask */
+	if (nbufs < 1 || (nbufs & (nbufs - 1)) || nbufs > 32768
+			|| nsend < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	u = calloc(1, sizeof(*u));
+	if (NULL == u)
+		return NULL;
+	u->fd = -1;
+	u->sockfd = sockfd;
+	u->sqpoll = sqpoll;
+	u->syscalls = syscalls;
+	u->nbufs = nbufs;
+	u->buf_sz = (buf_sz + 7) & ~(size_t) 7;	/* aligned packets */
+	u->nsend = nsend;
+	u->send_sz = send_sz;
+
+	/* every buffer and every send can be waiting to be reaped */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = nbufs + nsend + 2;
+	if (sqpoll) {
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = SQPOLL_IDLE_MS;
+	}
+	u->fd = uring_setup(nsend + 2, &p);
+	if (-1 == u->fd)
+		goto fail;
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		errno = EOPNOTSUPP;
+		goto fail;
+	}
+
+	u->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && cq_sz > u->ring_sz)
+		u->ring_sz = cq_sz;
+	u->ring = mmap(NULL, u->ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == u->ring) {
+		u->ring = NULL;
+		goto fail;
+	}
+	u->cring = u->ring;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		u->cring_sz = cq_sz;
+		u->cring = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, u->fd,
+				IORING_OFF_CQ_RING);
+		if (MAP_FAILED == u->cring) {
+			u->cring = NULL;
+			goto fail;
+		}
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == u->sqes) {
+		u->sqes = NULL;
+		goto fail;
+	}
+
+	u->sq_head = (unsigned int *) ((char *) u->ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *) ((char *) u->ring + p.sq_off.tail);
+	u->sq_flags = (unsigned int *) ((char *) u->ring + p.sq_off.flags);
+	u->sq_array = (unsigned int *) ((char *) u->ring + p.sq_off.array);
+	u->sq_mask = *(unsigned int *) ((char *) u->ring
+			+ p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_next = u->sq_done = *u->sq_tail;
+	u->cq_head = (unsigned int *) ((char *) u->cring + p.cq_off.head);
+	u->cq_tail = (unsigned int *) ((char *) u->cring + p.cq_off.tail);
+	u->cq_mask = *(unsigned int *) ((char *) u->cring
+			+ p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) ((char *) u->cring
+			+ p.cq_off.cqes);
+
+	/* the buffers, each after room for what recvmsg puts first */
+	u->rmsg.msg_namelen = sizeof(struct sockaddr_storage);
+	u->rmsg.msg_controllen = CMSG_SPACE(sizeof(int));
+	u->buf_hdr = (sizeof(struct io_uring_recvmsg_out)
+			+ u->rmsg.msg_namelen + u->rmsg.msg_controllen + 7)
+		& ~(size_t) 7;
+	u->br_sz = nbufs * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == u->br) {
+		u->br = NULL;
+		goto fail;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) u->br;
+	reg.ring_entries = nbufs;
+	reg.bgid = 0;
+	if (-1 == uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+		goto fail;
+
+	u->sb = calloc(nsend, sizeof(*u->sb));
+	u->sdata = malloc(nsend * send_sz);
+	if (NULL == u->sb || NULL == u->sdata)
+		goto fail;
+	for (i = 0; i < nsend; i++)
+		u->sb[i].next = i + 1;
+	u->sb[nsend - 1].next = -1;
+	u->sb_free = 0;
+
+	return u;
+
+fail:
+	arq_uring_free(u);
+	return NULL;
+}
+
+void arq_uring_free(struct arq_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	struct timespec ts = { 0, 1000000 };
+	int i, err = errno;
+
+	if (NULL == u)
+		return;
+
+	/*
+	 * The kernel may still be writing into the buffers, or reading
+	 * from the sends, until their completions are in.
+	 */
+	if (u->armed && (sqe = uring_sqe(u))) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = RECV_TAG;
+		sqe->user_data = CANCEL_TAG;
+	}
+	for (i = 0; i < FREE_WAIT_MS && (u->armed || u->inflight); i++) {
+		if (-1 == uring_enter(u, 1, &ts) && EINTR != errno)
+			break;
+		uring_reap(u);
+	}
+
+	if (u->fd != -1)
+		close(u->fd);
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cring && u->cring != u->ring)
+		munmap(u->cring, u->cring_sz);
+	if (u->ring)
+		munmap(u->ring, u->ring_sz);
+	if (u->br)
+		munmap(u->br, u->br_sz);
+	free(u->bufs);
+	free(u->rxq);
+	free(u->sb);
+	free(u->sdata);
+	free(u);
+	errno = err;
+}
+
+int arq_uring_send(struct arq_uring *u, struct mmsghdr *msgs,
+		unsigned int n)
+{
+	struct io_uring_sqe *sqe;
+	struct send_buf *sb;
+	struct msghdr *msg;
+	size_t len, k;
+	unsigned int i;
+	int idx;
+
+	for (i = 0; i < n; i++) {
+		msg = &msgs[i].msg_hdr;
+		for (len = 0, k = 0; k < msg->msg_iovlen; k++)
+			len += msg->msg_iov[k].iov_len;
+		if (len > u->send_sz || msg->msg_namelen > sizeof(sb->addr)
+				|| msg->msg_controllen > sizeof(sb->ctl)) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		/* all of the copies are in flight, wait for one */
+		uring_reap(u);
+		while (-1 == u->sb_free) {
+			if (-1 == uring_enter(u, 1, NULL))
+				return -1;
+			uring_reap(u);
+		}
+		idx = u->sb_free;
+		sb = &u->sb[idx];
+		u->sb_free = sb->next;
+
+		sb->iov.iov_base = u->sdata + idx * u->send_sz;
+		sb->iov.iov_len = 0;
+		for (k = 0; k < msg->msg_iovlen; k++) {
+			memcpy((char *) sb->iov.iov_base + sb->iov.iov_len,
+					msg->msg_iov[k].iov_base,
+					msg->msg_iov[k].iov_len);
+			sb->iov.iov_len += msg->msg_iov[k].iov_len;
+		}
+		memset(&sb->msg, 0, sizeof(sb->msg));
+		memcpy(&sb->addr, msg->msg_name, msg->msg_namelen);
+		sb->msg.msg_name = msg->msg_namelen ? &sb->addr : NULL;
+		sb->msg.msg_namelen = msg->msg_namelen;
+		sb->msg.msg_iov = &sb->iov;
+		sb->msg.msg_iovlen = 1;
+		if (msg->msg_controllen) {
+			memcpy(sb->ctl.buf, msg->msg_control,
+					msg->msg_controllen);
+			sb->msg.msg_control = sb->ctl.buf;
+			sb->msg.msg_controllen = msg->msg_controllen;
+		}
+
+		sqe = uring_sqe(u);
+		if (NULL == sqe) {
+			sb->next = u->sb_free;
+			u->sb_free = idx;
+			return -1;
+		}
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = u->sockfd;
+		sqe->addr = (uint64_t) (uintptr_t) &sb->msg;
+		sqe->len = 1;
+		sqe->user_data = idx + 1;
+		u->inflight++;
+		msgs[i].msg_len = sb->iov.iov_len;
+	}
+
+	if (-1 == uring_enter(u, 0, NULL))
+		return -1;
+
+	return n;
+}
+
+/* fill in 'd' from the buffer of a datagram that was read */
+static void dgram_get(struct arq_uring *u, struct arq_dgram *d,
+		unsigned short id)
+{
+	struct io_uring_recvmsg_out *out;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	char *buf;
+
+	buf = u->bufs + (size_t) id * (u->buf_hdr + u->buf_sz);
+	out = (struct io_uring_recvmsg_out *) buf;
+
+	d->id = id;
+	d->data = buf + u->buf_hdr;
+	d->len = out->payloadlen;
+	d->seg = d->len;
+	d->addr = (struct sockaddr *) (out + 1);
+	d->addrlen = MIN(out->namelen, u->rmsg.msg_namelen);
+
+	/* a run of GRO segments says how long each one is */
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = buf + sizeof(*out) + u->rmsg.msg_namelen;
+	msg.msg_controllen = MIN(out->controllen, u->rmsg.msg_controllen);
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (SOL_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type)
+			memcpy(&d->seg, CMSG_DATA(cmsg), sizeof(d->seg));
+	}
+	if (d->seg <= 0)
+		d->seg = d->len;
+}
+
+int arq_uring_recv(struct arq_uring *u, struct arq_dgram *d, int n,
+		const struct timespec *timeout)
+{
+	int i, r;
+
+	for (;;) {
+		if (-1 == uring_arm(u))
+			return -1;
+		uring_reap(u);
+
+		if (u->rx_n > 0) {
+			for (i = 0; i < n && u->rx_n > 0; i++) {
+				dgram_get(u, &d[i], u->rxq[u->rx_head].id);
+				u->rx_head = (u->rx_head + 1) % u->nbufs;
+				u->rx_n--;
+			}
+			return i;
+		}
+
+		if (u->broken) {
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+
+		/* not waiting, but the recvmsg may still need submitting */
+		if (timeout && 0 == timeout->tv_sec && 0 == timeout->tv_nsec) {
+			if (-1 == uring_enter(u, 0, NULL))
+				return -1;
+			uring_reap(u);
+			if (0 == u->rx_n) {
+				errno = EAGAIN;
+				return -1;
+			}
+			continue;
+		}
+
+		r = uring_enter(u, 1, timeout);
+		if (-1 == r)
+			return -1;
+		if (1 == r) {
+			uring_reap(u);
+			if (0 == u->rx_n) {
+				errno = EAGAIN;
+				return -1;
+			}
+		}
+	}
+}
+
+void arq_uring_done(struct arq_uring *u, const struct arq_dgram *d, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		buf_put(u, d[i].id);
+}
+
+int arq_uring_wait(struct arq_uring *u, const struct timespec *timeout)
+{
+	if (-1 == uring_arm(u))
+		return -1;
+	uring_reap(u);
+	if (u->rx_n > 0 || u->broken)
+		return 0;
+
+	return (-1 == uring_enter(u, 1, timeout)) ? -1 : 0;
+}
+
+#else
+
+/* built without io_uring, the socket is always used */
+struct arq_uring *arq_uring_new(int sockfd, int sqpoll, int nbufs,
+		size_t buf_sz, int nsend, size_t send_sz,
+		unsigned long *syscalls)
+{
+	(void) sockfd;
+	(void) sqpoll;
+	(void) nbufs;
+	(void) buf_sz;
+	(void) nsend;
+	(void) send_sz;
+	(void) syscalls;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void arq_uring_free(struct arq_uring *u)
+{
+	(void) u;
+}
+
+int arq_uring_send(struct arq_uring *u, struct mmsghdr *msgs,
+		unsigned int n)
+{
+	(void) u;
+	(void) msgs;
+	(void) n;
+	errno = ENOSYS;
+	return -1;
+}
+
+int arq_uring_recv(struct arq_uring *u, struct arq_dgram *d, int n,
+		const struct timespec *timeout)
+{
+	(void) u;
+	(void) d;
+	(void) n;
+	(void) timeout;
+	errno = ENOSYS;
+	return -1;
+}
+
+void arq_uring_done(struct arq_uring *u, const struct arq_dgram *d, int n)
+{
+	(void) u;
+	(void) d;
+	(void) n;
+}
+
+int arq_uring_wait(struct arq_uring *u, const struct timespec *timeout)
+{
+	(void) u;
+	(void) timeout;
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
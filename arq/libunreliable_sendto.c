@@ -1,19 +1,563 @@
 
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "unreliable_sendto.h"
 
-#ifndef UNRELIABLE_SENDTO_H
-#define UNRELIABLE_SENDTO_H
+#define BATCH_MAX 64
+
+/* a packet waiting for its time to be sent */
+struct delayed {
+	struct timespec due;
+	unsigned long order;	/* keeps packets due together in order */
+	int sockfd;
+	int flags;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	size_t len;
+	unsigned char buf[];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct unreliable_channel chan;
+static int chan_ready;
+
+static uint64_t rng;
+static unsigned char periodic_count;
+static int ge_bad;
+
+/* delayed packets, a heap by due time */
+static pthread_cond_t cond;
+static pthread_t thread;
+static int thread_running;
+static struct delayed **heap;
+static int heap_len;
+static int heap_cap;
+static unsigned long order;
+
+/* splitmix64, a uniform double in [0, 1) */
+static double uniform()
+{
+	uint64_t z;
+
+	z = (rng += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z = z ^ (z >> 31);
+
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void channel_env(struct unreliable_channel *ch)
+{
+	char *v;
+
+	memset(ch, 0, sizeof(*ch));
+	ch->seed = 1;
+	ch->periodic = 1;
+	ch->ge_loss_bad = 1;
+	ch->reorder_ms = 1;
+	ch->limit = 1000;
+
+	if ((v = getenv("UNRELIABLE_SEED")))
+		ch->seed = strtoul(v, NULL, 0);
+	if ((v = getenv("UNRELIABLE_LOSS"))) {
+		ch->loss = strtod(v, NULL);
+		ch->periodic = 0;
+	}
+	if ((v = getenv("UNRELIABLE_GE"))) {
+		sscanf(v, "%lf,%lf,%lf,%lf", &ch->ge_p, &ch->ge_r,
+				&ch->ge_loss_bad, &ch->ge_loss_good);
+		ch->periodic = 0;
+	}
+	if ((v = getenv("UNRELIABLE_DELAY")))
+		sscanf(v, "%lf,%lf", &ch->delay_ms, &ch->jitter_ms);
+	if ((v = getenv("UNRELIABLE_DUP")))
+		ch->dup = strtod(v, NULL);
+	if ((v = getenv("UNRELIABLE_REORDER")))
+		sscanf(v, "%lf,%lf", &ch->reorder, &ch->reorder_ms);
+	if ((v = getenv("UNRELIABLE_CORRUPT")))
+		ch->corrupt = strtod(v, NULL);
+	if ((v = getenv("UNRELIABLE_LIMIT")))
+		ch->limit = atoi(v);
+}
+
+static void channel_start(const struct unreliable_channel *ch)
+{
+	chan = *ch;
+	rng = ch->seed;
+	periodic_count = 0;
+	ge_bad = 0;
+	chan_ready = 1;
+}
+
+/*
+ * channel()
+ *
+ * Decide the fate of the next packet, with the lock held.
+ *
+ * Returns: the number of copies to send (0 if it is lost), the
+ * delay before they are sent in 'delay', and in 'flip' whether a
+ * bit of them is to be flipped.
+ */
+static int channel(double *delay, int *flip)
+{
+	struct unreliable_channel ch;
+	double loss;
+
+	if (!chan_ready) {
+		channel_env(&ch);
+		channel_start(&ch);
+	}
+
+	if (chan.periodic) {
+		periodic_count++;
+		if (periodic_count & 0x4 && periodic_count & 0x2)
+			return 0;  /* 1/4 error, burst of 2 */
+	}
+
+	if (chan.ge_p > 0 || chan.ge_r > 0) {
+		if (ge_bad)
+			ge_bad = !(uniform() < chan.ge_r);
+		else
+			ge_bad = (uniform() < chan.ge_p);
+
+		loss = ge_bad ? chan.ge_loss_bad : chan.ge_loss_good;
+		if (loss > 0 && uniform() < loss)
+			return 0;
+	}
+
+	if (chan.loss > 0 && uniform() < chan.loss)
+		return 0;
+
+	*delay = chan.delay_ms;
+	if (chan.jitter_ms > 0)
+		*delay += (2 * uniform() - 1) * chan.jitter_ms;
+	if (chan.reorder > 0 && uniform() < chan.reorder)
+		*delay += chan.reorder_ms;
+	if (*delay < 0)
+		*delay = 0;
+	*flip = (chan.corrupt > 0 && uniform() < chan.corrupt);
+
+	return (chan.dup > 0 && uniform() < chan.dup) ? 2 : 1;
+}
+
+/* does the channel do anything at all to packets? */
+static int impaired()
+{
+	struct unreliable_channel ch;
+	int r;
+
+	pthread_mutex_lock(&lock);
+	if (!chan_ready) {
+		channel_env(&ch);
+		channel_start(&ch);
+	}
+	r = chan.periodic || chan.loss > 0 || chan.ge_p > 0 || chan.ge_r > 0
+		|| chan.delay_ms > 0 || chan.jitter_ms > 0 || chan.dup > 0
+		|| chan.reorder > 0 || chan.corrupt > 0;
+	pthread_mutex_unlock(&lock);
+
+	return r;
+}
+
+static int before(const struct delayed *a, const struct delayed *b)
+{
+	if (a->due.tv_sec != b->due.tv_sec)
+		return a->due.tv_sec < b->due.tv_sec;
+	if (a->due.tv_nsec != b->due.tv_nsec)
+		return a->due.tv_nsec < b->due.tv_nsec;
+	return a->order < b->order;
+}
+
+static void heap_push(struct delayed *d)
+{
+	int i;
+
+	for (i = heap_len++; i > 0 && before(d, heap[(i - 1) / 2]);
+			i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = d;
+}
+
+static struct delayed *heap_pop()
+{
+	struct delayed *top, *d;
+	int i, c;
+
+	top = heap[0];
+	d = heap[--heap_len];
+
+	for (i = 0; (c = 2 * i + 1) < heap_len; i = c) {
+		if (c + 1 < heap_len && before(heap[c + 1], heap[c]))
+			c++;
+		if (!before(heap[c], d))
+			break;
+		heap[i] = heap[c];
+	}
+	heap[i] = d;
+
+	return top;
+}
+
+/* send the delayed packets when they are due */
+static void *delay_thread(void *arg)
+{
+	struct timespec now;
+	struct delayed *d;
+
+	(void) arg;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		if (0 == heap_len) {
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		d = heap[0];
+		if (now.tv_sec < d->due.tv_sec || (now.tv_sec == d->due.tv_sec
+					&& now.tv_nsec < d->due.tv_nsec)) {
+			pthread_cond_timedwait(&cond, &lock, &d->due);
+			continue;
+		}
+
+		heap_pop();
+		pthread_mutex_unlock(&lock);
+
+		/* the socket may be gone by now, the packet is simply lost */
+		sendto(d->sockfd, d->buf, d->len, d->flags,
+				(struct sockaddr *) &d->addr, d->addrlen);
+		free(d);
+
+		pthread_mutex_lock(&lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * delay()
+ *
+ * Queue 'copies' of a packet to be sent after 'ms', with the
+ * lock held.  With 'flip' a random bit of each copy is flipped.
+ */
+static int delay(int sockfd, const struct msghdr *msg, int flags,
+		double ms, int copies, int flip)
+{
+	pthread_condattr_t attr;
+	struct delayed **h;
+	struct delayed *d;
+	size_t i, len;
+
+	if (!thread_running) {
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&cond, &attr);
+		pthread_condattr_destroy(&attr);
+
+		errno = pthread_create(&thread, NULL, delay_thread, NULL);
+		if (errno)
+			return -1;
+		pthread_detach(thread);
+		thread_running = 1;
+	}
+
+	len = 0;
+	for (i = 0; i < msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+
+	while (copies--) {
+		if (heap_len >= chan.limit)
+			return 0;  /* the queue is full, the packet is lost */
+
+		if (heap_len == heap_cap) {
+			heap_cap = heap_cap ? 2 * heap_cap : 256;
+			h = realloc(heap, heap_cap * sizeof(*heap));
+			if (NULL == h)
+				return -1;
+			heap = h;
+		}
+
+		d = malloc(sizeof(*d) + len);
+		if (NULL == d)
+			return -1;
 
-static unsigned char rand;
+		clock_gettime(CLOCK_MONOTONIC, &d->due);
+		d->due.tv_nsec += ms * 1000000;
+		d->due.tv_sec += d->due.tv_nsec / 1000000000;
+		d->due.tv_nsec %= 1000000000;
+		d->order = order++;
+		d->sockfd = sockfd;
+		d->flags = flags;
+		d->addrlen = 0;
+		if (msg->msg_name != NULL) {
+			d->addrlen = msg->msg_namelen;
+			memcpy(&d->addr, msg->msg_name, msg->msg_namelen);
+		}
+		d->len = 0;
+		for (i = 0; i < msg->msg_iovlen; i++) {
+			memcpy(d->buf + d->len, msg->msg_iov[i].iov_base,
+					msg->msg_iov[i].iov_len);
+			d->len += msg->msg_iov[i].iov_len;
+		}
+		if (flip && d->len) {
+			i = uniform() * d->len * 8;
+			d->buf[i / 8] ^= 1 << (i % 8);
+		}
+
+		heap_push(d);
+		if (heap[0] == d)
+			pthread_cond_signal(&cond);
+	}
+
+	return 0;
+}
 
 ssize_t unreliable_sendto(int sockfd, const void *buf, size_t len, int flags,
 			const struct sockaddr *dest_addr, socklen_t addrlen)
 {
-	rand++;
-	if (rand & 0x4 && rand & 0x2)  /* 1/4 error, burst of 2 */
-		return len; /* drop packet, but indicate it was sent */
-	else
-		return sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+	struct msghdr msg;
+	struct iovec iov;
+	double ms = 0;
+	ssize_t n = len;
+	int copies, flip;
+
+	pthread_mutex_lock(&lock);
+	copies = channel(&ms, &flip);
+	if (copies && (ms > 0 || flip)) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = (void *) dest_addr;
+		msg.msg_namelen = addrlen;
+		iov.iov_base = (void *) buf;
+		iov.iov_len = len;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if (-1 == delay(sockfd, &msg, flags, ms, copies, flip))
+			n = -1;
+		copies = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	while (copies--) {
+		n = sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+		if (-1 == n)
+			return -1;
+	}
+
+	return n;  /* a lost packet is indicated as sent */
 }
 
-#endif /* UNRELIABLE_SENDTO_H */
+static int mmsg_send(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+		int flags)
+{
+	struct mmsghdr keep[2 * BATCH_MAX];
+	struct mmsghdr *orig[2 * BATCH_MAX];
+	unsigned int i, j, k, sent;
+	size_t len;
+	double ms;
+	int copies, flip;
+	int n;
+
+	for (i = 0; i < vlen; i += k) {
+		k = (vlen - i < BATCH_MAX) ? vlen - i : BATCH_MAX;
+
+		/* keep the packets to send now, queue the delayed ones */
+		pthread_mutex_lock(&lock);
+		for (j = 0, n = 0; j < k; j++) {
+			len = 0;
+			for (sent = 0; sent < msgvec[i + j].msg_hdr.msg_iovlen;
+					sent++)
+				len += msgvec[i + j].msg_hdr.msg_iov[sent].iov_len;
+			msgvec[i + j].msg_len = len;
+
+			ms = 0;
+			copies = channel(&ms, &flip);
+			if (copies && (ms > 0 || flip)) {
+				if (-1 == delay(sockfd, &msgvec[i + j].msg_hdr,
+							flags, ms, copies, flip)) {
+					pthread_mutex_unlock(&lock);
+					return (0 == i) ? -1 : (int) i;
+				}
+				continue;
+			}
+
+			while (copies--) {
+				orig[n] = &msgvec[i + j];
+				keep[n++] = msgvec[i + j];
+			}
+		}
+		pthread_mutex_unlock(&lock);
+
+		for (sent = 0; sent < (unsigned int) n; ) {
+			j = sendmmsg(sockfd, keep + sent, n - sent, flags);
+			if ((unsigned int) -1 == j)
+				return (0 == i) ? -1 : (int) i;
+			sent += j;
+		}
+
+		for (j = 0; j < (unsigned int) n; j++)
+			orig[j]->msg_len = keep[j].msg_len;
+	}
+
+	return vlen;
+}
+
+/* the segment size of a datagram for UDP GSO, 0 if it is not one */
+static size_t segment_size(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	uint16_t seg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (SOL_UDP == cmsg->cmsg_level
+				&& UDP_SEGMENT == cmsg->cmsg_type) {
+			memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+			return seg;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * segments_send()
+ *
+ * Send a datagram for UDP GSO as the segments the kernel would have
+ * split it into, so that each of them meets its own fate.
+ */
+static int segments_send(int sockfd, struct mmsghdr *m, int flags,
+		size_t seg)
+{
+	struct mmsghdr *segs;
+	struct iovec *iov;
+	unsigned char *buf;
+	size_t i, n, len;
+	int r;
+
+	len = 0;
+	for (i = 0; i < m->msg_hdr.msg_iovlen; i++)
+		len += m->msg_hdr.msg_iov[i].iov_len;
+	n = (len + seg - 1) / seg;
+
+	buf = malloc(len);
+	segs = calloc(n, sizeof(*segs));
+	iov = calloc(n, sizeof(*iov));
+	if (NULL == buf || NULL == segs || NULL == iov) {
+		free(buf);
+		free(segs);
+		free(iov);
+		return -1;
+	}
+
+	len = 0;
+	for (i = 0; i < m->msg_hdr.msg_iovlen; i++) {
+		memcpy(buf + len, m->msg_hdr.msg_iov[i].iov_base,
+				m->msg_hdr.msg_iov[i].iov_len);
+		len += m->msg_hdr.msg_iov[i].iov_len;
+	}
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf + i * seg;
+		iov[i].iov_len = (len - i * seg < seg) ? len - i * seg : seg;
+		segs[i].msg_hdr.msg_name = m->msg_hdr.msg_name;
+		segs[i].msg_hdr.msg_namelen = m->msg_hdr.msg_namelen;
+		segs[i].msg_hdr.msg_iov = &iov[i];
+		segs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	r = mmsg_send(sockfd, segs, n, flags);
+	m->msg_len = len;
+
+	free(buf);
+	free(segs);
+	free(iov);
+
+	return (-1 == r) ? -1 : 0;
+}
+
+int unreliable_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+		int flags)
+{
+	unsigned int i, j;
+	size_t seg = 0;
+	int bad;
+	int n;
+
+	/*
+	 * A datagram for UDP GSO goes through whole, unless the channel
+	 * has something to do to each of its segments.
+	 */
+	bad = impaired();
+	for (i = 0; i < vlen; i = j + 1) {
+		for (j = i; j < vlen; j++) {
+			seg = bad ? segment_size(&msgvec[j].msg_hdr) : 0;
+			if (seg)
+				break;
+		}
+
+		if (j > i) {
+			n = mmsg_send(sockfd, msgvec + i, j - i, flags);
+			if (-1 == n)
+				return (0 == i) ? -1 : (int) i;
+			if ((unsigned int) n < j - i)
+				return i + n;
+		}
+
+		if (j < vlen && -1 == segments_send(sockfd, &msgvec[j], flags,
+					seg))
+			return (0 == j) ? -1 : (int) j;
+	}
+
+	return vlen;
+}
+
+int unreliable_transparent()
+{
+	return !impaired();
+}
+
+void unreliable_get_channel(struct unreliable_channel *ch)
+{
+	pthread_mutex_lock(&lock);
+	if (!chan_ready) {
+		channel_env(ch);
+		channel_start(ch);
+	}
+	*ch = chan;
+	pthread_mutex_unlock(&lock);
+}
+
+int unreliable_set_channel(const struct unreliable_channel *ch)
+{
+	if (ch->loss < 0 || ch->loss > 1
+			|| ch->ge_p < 0 || ch->ge_p > 1
+			|| ch->ge_r < 0 || ch->ge_r > 1
+			|| ch->ge_loss_bad < 0 || ch->ge_loss_bad > 1
+			|| ch->ge_loss_good < 0 || ch->ge_loss_good > 1
+			|| ch->dup < 0 || ch->dup > 1
+			|| ch->reorder < 0 || ch->reorder > 1
+			|| ch->corrupt < 0 || ch->corrupt > 1
+			|| ch->delay_ms < 0 || ch->jitter_ms < 0
+			|| ch->reorder_ms < 0 || ch->limit < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	channel_start(ch);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
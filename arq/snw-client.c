@@ -15,6 +15,61 @@
  *   ./snw-client localhost 16245 data
  *   (result in data.out)
  *
+ * The ARQ window (-w) is the number of out of order packets
+ * that will be buffered, it should match the server.
+ *
+ *   ./snw-client -w 32 localhost 16245 data
+ *
+ * With Go-Back-N (-m gbn) nothing is buffered out of order so
+ * a window of 1 is enough even if the server uses a larger one.
+ *
+ *   ./snw-client -m gbn localhost 16245 data
+ *
+ * Datagrams are sent and received in batches of up to -b with
+ * one system call, and -s shows how many system calls were made
+ * for each MB of data.
+ *
+ *   ./snw-client -w 32 -b 16 -s localhost 16245 data
+ *
+ * With -a the ACKs are delayed, one is sent for every -a packets
+ * that arrive in order (or after ACK_DELAY_MS).
+ *
+ *   ./snw-client -w 32 -a 2 localhost 16245 data
+ *
+ * With -M packets from the server may carry up to that much data,
+ * and -g reads runs of them as one (UDP GRO).
+ *
+ *   ./snw-client -w 64 -b 32 -M 65000 -g localhost 16245 data
+ *
+ * Everything that has arrived in order is taken at once
+ * (arq_session_recvv) into a ring of large buffers.  A writer
+ * thread writes the full ones behind it with one writev, so the
+ * ACKs never wait for the disk unless the whole ring is full.
+ *
+ * With -k damaged packets are caught by a CRC32C in every one,
+ * and the file by a digest at the end (EBADMSG), as long as the
+ * server uses -k too.
+ *
+ *   ./snw-client -w 64 -k localhost 16245 data
+ *
+ * With -j n the file is split into n ranges, each received from
+ * the next port of a server with -j at least n, by a thread and a
+ * session of its own, and written in place (pwritev).
+ *
+ *   ./snw-client -w 64 -j 4 localhost 16245 data
+ *
+ * With -d many files, or directories, are received into a directory
+ * at once, in one session (see snw.h).  Each is written under its
+ * path on the server, which must be relative and without "..".
+ *
+ *   ./snw-client -w 64 -d copy localhost 16245 photos notes.txt
+ *   (result in copy/photos/..., copy/notes.txt)
+ *
+ * While a transfer is not complete a <in file>.out.part file holds
+ * the size and time of the file on the server.  If the client is
+ * run again it only asks for the rest, after what is in the .out
+ * file, and the server sends it if the file has not changed.
+ *
  * A good way to generate random data is with 'dd'.
  * The following would create 5M of random data.
  *
@@ -39,32 +94,816 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <limits.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #include "unreliable_sendto.h"
 #include "arq.h"
+#include "snw.h"
+
+/*
+ * The ring of receive buffers, each one is only written once it is
+ * full so the writes are large and aligned.  Two of them must hold
+ * the largest packets that arrive in order at once.
+ */
+#define RING_N 32
+#define RING_SZ (256 * 1024)
+
+struct ring {
+	char *buf;		/* RING_N buffers of RING_SZ */
+	size_t len[RING_N];	/* data in each full buffer */
+	unsigned int head;	/* the buffer being filled */
+	unsigned int tail;	/* the next one to be written */
+	int done;		/* nothing more will be filled */
+	int err;		/* errno of a failed write, or 0 */
+	int fd;
+	off_t pos;		/* of the file, where 'tail' goes */
+	struct entry *man;	/* a manifest is cut up into files instead */
+	pthread_mutex_t lock;
+	pthread_cond_t full;	/* a buffer was filled, or done */
+	pthread_cond_t empty;	/* a buffer was written */
+};
+
+#define RING_BUF(r, i) ((r)->buf + ((i) % RING_N) * RING_SZ)
+#define RING_LEN(r, i) ((r)->len[(i) % RING_N])
 
 int quit = 0;
 void int_handler() {
 	quit = 1;
 }
 
+/* the options of every session */
+int window = 1;
+int mode = ARQ_SR;
+int batch = 1;
+int delack = 1;
+int mss = DATA_SZ;
+int offload = 0;
+int crc = 0;
+int stats = 0;
+FILE *evtrace = NULL;
+char *outdir = NULL;
+
+/*
+ * A striped transfer (-j) receives a range of the file with each of
+ * its own sessions, from the next port of the server, in a thread
+ * of its own.
+ */
+struct stripe {
+	const struct addrinfo *res;	/* of the server */
+	int port;			/* after the one given */
+	const char *infile;
+	int outfd;
+	long long start;		/* the range */
+	long long end;
+	long long size;			/* of the file it is from */
+	long long mtime;
+	pthread_t thread;
+	int eof;			/* all of it arrived */
+	int err;			/* errno of a failure, or 0 */
+};
+
+/*
+ * Manifests (-d)
+ *
+ * The stream of a manifest is taken a batch of packets at a time
+ * and cut up into its files, the data of each one written as it
+ * arrives.
+ */
+
+/* a header, with the sizes before the path */
+#define ENTRY_MAX (PATH_MAX + 64)
+
+struct entry {
+	char hdr[ENTRY_MAX];	/* of the next file, so far */
+	size_t hdr_len;
+	char path[PATH_MAX];	/* where it is written */
+	char dir[PATH_MAX];	/* the last directory made */
+	int fd;			/* or -1 while its data is skipped */
+	long long left;		/* of its data still to come */
+	long long mtime;
+	int files;		/* written */
+	int failed;
+};
+
+/* is 'path' one that stays inside the directory? */
+static int path_safe(const char *path) {
+	size_t n;
+
+	if ('\0' == *path)
+		return 0;
+	for (; *path; path += n + ('/' == path[n])) {
+		n = strcspn(path, "/");
+		if (2 == n && 0 == strncmp(path, "..", 2))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* make the directories that the file of 'e' is in */
+static int dirs_make(struct entry *e) {
+	char *p, *end;
+
+	end = strrchr(e->path, '/');
+	if (NULL == end || ((size_t) (end - e->path) == strlen(e->dir)
+				&& 0 == strncmp(e->path, e->dir,
+					end - e->path)))
+		return 0;
+
+	for (p = strchr(e->path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (-1 == mkdir(e->path, 0775) && EEXIST != errno) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	memcpy(e->dir, e->path, end - e->path);
+	e->dir[end - e->path] = '\0';
+
+	return 0;
+}
+
+/* the file of 'e' is complete */
+static void entry_end(struct entry *e) {
+	struct timespec times[2];
+
+	if (-1 == e->fd)
+		return;
+
+	times[0].tv_sec = times[1].tv_sec = e->mtime;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	futimens(e->fd, times);
+	if (-1 == close(e->fd)) {
+		perror(e->path);
+		e->failed++;
+	} else {
+		e->files++;
+	}
+	e->fd = -1;
+}
+
+/*
+ * entry_start()
+ *
+ * Start on the file whose header is in 'e'.  Its data is skipped if
+ * it can not be written, and there is none if it was not sent.
+ *
+ * Returns: 0, or -1 with errno EPROTO if the header is not one.
+ */
+static int entry_start(struct entry *e) {
+	long long size;
+	unsigned int mode;
+	const char *name;
+	int off = 0;
+	int n;
+
+	e->hdr_len = 0;
+	e->left = 0;
+	if (3 != sscanf(e->hdr, SNW_ENTRY "%n", &size, &e->mtime, &mode,
+				&off) || 0 == off) {
+		errno = EPROTO;
+		return -1;
+	}
+	name = e->hdr + off;
+
+	if (size < 0) {
+		fprintf(stderr, "%s: not sent\n", name);
+		e->failed++;
+		return 0;
+	}
+	e->left = size;
+
+	/* under the directory, whatever the path was */
+	name += strspn(name, "/");
+	n = snprintf(e->path, sizeof(e->path), "%s/%s", outdir, name);
+	if (!path_safe(name) || n < 0 || (size_t) n >= sizeof(e->path)) {
+		fprintf(stderr, "%s: not a path to write to\n", name);
+		e->failed++;
+		return 0;
+	}
+
+	if (-1 == dirs_make(e)
+			|| -1 == (e->fd = open(e->path, O_WRONLY | O_CREAT
+					| O_TRUNC, mode & 0777))) {
+		perror(e->path);
+		e->failed++;
+		return 0;
+	}
+	if (0 == e->left)
+		entry_end(e);
+
+	return 0;
+}
+
+/* write all 'len' bytes of 'buf' */
+static int write_all(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	for (; len; buf += n, len -= n) {
+		n = write(fd, buf, len);
+		if (-1 == n)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * entries_write()
+ *
+ * Cut the next part of the stream of a manifest, in 'cnt' buffers,
+ * up into the headers and data of its files and write them.
+ *
+ * Returns: all of it, or -1 with errno EPROTO if it is not a stream.
+ */
+ssize_t entries_write(struct entry *e, const struct iovec *iov, int cnt) {
+	ssize_t total = 0;
+	char *p, *q;
+	size_t n, k;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		p = iov[i].iov_base;
+		n = iov[i].iov_len;
+		total += n;
+
+		while (n > 0) {
+			/* the data of a file */
+			if (e->left > 0) {
+				k = MIN((long long) n, e->left);
+				if (-1 != e->fd && -1 == write_all(e->fd,
+							p, k)) {
+					perror(e->path);
+					close(e->fd);
+					e->fd = -1;
+					e->failed++;
+				}
+				p += k;
+				n -= k;
+				e->left -= k;
+				if (0 == e->left)
+					entry_end(e);
+				continue;
+			}
+
+			/* or the header of the next one, up to its '\0' */
+			q = memchr(p, '\0', n);
+			k = q ? (size_t) (q - p) + 1 : n;
+			if (e->hdr_len + k > sizeof(e->hdr)) {
+				errno = EPROTO;
+				return -1;
+			}
+			memcpy(e->hdr + e->hdr_len, p, k);
+			e->hdr_len += k;
+			p += k;
+			n -= k;
+			if (q && -1 == entry_start(e))
+				return -1;
+		}
+	}
+
+	return total;
+}
+
+/*
+ * write_behind()
+ *
+ * The writer thread, writes the full buffers of the ring in order
+ * until it is done and empty, or the files of a manifest in them.
+ */
+void *write_behind(void *arg) {
+	struct ring *r = arg;
+	struct iovec iov[RING_N];
+	unsigned int i, end, cnt;
+	ssize_t n;
+	size_t off = 0;	/* already written of the buffer at 'tail' */
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->err) {
+		while (r->tail == r->head && !r->done)
+			pthread_cond_wait(&r->full, &r->lock);
+		if (r->tail == r->head)
+			break;
+		end = r->head;
+		pthread_mutex_unlock(&r->lock);
+
+		/*
+		 * Every full buffer with one pwritev.  The files of a
+		 * manifest are made one buffer at a time instead, so the
+		 * ring does not wait for thousands of them to be free.
+		 */
+		if (r->man)
+			end = r->tail + 1;
+		for (i = r->tail, cnt = 0; i != end; i++, cnt++) {
+			iov[cnt].iov_base = RING_BUF(r, i) + off;
+			iov[cnt].iov_len = RING_LEN(r, i) - off;
+			off = 0;
+		}
+		if (r->man)
+			n = entries_write(r->man, iov, cnt);
+		else
+			n = pwritev(r->fd, iov, cnt, r->pos);
+
+		pthread_mutex_lock(&r->lock);
+		if (-1 == n) {
+			r->err = errno;
+			break;
+		}
+		r->pos += n;
+
+		/* a short write goes on from where it stopped */
+		for (i = 0; i < cnt && (size_t) n >= iov[i].iov_len; i++) {
+			n -= iov[i].iov_len;
+			r->tail++;
+		}
+		off = (i < cnt) ? (char *) iov[i].iov_base + n
+				- RING_BUF(r, r->tail) : 0;
+		pthread_cond_signal(&r->empty);
+	}
+	pthread_cond_signal(&r->empty);
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/*
+ * ring_init()
+ *
+ * Set up a ring that writes to 'fd' from 'pos' on.
+ *
+ * Returns: 0, or the errno of a failure.
+ */
+int ring_init(struct ring *r, int fd, off_t pos) {
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->pos = pos;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->full, NULL);
+	pthread_cond_init(&r->empty, NULL);
+
+	return posix_memalign((void **) &r->buf, 4096, RING_N * RING_SZ);
+}
+
+void ring_free(struct ring *r) {
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->full);
+	pthread_cond_destroy(&r->empty);
+	free(r->buf);
+}
+
+/* pass the buffer being filled, with 'len' in it, to the writer */
+void ring_put(struct ring *r, size_t len) {
+	pthread_mutex_lock(&r->lock);
+	RING_LEN(r, r->head) = len;
+	r->head++;
+	pthread_cond_signal(&r->full);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * ring_wait()
+ *
+ * Wait until the buffer after the one being filled is free too.
+ *
+ * Returns: 0, or the errno of a write that failed.
+ */
+int ring_wait(struct ring *r) {
+	int err;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->head - r->tail > RING_N - 2 && !r->err)
+		pthread_cond_wait(&r->empty, &r->lock);
+	err = r->err;
+	pthread_mutex_unlock(&r->lock);
+
+	return err;
+}
+
+/*
+ * receive()
+ *
+ * Receive the data of 'sess' up to its EOF into the ring 'r', after
+ * the 'fill' bytes already in the buffer being filled, while a
+ * writer thread writes it behind.  '*eof' is set once all of it has
+ * arrived, rather than the transfer being interrupted.
+ *
+ * Returns: the bytes received (with 'fill'), or -1 on error.
+ */
+long long receive(struct arq_session *sess, struct ring *r, size_t fill,
+		int *eof) {
+	pthread_t writer;
+	struct iovec riov[2];
+	long long total = fill;
+	int err = 0;
+	int n;
+
+	*eof = 0;
+	errno = pthread_create(&writer, NULL, write_behind, r);
+	if (errno)
+		return -1;
+
+	/* the rest of the buffer being filled and all of the next one */
+	while (!*eof && !quit) {
+		err = ring_wait(r);
+		if (err)
+			break;
+		riov[0].iov_base = RING_BUF(r, r->head) + fill;
+		riov[0].iov_len = RING_SZ - fill;
+		riov[1].iov_base = RING_BUF(r, r->head + 1);
+		riov[1].iov_len = RING_SZ;
+
+		n = arq_session_recvv(sess, riov, 2, 0);
+		if (-1 == n) {
+			if (EINTR != errno || !quit)
+				err = errno;
+			break;
+		}
+
+		*eof = (0 == n);
+		total += n;
+		fill += n;
+		if (fill >= RING_SZ) {
+			fill -= RING_SZ;
+			ring_put(r, RING_SZ);
+		}
+	}
+
+	/* write the rest and wait for the writer */
+	ring_put(r, fill);
+	pthread_mutex_lock(&r->lock);
+	r->done = 1;
+	pthread_cond_signal(&r->full);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(writer, NULL);
+
+	if (!err)
+		err = r->err;
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return total;
+}
+
+void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-s] [-g] [-u|-U] [-k] [-w window] [-m sr|gbn] [-b batch]"
+			" [-a acks] [-M mss] [-j jobs] [-E events]"
+			" <host> <port> <input file>\n", prog);
+	fprintf(stderr, "                output -> <in file>.out\n");
+	fprintf(stderr, "       %s [options] -d dir <host> <port> <input>...\n",
+			prog);
+	fprintf(stderr, "                output -> <dir>/<input>\n");
+	exit(EXIT_FAILURE);
+}
+
+/* show the system calls per MB and the losses of a finished session */
+void print_stats(struct arq_session *sess) {
+	struct arq_stats st;
+	double mb;
+
+	if (!stats)
+		return;
+
+	arq_session_stats(sess, &st);
+	mb = (st.bytes_sent + st.bytes_recv) / (1024.0 * 1024.0);
+	fprintf(stderr, "%llu bytes, %lu syscalls, %.1f per MB,"
+			" %lu ACKs, %lu rebuilt, %lu damaged\n",
+			st.bytes_sent + st.bytes_recv, st.syscalls,
+			(mb > 0) ? st.syscalls / mb : 0, st.acks_sent,
+			st.fec_recovered, st.crc_errors);
+	fprintf(stderr, "%lu delayed ACKs, waited %.2f ms on average,"
+			" %.2f ms at most\n", st.acks_delayed,
+			st.ack_delay_avg_ms, st.ack_delay_max_ms);
+	fprintf(stderr, "%lu resent (%llu bytes), %lu timeouts, %lu fast,"
+			" %lu dupACKs, %lu gave up, RTT %.2f/%.2f/%.2f ms\n",
+			st.packets_resent, st.bytes_resent, st.timeouts,
+			st.fast_resends, st.dupacks, st.give_ups,
+			st.rtt_min_ms, st.rtt_avg_ms, st.rtt_max_ms);
+}
+
+/*
+ * session_open()
+ *
+ * Open a socket, and a session on it with the server at 'res' or
+ * 'port' ports after it.
+ *
+ * Returns: the session, or NULL on error.
+ */
+struct arq_session *session_open(const struct addrinfo *res, int port,
+		int *sockfd) {
+	struct sockaddr_in sin;
+	struct arq_session *sess;
+	int sock_buf = 4 * 1024 * 1024;	/* up to net.core.rmem_max */
+
+	memcpy(&sin, res->ai_addr, sizeof(sin));
+	sin.sin_port = htons(ntohs(sin.sin_port) + port);
+
+	*sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (*sockfd < 0)
+		return NULL;
+
+	/* a window of large packets needs more than the default buffer */
+	if (mss > DATA_SZ && -1 == setsockopt(*sockfd, SOL_SOCKET, SO_RCVBUF,
+				&sock_buf, sizeof(sock_buf))) {
+		close(*sockfd);
+		return NULL;
+	}
+
+	sess = arq_session_new(*sockfd, (struct sockaddr *) &sin, sizeof(sin));
+	if (NULL == sess
+			|| -1 == arq_session_set_window(sess, window)
+			|| -1 == arq_session_set_mode(sess, mode)
+			|| -1 == arq_session_set_batch(sess, batch)
+			|| -1 == arq_session_set_delack(sess, delack, ACK_DELAY_MS)
+			|| -1 == arq_session_set_mss(sess, mss, 1)
+			|| -1 == arq_session_set_offload(sess, offload)
+			|| -1 == arq_session_set_crc(sess, crc)) {
+		arq_session_free(sess);
+		close(*sockfd);
+		return NULL;
+	}
+	arq_session_set_events(sess, evtrace);
+
+	return sess;
+}
+
+/*
+ * request()
+ *
+ * Send the file name and where to resume, and up to 'end' unless it
+ * is -1 (see snw.h).  It is sent again if the server did not respond
+ * and 'retry' is set, otherwise that fails with ETIMEDOUT.
+ *
+ * Returns: 0, or -1 on error.
+ */
+int request(struct arq_session *sess, const char *infile, long long offset,
+		long long size, long long mtime, long long end, int retry) {
+	char sbuf[MAXLINE];
+	size_t len;
+	int n;
+
+	len = strlen(infile) + 1;
+	if (len + 96 > sizeof(sbuf)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(sbuf, infile, len);
+	if (-1 == end)
+		len += sprintf(sbuf + len, SNW_RESUME, offset, size, mtime);
+	else
+		len += sprintf(sbuf + len, SNW_RANGE, offset, size, mtime,
+				end);
+
+	do {
+		n = arq_session_send(sess, sbuf, len, 0);
+		if (-1 == n)
+			return -1;
+		if (0 == n && !retry) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	} while (0 == n && !quit);
+
+	return 0;
+}
+
+/*
+ * stripe_recv()
+ *
+ * The thread of a stripe, receives its range of the file.  The
+ * reply must start where the range does, in the same file.
+ */
+void *stripe_recv(void *arg) {
+	struct stripe *sp = arg;
+	struct arq_session *sess;
+	struct ring ring;
+	char hdr[MAXLINE];
+	long long offset, size, mtime;
+	long long n;
+	int sockfd;
+
+	sess = session_open(sp->res, sp->port, &sockfd);
+	if (NULL == sess) {
+		sp->err = errno;
+		return NULL;
+	}
+
+	/* the server said it has the worker, a give up is an error */
+	sp->err = ring_init(&ring, sp->outfd, sp->start);
+	if (0 == sp->err && -1 == request(sess, sp->infile, sp->start,
+				sp->size, sp->mtime, sp->end, 0))
+		sp->err = errno;
+
+	n = sp->err ? 0 : arq_session_recv(sess, ring.buf, RING_SZ, 0);
+	if (-1 == n) {
+		if (EINTR != errno || !quit)
+			sp->err = errno;
+	} else if (n > 0) {
+		memcpy(hdr, ring.buf, MIN((size_t) n, sizeof(hdr) - 1));
+		hdr[MIN((size_t) n, sizeof(hdr) - 1)] = '\0';
+		if (3 != sscanf(hdr, SNW_RESUME, &offset, &size, &mtime)
+				|| offset != sp->start || size != sp->size
+				|| mtime != sp->mtime)
+			sp->err = ESTALE;
+	}
+
+	if (n > 0 && !sp->err) {
+		n = receive(sess, &ring, 0, &sp->eof);
+		if (-1 == n)
+			sp->err = errno;
+		else if (sp->eof && n != sp->end - sp->start)
+			sp->err = EPROTO;
+	}
+
+	print_stats(sess);
+	arq_session_free(sess);
+	close(sockfd);
+	ring_free(&ring);
+
+	return NULL;
+}
+
+/*
+ * stripes()
+ *
+ * Receive the file of 'size' and 'mtime' in 'jobs' ranges at once,
+ * each from the next port of the server.
+ *
+ * Returns: 1 once all of it has arrived, 0 if interrupted, -1 on
+ * error.
+ */
+int stripes(const struct addrinfo *res, const char *infile, int outfd,
+		long long size, long long mtime, int jobs) {
+	struct stripe sp[MAX_JOBS];
+	struct timespec ts;
+	int port;
+	int i, j, r = 1;
+
+	port = ntohs(((struct sockaddr_in *) res->ai_addr)->sin_port);
+
+	/* ranges of whole buffers, so the writes stay aligned */
+	for (i = 0; i < jobs; i++) {
+		sp[i].res = res;
+		sp[i].port = i;
+		sp[i].infile = infile;
+		sp[i].outfd = outfd;
+		sp[i].start = size * i / jobs / RING_SZ * RING_SZ;
+		sp[i].end = size * (i + 1) / jobs / RING_SZ * RING_SZ;
+		if (jobs - 1 == i)
+			sp[i].end = size;
+		sp[i].size = size;
+		sp[i].mtime = mtime;
+		sp[i].eof = 0;
+		sp[i].err = 0;
+
+		errno = pthread_create(&sp[i].thread, NULL, stripe_recv,
+				&sp[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/*
+	 * An interrupt only reaches one thread, the rest are woken up
+	 * with one of their own so they do not wait for their data.
+	 */
+	for (i = 0; i < jobs; i++) {
+		do {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			ts.tv_sec += ts.tv_nsec / 1000000000;
+			ts.tv_nsec %= 1000000000;
+			for (j = i; quit && j < jobs; j++)
+				pthread_kill(sp[j].thread, SIGINT);
+		} while (ETIMEDOUT == pthread_timedjoin_np(sp[i].thread,
+					NULL, &ts));
+
+		if (sp[i].err) {
+			fprintf(stderr, "%s, stripe %d (port %d): %s\n",
+					infile, i, port + i,
+					strerror(sp[i].err));
+			r = -1;
+		} else if (!sp[i].eof && 1 == r) {
+			r = 0;
+		}
+	}
+
+	return r;
+}
+
+/*
+ * manifest_recv()
+ *
+ * Ask for the 'count' files and directories 'names' and receive all
+ * of the files into 'outdir'.  The stream goes through the ring, so
+ * the ACKs do not wait for the files to be written either.
+ *
+ * Returns: 0 if every one arrived, -1 if not.
+ */
+int manifest_recv(const struct addrinfo *res, char **names, int count) {
+	struct arq_session *sess;
+	struct entry *e;
+	struct ring ring;
+	char *req;
+	size_t len, k;
+	int sockfd;
+	int eof = 0, err = 0;
+	int i, n;
+
+	/* an empty name first, then the names and another empty one */
+	for (len = 2, i = 0; i < count; i++)
+		len += strlen(names[i]) + 1;
+	if (len > MANIFEST_MAX) {
+		fprintf(stderr, "manifest: %s\n", strerror(E2BIG));
+		return -1;
+	}
+
+	req = malloc(len);
+	e = calloc(1, sizeof(*e));
+	errno = (req && e) ? ring_init(&ring, -1, 0) : ENOMEM;
+	sess = errno ? NULL : session_open(res, 0, &sockfd);
+	if (NULL == sess) {
+		perror("manifest");
+		exit(EXIT_FAILURE);
+	}
+	e->fd = -1;
+	ring.man = e;
+
+	req[0] = '\0';
+	for (len = 1, i = 0; i < count; i++) {
+		k = strlen(names[i]) + 1;
+		memcpy(req + len, names[i], k);
+		len += k;
+	}
+	req[len++] = '\0';
+
+	for (k = 0; k < len && !quit; k += n) {
+		n = arq_session_send(sess, req + k, len - k, 0);
+		if (-1 == n) {
+			err = errno;
+			break;
+		}
+	}
+
+	if (!err && !quit && -1 == receive(sess, &ring, 0, &eof))
+		err = errno;
+
+	/* the EOF in the middle of a file */
+	if (eof && !err && (e->left || e->hdr_len))
+		err = EPROTO;
+
+	if (err)
+		fprintf(stderr, "manifest: %s\n", strerror(err));
+	else if (!eof)
+		fprintf(stderr, "%s: cut short\n", outdir);
+	if (e->fd != -1)
+		close(e->fd);
+	if (stats)
+		fprintf(stderr, "%d files, %d failed\n", e->files, e->failed);
+
+	print_stats(sess);
+	arq_session_free(sess);
+	close(sockfd);
+	ring_free(&ring);
+	n = (eof && !err && 0 == e->failed) ? 0 : -1;
+	free(req);
+	free(e);
+
+	return n;
+}
+
 int main(int argc, char* argv[]) {
 	char *infile;
 	char outfile[1024];
+	char partfile[1024];
 	int outfd;
+	struct stat sb;
+	FILE *fp;
+	long long offset = 0;	/* what is already in outfile */
+	long long size = -1;	/* and of what file on the server */
+	long long mtime = -1;
+	int eof = 0;
 
 	int n;
 
@@ -72,15 +911,21 @@ int main(int argc, char* argv[]) {
 	char *host;
 	char *port;
 
-	char sbuf[MAXLINE];	/* send buffer */
-	char rbuf[MAXLINE];	/* receive buffer */
-	size_t len;
+	char sbuf[MAXLINE];
+	struct ring ring;
+	size_t fill = 0;	/* data in the buffer being filled */
 
 	int sockfd = 0;
 	struct addrinfo *res = NULL;
+	struct arq_session *sess;
 
 	struct sigaction int_act;
 
+	int opt;
+	int jobs = 1;
+	int workers;		/* of the server, for a stripe each */
+	int k;
+
 	memset(&int_act, 0, sizeof(int_act));
 	int_act.sa_handler = int_handler;
 	if (-1 == sigaction(SIGINT, &int_act, 0)) {
@@ -88,15 +933,93 @@ int main(int argc, char* argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
-	if (argc != 4) {
-		fprintf(stderr, "usage: %s <host> <port> <input file>\n",
-				argv[0]);
-		fprintf(stderr, "                output -> <in file>.out\n");
+	while ((opt = getopt(argc, argv, "w:m:b:a:M:j:E:d:gksuU")) != -1) {
+		switch (opt) {
+		case 'd':
+			outdir = optarg;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'a':
+			delack = atoi(optarg);
+			break;
+		case 'M':
+			mss = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'g':
+			offload |= ARQ_GSO | ARQ_GRO;
+			break;
+		case 'u':
+			offload |= ARQ_URING;
+			break;
+		case 'U':
+			offload |= ARQ_URING | ARQ_SQPOLL;
+			break;
+		case 'k':
+			crc = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'E':
+			evtrace = fopen(optarg, "wb");
+			if (NULL == evtrace) {
+				perror(optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'm':
+			if (0 == strcmp(optarg, "sr"))
+				mode = ARQ_SR;
+			else if (0 == strcmp(optarg, "gbn"))
+				mode = ARQ_GBN;
+			else
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((outdir ? argc - optind < 3 : argc - optind != 3)
+			|| window < 1 || window > ARQ_MAX_WINDOW
+			|| batch < 1 || batch > ARQ_MAX_BATCH
+			|| delack < 1 || delack > ARQ_MAX_WINDOW
+			|| mss < DATA_SZ || mss > ARQ_MAX_MSS
+			|| jobs < 1 || jobs > MAX_JOBS || (outdir && jobs > 1))
+		usage(argv[0]);
+
+	host = argv[optind];
+	port = argv[optind + 1];
+	infile = argv[optind + 2];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family 	= AF_INET;
+	hints.ai_socktype 	= SOCK_DGRAM;
+
+	if ( (n = getaddrinfo(host, port, &hints, &res)) != 0) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(n));
 		exit(EXIT_FAILURE);
 	}
-	host = argv[1];
-	port = argv[2];
-	infile = argv[3];
+
+	/* every file of the manifest into the directory */
+	if (outdir) {
+		if (-1 == mkdir(outdir, 0775) && EEXIST != errno) {
+			perror(outdir);
+			exit(EXIT_FAILURE);
+		}
+		n = manifest_recv(res, argv + optind + 2, argc - optind - 2);
+		if (evtrace)
+			fclose(evtrace);
+		freeaddrinfo(res);
+		return (-1 == n) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
 
 	/* The output file is the infile with .out appended. */
 	n = snprintf(outfile, sizeof(outfile), "%s.out", infile);
@@ -104,52 +1027,124 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "snprintf failed\n");
 		exit(EXIT_FAILURE);
 	}
-	outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	outfd = open(outfile, O_WRONLY | O_CREAT, 0664);
 	if (-1 == outfd) {
 		perror("open outfile");
 		exit(EXIT_FAILURE);
 	}
 
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family 	= AF_INET;
-	hints.ai_socktype 	= SOCK_DGRAM;
-
-	if ( (n = getaddrinfo(host, port, &hints, &res)) != 0) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(n));
+	/*
+	 * The part file of a transfer that was cut short.  A striped
+	 * one is not resumed, its .out file has holes.
+	 */
+	n = snprintf(partfile, sizeof(partfile), "%s.part", outfile);
+	if (n < 0 || (size_t) n >= sizeof(partfile)) {
+		fprintf(stderr, "snprintf failed\n");
 		exit(EXIT_FAILURE);
 	}
+	fp = (1 == jobs) ? fopen(partfile, "r") : NULL;
+	if (fp) {
+		if (2 == fscanf(fp, "%lld %lld", &size, &mtime)
+				&& 0 == fstat(outfd, &sb))
+			offset = sb.st_size;
+		fclose(fp);
+	}
 
-	sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (sockfd < 0) {
-		perror("socket");
+	sess = session_open(res, 0, &sockfd);
+	if (NULL == sess) {
+		perror("session_open");
 		exit(EXIT_FAILURE);
 	}
 
-	/* send the file name */
-	len = (strlen(infile) + 1)*sizeof(*infile);
-	memcpy(&sbuf, infile, len);
-	n = arq_sendto(sockfd, &sbuf, len, 0, res->ai_addr, res->ai_addrlen);
-	if (-1 == n) {
-		perror("arq_sendto");
+	/* a striped transfer first asks for nothing, to learn the size */
+	if (-1 == request(sess, infile, offset, size, mtime,
+				(1 == jobs) ? -1 : 0, 1)) {
+		perror("request");
 		exit(EXIT_FAILURE);
 	}
 
-	while ( (n = arq_recvfrom(sockfd, &rbuf, MAXLINE, 0, NULL, NULL))) {
-		if (quit)
-			break;
+	errno = ring_init(&ring, outfd, 0);
+	if (errno) {
+		perror("posix_memalign");
+		exit(EXIT_FAILURE);
+	}
 
-		if (-1 == n) {
-			perror("arq_recvfrom");
+	/*
+	 * The reply starts with where the data starts, unless it is an
+	 * error such as a 404, which is just data.
+	 */
+	n = arq_session_recv(sess, ring.buf, RING_SZ, 0);
+	if (-1 == n) {
+		perror("arq_session_recv");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(sbuf, ring.buf, MIN((size_t) n, sizeof(sbuf) - 1));
+	sbuf[MIN((size_t) n, sizeof(sbuf) - 1)] = '\0';
+	k = (n > 0) ? sscanf(sbuf, SNW_WORKERS, &offset, &size, &mtime,
+			&workers) : 0;
+	if (k >= 3) {
+		/* a stripe without a worker would never be answered */
+		if (4 == k && jobs > workers) {
+			fprintf(stderr, "%s: -j %d, but the server runs"
+					" -j %d\n", infile, jobs, workers);
+			exit(EXIT_FAILURE);
+		}
+		fp = (1 == jobs) ? fopen(partfile, "w") : NULL;
+		if (1 == jobs && (NULL == fp
+				|| fprintf(fp, "%lld %lld\n", size, mtime) < 0
+				|| EOF == fclose(fp))) {
+			perror(partfile);
 			exit(EXIT_FAILURE);
 		}
+	} else {
+		offset = 0;
+		fill = n;
+		eof = (0 == n);
+		jobs = 1;
+		unlink(partfile);
+	}
+	if (-1 == ftruncate(outfd, (1 == jobs) ? offset : size)) {
+		perror("outfile");
+		exit(EXIT_FAILURE);
+	}
 
-		n = write(outfd, rbuf, n);
-		if (-1 == n) {
-			perror("write");
+	if (1 == jobs) {
+		ring.pos = offset;
+		if (!eof && -1 == receive(sess, &ring, fill, &eof)) {
+			/* the digest is wrong, do not resume from it */
+			if (EBADMSG == errno)
+				unlink(partfile);
+			perror(infile);
 			exit(EXIT_FAILURE);
 		}
+	} else {
+		/* the EOF of the empty reply */
+		while (!quit && 0 != (n = arq_session_recv(sess, sbuf,
+						sizeof(sbuf), 0))) {
+			if (-1 == n && EINTR != errno) {
+				perror("arq_session_recv");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		n = quit ? 0 : stripes(res, infile, outfd, size, mtime, jobs);
+		if (-1 == n)
+			exit(EXIT_FAILURE);
+		eof = n;
 	}
 
+	/* complete, nothing to resume */
+	if (eof)
+		unlink(partfile);
+	else
+		fprintf(stderr, "%s: cut short\n", outfile);
+
+	print_stats(sess);
+	arq_session_free(sess);
+	ring_free(&ring);
+	if (evtrace)
+		fclose(evtrace);
+
 	if (sockfd > 0)
 		close(sockfd);
 
@@ -8,6 +8,77 @@
  *   ./snw-server
  *   Port: 16245
  *
+ * The ARQ window can be given with -w, the default is 1
+ * which is Stop and Wait.
+ *
+ *   ./snw-server -w 32
+ *
+ * Selective Repeat (-m sr) is used unless Go-Back-N is
+ * chosen with -m gbn.
+ *
+ *   ./snw-server -w 32 -m gbn
+ *
+ * Normally one client is served at a time.  With -e an event
+ * loop serves every client in parallel from the same socket.
+ *
+ *   ./snw-server -e -w 32
+ *
+ * Datagrams are sent and received in batches of up to -b
+ * with one system call, and -s shows how many system calls
+ * each transfer needed.
+ *
+ *   ./snw-server -e -w 32 -b 16 -s
+ *
+ * A congestion control algorithm (-c reno or cubic) keeps less
+ * than the whole window in flight until the path is known to take
+ * it.  -C writes every change of the congestion window to a file.
+ *
+ *   ./snw-server -w 256 -c cubic -C cwnd.csv
+ *
+ * With -p new packets are paced, spread out evenly at a rate in
+ * Mbit/s or at one window per RTT (-p cwnd).
+ *
+ *   ./snw-server -w 256 -c cubic -p cwnd
+ *
+ * With -f k,m every k data packets are followed by m parity packets
+ * (forward error correction), and the client can rebuild up to m
+ * lost packets of them without waiting for a re-send.  An m of 1
+ * (the default) is a simple XOR, more use Reed-Solomon.
+ *
+ *   ./snw-server -w 64 -f 16,2
+ *
+ * With -M packets may carry up to that much data, as far as the
+ * path and the client allow, which is found by probing.  With -g
+ * runs of them are sent with one large datagram (UDP GSO).
+ *
+ *   ./snw-server -w 64 -b 32 -M 65000 -g
+ *
+ * Files are mapped (mmap) and the packets sent straight from the
+ * mapping, so the data is never copied and a re-send only refers
+ * to it again.  A file that is changed while it is being sent can
+ * not be sent correctly.  One that is truncated ends its transfer
+ * without the EOF, so the client can start over, and the other
+ * transfers go on.
+ *
+ * With -k every packet carries a CRC32C, damaged ones are dropped,
+ * and the EOF a digest of the file that the client checks.  The
+ * client must use -k too.
+ *
+ *   ./snw-server -w 64 -k
+ *
+ * A client can resume a transfer that was cut short, the server
+ * then only sends the rest if the file has not changed (see snw.h).
+ *
+ * A client can also ask for a manifest of files and directories
+ * (snw-client -d), every file under them is then sent in one session
+ * with a small header before each, small ones back to back.
+ *
+ * With -j n there are n workers, each a thread with a socket of its
+ * own on the n ports from the one shown, so a striped client (-j)
+ * can receive a range of the file from each at once.
+ *
+ *   ./snw-server -e -w 64 -j 4
+ *
  * Then the snw-client can connect and send a string of
  * the file name that the server should open and read
  * data from.  The server will transfer the data from
@@ -16,38 +87,1444 @@
  *   (terminal 2)
  *   ./snw-client localhost 16245 data
  *
- * Author:
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arq.h"
+#include "snw.h"
+
+#define SERVICE_PORT "0"  /* any available port number */
+/*#define SERVICE_PORT "48665"*/
+
+/* drop a client after this many rounds of MAX_RESEND without a word */
+#define MAX_GIVEUP 8
+
+int quit = 0;
+void int_handler() {
+	quit = 1;
+}
+
+/*
+ * A mapped file that is truncated while it is sent has no pages past
+ * its new end.  Reading one raises SIGBUS and sending one fails with
+ * EFAULT.  The page that was read is replaced with one of zeros
+ * instead, and the transfer finds out with map_shrunk().
+ *
+ * Only the files this thread has mapped to send are patched, they
+ * are kept in 'mapped' by map_file() and unmap_file().  The fault
+ * comes from a read of one of them, never while the list changes.
+ */
+struct mapping {
+	char *addr;
+	size_t len;
+};
+
+static __thread struct mapping *mapped;
+static __thread int nmapped;
+static __thread int mapped_cap;
+
+size_t page_sz;
+void bus_handler(int sig, siginfo_t *si, void *ctx) {
+	char *addr = si->si_addr;
+	char *page = (char *) ((uintptr_t) addr & ~(page_sz - 1));
+	int i;
+
+	(void) sig;
+	(void) ctx;
+
+	for (i = 0; BUS_ADRERR == si->si_code && i < nmapped; i++) {
+		if (addr >= mapped[i].addr
+				&& addr < mapped[i].addr + mapped[i].len)
+			break;
+	}
+
+	/*
+	 * Anything else is a real fault, it kills as it would have.
+	 * mmap() is not on the async-signal-safe list, but all it does
+	 * here is the system call, over a page of this thread's own file.
+	 */
+	if (BUS_ADRERR != si->si_code || i == nmapped
+			|| MAP_FAILED == mmap(page, page_sz, PROT_READ,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+				-1, 0))
+		signal(SIGBUS, SIG_DFL);
+}
+
+int window = 1;
+int mode = ARQ_SR;
+int batch = 1;
+int stats = 0;
+const struct arq_cc *cc = NULL;
+FILE *trace = NULL;
+FILE *evtrace = NULL;
+double pacing = 0;
+int fec_k = 0;
+int fec_m = 0;
+int mss = DATA_SZ;
+int offload = 0;
+int crc = 0;
+int events = 0;
+int jobs = 1;
+
+void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-e] [-s] [-g] [-u|-U] [-k] [-w window]"
+			" [-m sr|gbn] [-b batch] [-c reno|cubic] [-C trace] [-E events]"
+			" [-p mbps|cwnd] [-f k[,m]] [-M mss] [-j jobs]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/* show the system calls per MB and the losses of a finished session */
+void print_stats(struct arq_session *sess) {
+	struct arq_stats st;
+	double mb;
+
+	if (!stats)
+		return;
+
+	arq_session_stats(sess, &st);
+	mb = (st.bytes_sent + st.bytes_recv) / (1024.0 * 1024.0);
+	fprintf(stderr, "%llu bytes, %lu syscalls, %.1f per MB,"
+			" %lu parity, %lu damaged\n",
+			st.bytes_sent + st.bytes_recv, st.syscalls,
+			(mb > 0) ? st.syscalls / mb : 0, st.fec_sent,
+			st.crc_errors);
+	fprintf(stderr, "%lu resent (%llu bytes), %lu timeouts, %lu fast,"
+			" %lu dupACKs, %lu gave up, RTT %.2f/%.2f/%.2f ms\n",
+			st.packets_resent, st.bytes_resent, st.timeouts,
+			st.fast_resends, st.dupacks, st.give_ups,
+			st.rtt_min_ms, st.rtt_avg_ms, st.rtt_max_ms);
+}
+
+/* as much of 'len' as fills whole packets, so none is sent short */
+size_t whole(struct arq_session *sess, size_t len) {
+	return len / arq_session_mss(sess) * arq_session_mss(sess);
+}
+
+/*
+ * send_eof()
+ *
+ * Send the EOF, again after each round of resends without an answer
+ * until '*giveups' is more than MAX_GIVEUP.
+ *
+ * Returns: 0, or -1 with errno EFAULT if a packet still to be ACKed
+ * was of a mapped file that has been truncated.
+ */
+int send_eof(struct arq_session *sess, int *giveups) {
+	int n;
+
+	while (!quit && *giveups <= MAX_GIVEUP) {
+		errno = 0;
+		n = arq_session_send(sess, NULL, 0, 0);
+		if (-1 == n && EFAULT == errno)
+			return -1;
+		if (-1 == n) {
+			perror("arq_session_send, EOF");
+			exit(EXIT_FAILURE);
+		}
+		if (ETIMEDOUT != errno)
+			break;
+		++*giveups;
+	}
+
+	return 0;
+}
+
+/* is the file open as 'fd' shorter now than its mapping of 'len'? */
+int map_shrunk(int fd, size_t len) {
+	struct stat st;
+
+	return -1 == fstat(fd, &st) || (size_t) st.st_size < len;
+}
+
+/*
+ * map_file()
+ *
+ * Map all of an open file so it can be sent without copying it,
+ * until unmap_file().
+ *
+ * Returns: the mapping of '*len' bytes, or NULL if the file is
+ * empty or can not be mapped, then it must be read instead.
+ */
+char *map_file(int fd, size_t *len) {
+	struct mapping *maps;
+	struct stat st;
+	void *map;
+	int cap;
+
+	if (-1 == fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == st.st_size)
+		return NULL;
+
+	/* room to keep it, for the SIGBUS handler */
+	if (nmapped == mapped_cap) {
+		cap = mapped_cap ? 2 * mapped_cap : 16;
+		maps = realloc(mapped, cap * sizeof(*maps));
+		if (NULL == maps)
+			return NULL;
+		mapped = maps;
+		mapped_cap = cap;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map)
+		return NULL;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	mapped[nmapped].addr = map;
+	mapped[nmapped++].len = st.st_size;
+
+	*len = st.st_size;
+	return map;
+}
+
+/* unmap a file of map_file() */
+void unmap_file(char *map, size_t len) {
+	int i;
+
+	for (i = 0; i < nmapped; i++) {
+		if (mapped[i].addr == map) {
+			mapped[i] = mapped[--nmapped];
+			break;
+		}
+	}
+	munmap(map, len);
+}
+
+/*
+ * resume()
+ *
+ * Find where to start sending the file open as 'fd' for the request
+ * 'req' of 'n' bytes (with a '\0' after it), and how much of it, and
+ * write the reply that comes before the data to 'hdr' (of MAXDATA),
+ * with the number of workers for a range.
+ *
+ * Returns: the length of the reply, 0 if there is none.
+ */
+int resume(const char *req, size_t n, int fd, off_t *off, size_t *rest,
+		char *hdr) {
+	long long offset, size, mtime, end;
+	struct stat st;
+	size_t len = strlen(req) + 1;
+	int k;
+
+	*off = 0;
+	*rest = SIZE_MAX;	/* up to the EOF */
+	k = (len < n) ? sscanf(req + len, SNW_RANGE,
+			&offset, &size, &mtime, &end) : 0;
+	if (k < 3 || -1 == fstat(fd, &st))
+		return 0;
+
+	/* only the rest of the same file */
+	if (size == st.st_size && mtime == st.st_mtime
+			&& offset > 0 && offset <= size)
+		*off = offset;
+
+	/* a range of it */
+	if (4 == k && end >= *off && end < st.st_size)
+		*rest = end - *off;
+
+	if (4 == k)
+		return snprintf(hdr, MAXDATA, SNW_WORKERS, (long long) *off,
+				(long long) st.st_size,
+				(long long) st.st_mtime, jobs);
+
+	return snprintf(hdr, MAXDATA, SNW_RESUME, (long long) *off,
+			(long long) st.st_size, (long long) st.st_mtime);
+}
+
+/*
+ * Manifests (see snw.h)
+ *
+ * The names of a manifest are looked up as they arrive, directories
+ * walked in order, and the files are then sent as one stream.  The
+ * headers and the data of small files are gathered in 'stage' and
+ * sent a whole packet at a time, so a packet carries as many small
+ * files as fit.  The body of a large file is sent in place from a
+ * mapping, once the stage has been filled up to a packet with the
+ * start of it, and its tail is staged again.  The mappings are kept
+ * until the transfer is over, the packets refer to them until then.
+ */
+
+/* files at least this large are mapped */
+#define MAP_MIN (256 * 1024)
+
+/* holds more than a packet and a header */
+#define STAGE_SZ (4 * ARQ_MAX_MSS)
+
+struct manifest {
+	char *req;		/* the request so far */
+	size_t req_len;
+	size_t req_off;		/* where the next name starts */
+
+	char **paths;		/* the files, 'next' is sent next */
+	int npaths;
+	int cap;
+	int next;
+
+	int fd;			/* the file being sent, or -1 */
+	char *map;		/* of it, if it is mapped */
+	size_t size;
+	size_t pos;		/* of it staged or sent */
+	int bad;		/* could not be read, zeros are sent */
+
+	struct mapping *maps;	/* until the end */
+	int nmaps;
+
+	char stage[STAGE_SZ];
+	size_t stage_len;
+	size_t stage_off;	/* already sent */
+	int from_map;		/* the last chunk was of 'map' */
+};
+
+struct manifest *manifest_new() {
+	struct manifest *m;
+
+	m = calloc(1, sizeof(*m));
+	if (m)
+		m->fd = -1;
+
+	return m;
+}
+
+void manifest_free(struct manifest *m) {
+	int i;
+
+	if (NULL == m)
+		return;
+
+	if (m->fd != -1)
+		close(m->fd);
+	for (i = 0; i < m->nmaps; i++)
+		unmap_file(m->maps[i].addr, m->maps[i].len);
+	for (i = 0; i < m->npaths; i++)
+		free(m->paths[i]);
+	free(m->maps);
+	free(m->paths);
+	free(m->req);
+	free(m);
+}
+
+/* add a file to be sent, 'path' is taken over */
+static int path_add(struct manifest *m, char *path) {
+	char **p;
+
+	if (m->npaths == m->cap) {
+		m->cap = m->cap ? 2 * m->cap : 64;
+		p = realloc(m->paths, m->cap * sizeof(*p));
+		if (NULL == p) {
+			free(path);
+			return -1;
+		}
+		m->paths = p;
+	}
+	m->paths[m->npaths++] = path;
+
+	return 0;
+}
+
+/*
+ * manifest_add()
+ *
+ * Add the file 'path', or every file under it if it is a directory.
+ * Symbolic links are only followed to files, or if they were named,
+ * so a walk can not go around in circles.  Anything that can not be
+ * read is still added, to be reported as missing.
+ *
+ * Returns: 0, or -1 on error (ENOMEM).
+ */
+int manifest_add(struct manifest *m, const char *path, int named) {
+	struct dirent **list;
+	struct stat st;
+	char *child;
+	int i, n, r = 0;
+
+	if (-1 == (named ? stat(path, &st) : lstat(path, &st)))
+		st.st_mode = 0;
+	if (S_ISLNK(st.st_mode) && (-1 == stat(path, &st)
+				|| S_ISDIR(st.st_mode)))
+		return 0;
+
+	n = (S_ISDIR(st.st_mode)) ? scandir(path, &list, NULL, alphasort)
+		: -1;
+	if (-1 == n) {
+		child = strdup(path);
+		return (child) ? path_add(m, child) : -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (0 == r && strcmp(list[i]->d_name, ".")
+				&& strcmp(list[i]->d_name, "..")) {
+			if (-1 == asprintf(&child, "%s%s%s", path,
+					('/' == path[strlen(path) - 1])
+					? "" : "/", list[i]->d_name)) {
+				r = -1;
+			} else {
+				r = manifest_add(m, child, 0);
+				free(child);
+			}
+		}
+		free(list[i]);
+	}
+	free(list);
+
+	return r;
+}
+
+/*
+ * manifest_request()
+ *
+ * Take the next 'n' bytes of the request, starting with the empty
+ * name, and add each name in it that is complete.
+ *
+ * Returns: 1 once the request is complete, 0 if there is more to
+ * come, -1 on error (EMSGSIZE or ENOMEM).
+ */
+int manifest_request(struct manifest *m, const char *buf, size_t n) {
+	char *req, *name;
+	size_t len;
+
+	if (m->req_len + n > MANIFEST_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	req = realloc(m->req, m->req_len + n);
+	if (NULL == req)
+		return -1;
+	memcpy(req + m->req_len, buf, n);
+	m->req = req;
+	m->req_len += n;
+
+	if (0 == m->req_off)
+		m->req_off = 1;	/* the empty name first */
+	while (m->req_off < m->req_len) {
+		name = m->req + m->req_off;
+		len = strnlen(name, m->req_len - m->req_off);
+		if (len == m->req_len - m->req_off)
+			return 0;
+		m->req_off += len + 1;
+		if (0 == len)
+			return 1;
+		if (-1 == manifest_add(m, name, 1))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* done with the file being sent, a mapping stays until the end */
+static void file_done(struct manifest *m) {
+	/* its size has been sent, the pages that are gone read as zeros */
+	if (m->map && map_shrunk(m->fd, m->size))
+		fprintf(stderr, "%s: shorter than it was\n",
+				m->paths[m->next - 1]);
+	close(m->fd);
+	m->fd = -1;
+	m->map = NULL;
+}
+
+/*
+ * file_open()
+ *
+ * Open the next file and stage its header, one with a size of -1
+ * if it can not be sent.
+ *
+ * Returns: 0, or -1 on error (ENOMEM).
+ */
+static int file_open(struct manifest *m) {
+	const char *path = m->paths[m->next++];
+	struct mapping *maps;
+	struct stat st;
+	size_t room = sizeof(m->stage) - m->stage_len;
+	size_t len;
+	int n;
+
+	m->fd = open(path, O_RDONLY);
+	if (m->fd != -1 && (-1 == fstat(m->fd, &st)
+				|| !S_ISREG(st.st_mode))) {
+		close(m->fd);
+		m->fd = -1;
+	}
+	if (-1 == m->fd) {
+		n = snprintf(m->stage + m->stage_len, room, SNW_ENTRY "%s",
+				-1LL, 0LL, 0, path);
+		if (n >= 0 && (size_t) n < room)
+			m->stage_len += n + 1;
+		return 0;
+	}
+
+	n = snprintf(m->stage + m->stage_len, room, SNW_ENTRY "%s",
+			(long long) st.st_size, (long long) st.st_mtime,
+			(unsigned int) (st.st_mode & 07777), path);
+	if (n < 0 || (size_t) n >= room) {
+		close(m->fd);
+		m->fd = -1;
+		return 0;	/* a path that long can not be opened anyway */
+	}
+	m->stage_len += n + 1;
+
+	m->size = st.st_size;
+	m->pos = 0;
+	m->bad = 0;
+	if (0 == m->size) {
+		file_done(m);
+		return 0;
+	}
+
+	if (m->size >= MAP_MIN) {
+		maps = realloc(m->maps, (m->nmaps + 1) * sizeof(*maps));
+		if (NULL == maps)
+			return -1;
+		m->maps = maps;
+		m->map = map_file(m->fd, &len);
+		if (m->map && len != m->size) {
+			unmap_file(m->map, len);
+			m->map = NULL;
+		}
+		if (m->map) {
+			m->maps[m->nmaps].addr = m->map;
+			m->maps[m->nmaps++].len = len;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * manifest_next()
+ *
+ * Find what to send next of the stream, '*len' bytes at '*buf'.
+ * Only whole packets are sent until the end.  It is the same until
+ * manifest_sent() says how much of it was sent.
+ *
+ * Returns: 1 if there is more to send, 0 once there is not, -1 on
+ * error.
+ */
+int manifest_next(struct manifest *m, struct arq_session *sess,
+		const char **buf, size_t *len) {
+	size_t mss = arq_session_mss(sess);
+	size_t want;
+	ssize_t n;
+
+	for (;;) {
+		if (m->stage_len - m->stage_off >= mss) {
+			*buf = m->stage + m->stage_off;
+			*len = whole(sess, m->stage_len - m->stage_off);
+			m->from_map = 0;
+			return 1;
+		}
+
+		/* the body of a large file, once the stage is empty */
+		if (m->map && m->stage_off == m->stage_len
+				&& m->size - m->pos >= mss) {
+			*buf = m->map + m->pos;
+			*len = whole(sess, m->size - m->pos);
+			m->from_map = 1;
+			return 1;
+		}
+
+		/* less than a packet is left, it goes to the front */
+		memmove(m->stage, m->stage + m->stage_off,
+				m->stage_len - m->stage_off);
+		m->stage_len -= m->stage_off;
+		m->stage_off = 0;
+
+		if (-1 == m->fd) {
+			if (m->next < m->npaths) {
+				if (-1 == file_open(m))
+					return -1;
+				continue;
+			}
+
+			/* the last packet may be short */
+			*buf = m->stage;
+			*len = m->stage_len;
+			m->from_map = 0;
+			return (m->stage_len > 0);
+		}
+
+		/* up to a packet of a mapped file, to line up its body */
+		want = MIN(m->size - m->pos, sizeof(m->stage) - m->stage_len);
+		if (m->map) {
+			want = MIN(want, mss - m->stage_len);
+			memcpy(m->stage + m->stage_len, m->map + m->pos, want);
+			n = want;
+		} else {
+			n = m->bad ? 0 : read(m->fd, m->stage + m->stage_len,
+					want);
+			if (n <= 0) {
+				/* the size has been sent, it must be kept */
+				if (!m->bad)
+					fprintf(stderr, "%s: %s\n",
+						m->paths[m->next - 1],
+						n ? strerror(errno)
+						: "shorter than it was");
+				m->bad = 1;
+				memset(m->stage + m->stage_len, 0, want);
+				n = want;
+			}
+		}
+		m->stage_len += n;
+		m->pos += n;
+		if (m->pos == m->size)
+			file_done(m);
+	}
+}
+
+/* 'n' bytes of what manifest_next() found were sent */
+void manifest_sent(struct manifest *m, size_t n) {
+	if (!m->from_map) {
+		m->stage_off += n;
+		return;
+	}
+
+	m->pos += n;
+	if (m->pos == m->size)
+		file_done(m);
+}
+
+/*
+ * send_manifest()
+ *
+ * Read the rest of the manifest request that started with 'req' and
+ * send its files, then the EOF.  A client that is gone is given up
+ * on.
+ */
+void send_manifest(struct arq_session *sess, struct manifest *m,
+		const char *req, int n) {
+	char rbuf[ARQ_MAX_MSS];
+	const char *buf;
+	size_t len;
+	int giveups = 0;
+	int r;
+
+	r = manifest_request(m, req, n);
+	while (0 == r && !quit) {
+		n = arq_session_recv(sess, rbuf, sizeof(rbuf), 0);
+		if (-1 == n && EINTR == errno)
+			return;
+		if (0 == n)
+			errno = EPROTO;	/* the EOF in the middle of it */
+		r = (n > 0) ? manifest_request(m, rbuf, n) : -1;
+	}
+	if (-1 == r) {
+		perror("manifest");
+		return;
+	}
+
+	while (!quit && giveups <= MAX_GIVEUP
+			&& 1 == (r = manifest_next(m, sess, &buf, &len))) {
+		if (m->from_map)
+			n = arq_session_send_ref(sess, buf, len, 0);
+		else
+			n = arq_session_send(sess, buf, len, 0);
+		if (-1 == n && EFAULT == errno)
+			break;
+		if (-1 == n) {
+			perror("arq_session_send");
+			exit(EXIT_FAILURE);
+		}
+		giveups = n ? 0 : giveups + 1;
+		manifest_sent(m, n);
+	}
+	if (-1 == r) {
+		perror("manifest");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((-1 == n && EFAULT == errno) || -1 == send_eof(sess, &giveups))
+		fprintf(stderr, "manifest: a file was truncated while it"
+				" was sent\n");
+}
+
+/*
+ * serve()
+ *
+ * Serve one client at a time, blocking until each
+ * transfer is complete.
+ */
+void serve(int sockfd) {
+
+	int n;
+
+	char sbuf[ARQ_MAX_MSS];
+	char rbuf[MAXDATA];
+
+	char *infile;
+	int infd;
+	char *map;
+	size_t map_len;
+	char hdr[MAXDATA];
+	int hdr_len;
+	off_t off;
+	size_t rest;
+	int giveups;
+	int cut;
+
+	size_t left;
+	size_t i;
+
+	struct arq_session *sess;
+	struct manifest *m;
+
+	while (!quit) {
+
+		/*
+		 * Each client gets a new session which belongs
+		 * to the first client that sends it a file name.
+		 */
+
+		sess = arq_session_new(sockfd, NULL, 0);
+		if (NULL == sess) {
+			perror("arq_session_new");
+			exit(EXIT_FAILURE);
+		}
+		if (-1 == arq_session_set_window(sess, window)
+				|| -1 == arq_session_set_mode(sess, mode)
+				|| -1 == arq_session_set_batch(sess, batch)
+				|| -1 == arq_session_set_mss(sess, mss, 1)
+				|| -1 == arq_session_set_offload(sess, offload)
+				|| -1 == arq_session_set_crc(sess, crc)
+				|| -1 == arq_session_set_fec(sess, fec_k, fec_m)) {
+			perror("arq_session");
+			exit(EXIT_FAILURE);
+		}
+		arq_session_set_cc(sess, cc);
+		arq_session_set_trace(sess, trace);
+		arq_session_set_events(sess, evtrace);
+		arq_session_set_pacing(sess, pacing);
+
+		/* Read the file name from the client. */
+
+		n = arq_session_recv(sess, rbuf, MAXDATA - 1, 0);
+		if (-1 == n) {
+			if (errno == EINTR) {
+				exit(EXIT_SUCCESS);
+			} else {
+				perror("arq_session_recv");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		/* A manifest of files instead of one (see snw.h) */
+
+		if (n > 0 && '\0' == rbuf[0]) {
+			m = manifest_new();
+			if (NULL == m) {
+				perror("manifest_new");
+				exit(EXIT_FAILURE);
+			}
+			send_manifest(sess, m, rbuf, n);
+			print_stats(sess);
+			arq_session_free(sess);
+			manifest_free(m);
+			continue;
+		}
+
+		/* Read the data file and send it to the client */
+
+		rbuf[n] = '\0';
+		infile = rbuf;
+		infd = open(infile, O_RDONLY);
+		if (-1 == infd) {
+			arq_session_send(sess, "HTTP/1.0 404 Not Found\r\n",
+					24, 0);
+			arq_session_send(sess, NULL, 0, 0);
+			print_stats(sess);
+			arq_session_free(sess);
+			continue;
+		}
+
+		/*
+		 * From where a previous transfer stopped.  A client that
+		 * is gone is given up on, it can resume later.
+		 */
+		giveups = 0;
+		hdr_len = resume(rbuf, n, infd, &off, &rest, hdr);
+		do {
+			n = hdr_len ? arq_session_send(sess, hdr, hdr_len, 0)
+				: 1;
+			if (-1 == n) {
+				perror("arq_session_send");
+				exit(EXIT_FAILURE);
+			}
+		} while (0 == n && !quit && ++giveups <= MAX_GIVEUP);
+		if (-1 == lseek(infd, off, SEEK_SET)) {
+			perror("lseek");
+			exit(EXIT_FAILURE);
+		}
+
+		/* a mapped file is sent in place, until the EOF is ACKed */
+		map = map_file(infd, &map_len);
+		if (map)
+			rest = MIN(rest, map_len - off);
+		cut = 0;
+		for (i = off; map && i < off + rest && !quit
+				&& giveups <= MAX_GIVEUP; i += n) {
+			n = arq_session_send_ref(sess, map + i, off + rest - i,
+					0);
+			if (-1 == n && EFAULT == errno) {
+				cut = 1;
+				break;
+			}
+			if (-1 == n) {
+				perror("arq_session_send_ref");
+				exit(EXIT_FAILURE);
+			}
+			giveups = n ? 0 : giveups + 1;
+		}
+
+		while (!map && rest && giveups <= MAX_GIVEUP
+				&& (n = read(infd, &sbuf, MIN(rest,
+						whole(sess, sizeof(sbuf)))))) {
+			if (quit)
+				break;
+
+			if (-1 == n) {
+				perror("read");
+				exit(EXIT_FAILURE);
+			}
+			rest -= n;
+
+			left = n;
+			i = 0;
+			while (left && giveups <= MAX_GIVEUP) {
+				n = arq_session_send(sess, sbuf + i, left, 0);
+				if (-1 == n) {
+					perror("arq_session_send");
+					exit(EXIT_FAILURE);
+				}
+				giveups = n ? 0 : giveups + 1;
+				left -= n;
+				i += n;
+			}
+		}
+
+		/*
+		 * Send a zero length packet to signal EOF, but not for a
+		 * file that was truncated, the client starts it over.
+		 */
+
+		if (map && !cut && map_shrunk(infd, map_len))
+			cut = 1;
+		if (!cut && -1 == send_eof(sess, &giveups))
+			cut = 1;
+		if (cut)
+			fprintf(stderr, "%s: truncated while it was sent\n",
+					infile);
+		close(infd);
+
+		print_stats(sess);
+		arq_session_free(sess);
+		if (map)
+			unmap_file(map, map_len);
+	}
+}
+
+/*
+ * Event driven server (-e)
+ *
+ * Every client has a transfer, found by its address in a hash
+ * table, which steps from reading the request, to sending the
+ * data and the EOF, to waiting for the last ACKs.  Nothing ever
+ * blocks, a transfer simply stops when its window is full and
+ * continues when ACKs arrive.
  *
- *   Jeremiah Mahler <jmmahler@gmail.com>
+ * The retransmit deadlines of all the transfers are kept in one
+ * heap and a single timerfd is armed for the earliest one.  Each
+ * worker (-j) has a table and heap of its own.
+ */
+
+#define HASH_SZ 1024
+
+enum {
+	T_REQUEST,	/* waiting for the file name */
+	T_MANIFEST,	/* waiting for the rest of a manifest */
+	T_HEADER,	/* sending where the data starts */
+	T_DATA,		/* sending the file */
+	T_FILES,	/* sending the files of the manifest */
+	T_EOF,		/* waiting to send the EOF */
+	T_CLOSE		/* waiting for everything to be ACKed */
+};
+
+struct transfer {
+	struct arq_session *sess;
+	struct sockaddr_in addr;
+	int state;
+
+	int infd;
+	char *map;		/* the file, or NULL if it is read */
+	size_t map_len;
+	char buf[ARQ_MAX_MSS];
+	size_t off;
+	size_t len;		/* data in 'map' or 'buf' not yet sent */
+	size_t rest;		/* of the file, not yet read */
+	char hdr[MAXDATA];	/* the reply before the data */
+	int hdr_len;
+	struct manifest *man;	/* of a manifest, or NULL */
+
+	int giveups;
+	struct timespec deadline;
+	int heap_idx;		/* -1 when no timer is running */
+
+	struct transfer *next;	/* hash chain */
+};
+
+static __thread struct transfer *table[HASH_SZ];
+
+static __thread struct transfer **heap;
+static __thread int heap_len;
+static __thread int heap_cap;
+
+static unsigned int addr_hash(const struct sockaddr_in *addr) {
+	return (addr->sin_addr.s_addr * 2654435761u
+			^ addr->sin_port) % HASH_SZ;
+}
+
+static struct transfer *transfer_find(const struct sockaddr_in *addr) {
+	struct transfer *t;
+
+	for (t = table[addr_hash(addr)]; t != NULL; t = t->next) {
+		if (t->addr.sin_addr.s_addr == addr->sin_addr.s_addr
+				&& t->addr.sin_port == addr->sin_port)
+			return t;
+	}
+
+	return NULL;
+}
+
+static int ts_before(const struct timespec *a, const struct timespec *b) {
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+}
+
+static void heap_set(int i, struct transfer *t) {
+	heap[i] = t;
+	t->heap_idx = i;
+}
+
+static void heap_up(int i) {
+	struct transfer *t = heap[i];
+
+	while (i > 0 && ts_before(&t->deadline,
+				&heap[(i - 1) / 2]->deadline)) {
+		heap_set(i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(i, t);
+}
+
+static void heap_down(int i) {
+	struct transfer *t = heap[i];
+	int c;
+
+	while ((c = 2 * i + 1) < heap_len) {
+		if (c + 1 < heap_len && ts_before(&heap[c + 1]->deadline,
+					&heap[c]->deadline))
+			c++;
+		if (!ts_before(&heap[c]->deadline, &t->deadline))
+			break;
+		heap_set(i, heap[c]);
+		i = c;
+	}
+	heap_set(i, t);
+}
+
+static void heap_remove(struct transfer *t) {
+	struct transfer *last;
+	int i = t->heap_idx;
+
+	if (-1 == i)
+		return;
+
+	t->heap_idx = -1;
+	last = heap[--heap_len];
+	if (last == t)
+		return;
+
+	heap_set(i, last);
+	heap_up(i);
+	heap_down(last->heap_idx);
+}
+
+/* move the transfer to its new deadline, if it has one */
+static void heap_update(struct transfer *t) {
+	struct transfer **h;
+
+	if (!arq_session_deadline(t->sess, &t->deadline)) {
+		heap_remove(t);
+		return;
+	}
+
+	if (-1 == t->heap_idx) {
+		if (heap_len == heap_cap) {
+			heap_cap = heap_cap ? 2 * heap_cap : 64;
+			h = realloc(heap, heap_cap * sizeof(*heap));
+			if (NULL == h) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+			heap = h;
+		}
+		heap_set(heap_len++, t);
+	}
+
+	heap_up(t->heap_idx);
+	heap_down(t->heap_idx);
+}
+
+static struct transfer *transfer_new(int sockfd,
+		const struct sockaddr_in *addr) {
+	struct transfer *t;
+	unsigned int h;
+
+	t = calloc(1, sizeof(*t));
+	if (NULL == t)
+		return NULL;
+
+	t->sess = arq_session_new(sockfd, (struct sockaddr *) addr,
+			sizeof(*addr));
+	if (NULL == t->sess
+			|| -1 == arq_session_set_window(t->sess, window)
+			|| -1 == arq_session_set_mode(t->sess, mode)
+			|| -1 == arq_session_set_batch(t->sess, batch)
+			|| -1 == arq_session_set_mss(t->sess, mss, 1)
+			|| -1 == arq_session_set_offload(t->sess, offload)
+			|| -1 == arq_session_set_crc(t->sess, crc)
+			|| -1 == arq_session_set_fec(t->sess, fec_k, fec_m)) {
+		arq_session_free(t->sess);
+		free(t);
+		return NULL;
+	}
+	arq_session_set_cc(t->sess, cc);
+	arq_session_set_trace(t->sess, trace);
+	arq_session_set_events(t->sess, evtrace);
+	arq_session_set_pacing(t->sess, pacing);
+
+	t->addr = *addr;
+	t->state = T_REQUEST;
+	t->infd = -1;
+	t->heap_idx = -1;
+
+	h = addr_hash(addr);
+	t->next = table[h];
+	table[h] = t;
+
+	return t;
+}
+
+static void transfer_free(struct transfer *t) {
+	struct transfer **pp;
+
+	for (pp = &table[addr_hash(&t->addr)]; *pp != t; pp = &(*pp)->next)
+		;
+	*pp = t->next;
+
+	heap_remove(t);
+
+	if (t->infd != -1)
+		close(t->infd);
+	print_stats(t->sess);
+	arq_session_free(t->sess);
+	if (t->map)
+		unmap_file(t->map, t->map_len);
+	manifest_free(t->man);
+	free(t);
+}
+
+/*
+ * transfer_pump()
  *
- * Copyright:
+ * Move the transfer along as far as it can go without blocking.
  *
- * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
- * This project is free software and released under
- * the GNU General Public License.
+ * Returns: 0 if it is waiting on the network, 1 once it is
+ * complete, -1 on error.
+ */
+static int transfer_pump(struct transfer *t) {
+	const char *buf;
+	size_t len;
+	off_t off;
+	int n;
+
+	for (;;) {
+		switch (t->state) {
+		case T_REQUEST:
+			n = arq_session_recv(t->sess, t->buf, MAXDATA - 1,
+					MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			t->buf[n] = '\0';
+
+			if (n > 0 && '\0' == t->buf[0]) {
+				t->man = manifest_new();
+				if (NULL == t->man)
+					return -1;
+				n = manifest_request(t->man, t->buf, n);
+				if (-1 == n)
+					return -1;
+				t->state = n ? T_FILES : T_MANIFEST;
+				break;
+			}
+
+			t->off = 0;
+			t->infd = open(t->buf, O_RDONLY);
+			if (-1 == t->infd) {
+				memcpy(t->buf, "HTTP/1.0 404 Not Found\r\n", 24);
+				t->len = 24;
+				t->state = T_DATA;
+				break;
+			}
+
+			t->hdr_len = resume(t->buf, n, t->infd, &off,
+					&t->rest, t->hdr);
+			if (-1 == lseek(t->infd, off, SEEK_SET))
+				return -1;
+			t->map = map_file(t->infd, &t->map_len);
+			if (t->map) {
+				t->off = off;
+				t->len = MIN(t->rest, t->map_len - off);
+			}
+			t->state = t->hdr_len ? T_HEADER : T_DATA;
+			break;
+
+		case T_MANIFEST:
+			n = arq_session_recv(t->sess, t->buf, sizeof(t->buf),
+					MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			if (0 == n) {
+				errno = EPROTO;
+				return -1;
+			}
+			n = manifest_request(t->man, t->buf, n);
+			if (-1 == n)
+				return -1;
+			if (n)
+				t->state = T_FILES;
+			break;
+
+		case T_HEADER:
+			n = arq_session_send(t->sess, t->hdr, t->hdr_len,
+					MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			t->state = T_DATA;
+			break;
+
+		case T_DATA:
+			if (0 == t->len) {
+				n = (-1 == t->infd || t->map || 0 == t->rest) ? 0
+					: read(t->infd, t->buf, MIN(t->rest,
+						whole(t->sess, sizeof(t->buf))));
+				if (-1 == n)
+					return -1;
+				if (0 == n) {
+					t->state = T_EOF;
+					break;
+				}
+				t->off = 0;
+				t->len = n;
+				t->rest -= n;
+			}
+
+			if (t->map)
+				n = arq_session_send_ref(t->sess,
+						t->map + t->off, t->len,
+						MSG_DONTWAIT);
+			else
+				n = arq_session_send(t->sess, t->buf + t->off,
+						t->len, MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			t->off += n;
+			t->len -= n;
+			break;
+
+		case T_FILES:
+			n = manifest_next(t->man, t->sess, &buf, &len);
+			if (-1 == n)
+				return -1;
+			if (0 == n) {
+				t->state = T_EOF;
+				break;
+			}
+
+			if (t->man->from_map)
+				n = arq_session_send_ref(t->sess, buf, len,
+						MSG_DONTWAIT);
+			else
+				n = arq_session_send(t->sess, buf, len,
+						MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			manifest_sent(t->man, n);
+			break;
+
+		case T_EOF:
+			/* not for a file that was truncated under it */
+			if (t->map && map_shrunk(t->infd, t->map_len)) {
+				errno = EFAULT;
+				return -1;
+			}
+			n = arq_session_send(t->sess, NULL, 0, MSG_DONTWAIT);
+			if (-1 == n)
+				return (EAGAIN == errno) ? 0 : -1;
+			t->state = T_CLOSE;
+			break;
+
+		case T_CLOSE:
+			if (-1 == arq_session_flush(t->sess))
+				return -1;
+			return (0 == arq_session_pending(t->sess));
+		}
+	}
+}
+
+/* pump the transfer and then either free it or update its timer */
+static void transfer_step(struct transfer *t) {
+	int n;
+
+	n = transfer_pump(t);
+	if (-1 == n)
+		perror("transfer");
+
+	if (n != 0)
+		transfer_free(t);
+	else
+		heap_update(t);
+}
+
+/*
+ * serve_events()
  *
+ * Serve every client at the same time from one socket.
  */
+void serve_events(int sockfd) {
 
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
+	int n;
+	int epfd, tfd;
+	struct epoll_event ev;
+	struct itimerspec its;
+	struct timespec now;
+	uint64_t expirations;
 
-#include "arq.h"
+	struct arq_packet pkts[ARQ_MAX_BATCH];
+	struct sockaddr_in addrs[ARQ_MAX_BATCH];
+	struct mmsghdr msgs[ARQ_MAX_BATCH];
+	struct iovec iov[ARQ_MAX_BATCH];
+	struct arq_packet *pkt;
+	struct sockaddr_in *cliaddr;
+	struct transfer *t;
+	int i, k;
 
-#define SERVICE_PORT "0"  /* any available port number */
-/*#define SERVICE_PORT "48665"*/
+	epfd = epoll_create1(0);
+	if (-1 == epfd) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
 
-int quit = 0;
-void int_handler() {
-	quit = 1;
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (-1 == tfd) {
+		perror("timerfd_create");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = sockfd;
+	if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev)) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	ev.data.fd = tfd;
+	if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev)) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+
+	while (!quit) {
+		n = epoll_wait(epfd, &ev, 1, -1);
+		if (-1 == n) {
+			if (EINTR == errno)
+				continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		/*
+		 * Hand every datagram to the transfer of its client,
+		 * reading up to a batch of them at a time.
+		 */
+
+		do {
+			memset(msgs, 0, batch * sizeof(*msgs));
+			for (i = 0; i < batch; i++) {
+				iov[i].iov_base = &pkts[i];
+				iov[i].iov_len = sizeof(pkts[i]);
+				msgs[i].msg_hdr.msg_name = &addrs[i];
+				msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+				msgs[i].msg_hdr.msg_iov = &iov[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			k = recvmmsg(sockfd, msgs, batch, MSG_DONTWAIT, NULL);
+			if (-1 == k) {
+				if (EAGAIN == errno || EWOULDBLOCK == errno)
+					break;
+				perror("recvmmsg");
+				exit(EXIT_FAILURE);
+			}
+
+			for (i = 0; i < k; i++) {
+				pkt = &pkts[i];
+				cliaddr = &addrs[i];
+				n = msgs[i].msg_len;
+
+				t = transfer_find(cliaddr);
+				if (NULL == t) {
+					/* only data (a request) starts a transfer */
+					if (n < HEADER_SZ || pkt->type != TYPE_DATA)
+						continue;
+
+					t = transfer_new(sockfd, cliaddr);
+					if (NULL == t) {
+						perror("transfer_new");
+						continue;
+					}
+				}
+
+				t->giveups = 0;
+				if (-1 == arq_session_input(t->sess, pkt, n,
+						(struct sockaddr *) cliaddr,
+						msgs[i].msg_hdr.msg_namelen)) {
+					perror("arq_session_input");
+					/* a re-send of a truncated file */
+					if (EFAULT == errno) {
+						transfer_free(t);
+						continue;
+					}
+				}
+
+				n = transfer_pump(t);
+				if (-1 == n)
+					perror("transfer");
+
+				/*
+				 * A request is a single packet (or starts a
+				 * manifest), a new client still without one is
+				 * left over from an old transfer.
+				 */
+				if (n != 0 || T_REQUEST == t->state)
+					transfer_free(t);
+				else
+					heap_update(t);
+			}
+		} while (k == batch);
+
+		/* Re-send for every transfer whose timer has expired. */
+
+		read(tfd, &expirations, sizeof(expirations));
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while (heap_len && !ts_before(&now, &heap[0]->deadline)) {
+			t = heap[0];
+
+			n = arq_session_expire(t->sess);
+			if (-1 == n)
+				perror("arq_session_expire");
+			if (-1 == n && EFAULT == errno) {
+				transfer_free(t);
+				continue;
+			}
+
+			/*
+			 * Nothing has been heard from the client for
+			 * MAX_GIVEUP rounds of resends, it is gone (or
+			 * only the ACK of its EOF was lost).
+			 */
+			if (0 == n && ++t->giveups > MAX_GIVEUP) {
+				transfer_free(t);
+				continue;
+			}
+
+			transfer_step(t);
+		}
+
+		memset(&its, 0, sizeof(its));
+		if (heap_len)
+			its.it_value = heap[0]->deadline;
+		if (-1 == timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+			perror("timerfd_settime");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	close(tfd);
+	close(epfd);
+}
+
+/* a worker, serving the clients of one port */
+void *worker(void *arg) {
+	int sockfd = *(int *) arg;
+
+	if (events)
+		serve_events(sockfd);
+	else
+		serve(sockfd);
+
+	return NULL;
+}
+
+/*
+ * port_open()
+ *
+ * Open another socket for a worker, on the port of 'sin'.
+ *
+ * Returns: the socket, or -1 on error.
+ */
+int port_open(const struct sockaddr_in *sin, int sock_buf) {
+	int sockfd;
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (-1 == sockfd)
+		return -1;
+
+	if ((mss > DATA_SZ && -1 == setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF,
+					&sock_buf, sizeof(sock_buf)))
+			|| -1 == bind(sockfd, (struct sockaddr *) sin,
+				sizeof(*sin))) {
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
 }
 
 int main(int argc, char* argv[]) {
@@ -56,29 +1533,108 @@ int main(int argc, char* argv[]) {
 
 	int n;
 
-	struct sockaddr cliaddr;
-	socklen_t cliaddr_len;
 	struct sockaddr_in sin;
 	socklen_t len;
 
-	char sbuf[MAXDATA];
-	char rbuf[MAXDATA];
-
-	char *infile;
-	int infd;
-
-	size_t left;
-	size_t i;
-
 	int sockfd = 0;
 	struct addrinfo *res = NULL;
 
 	struct sigaction int_act;
+	struct sigaction bus_act;
+	sigset_t mask, old;
 
-	if (argc != 1) {
-		fprintf(stderr, "usage: %s\n", argv[0]);
-		exit(EXIT_FAILURE);
+	int socks[MAX_JOBS];
+	pthread_t tid;
+	int i;
+
+	int opt;
+	int sock_buf = 4 * 1024 * 1024;	/* up to net.core.wmem_max */
+
+	while ((opt = getopt(argc, argv, "w:m:b:c:C:E:p:f:M:j:egksuU")) != -1) {
+		switch (opt) {
+		case 'e':
+			events = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'c':
+			cc = arq_cc_find(optarg);
+			if (NULL == cc)
+				usage(argv[0]);
+			break;
+		case 'C':
+			trace = fopen(optarg, "w");
+			if (NULL == trace) {
+				perror(optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'E':
+			evtrace = fopen(optarg, "wb");
+			if (NULL == evtrace) {
+				perror(optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'p':
+			if (0 == strcmp(optarg, "cwnd"))
+				pacing = ARQ_PACE_CWND;
+			else
+				pacing = atof(optarg) * 1e6 / 8;
+			if (pacing < 0 && ARQ_PACE_CWND != pacing)
+				usage(argv[0]);
+			break;
+		case 'f':
+			fec_k = atoi(optarg);
+			fec_m = 1;
+			if (strchr(optarg, ','))
+				fec_m = atoi(strchr(optarg, ',') + 1);
+			break;
+		case 'M':
+			mss = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'g':
+			offload |= ARQ_GSO | ARQ_GRO;
+			break;
+		case 'u':
+			offload |= ARQ_URING;
+			break;
+		case 'U':
+			offload |= ARQ_URING | ARQ_SQPOLL;
+			break;
+		case 'k':
+			crc = 1;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'm':
+			if (0 == strcmp(optarg, "sr"))
+				mode = ARQ_SR;
+			else if (0 == strcmp(optarg, "gbn"))
+				mode = ARQ_GBN;
+			else
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
 	}
+	if (optind != argc || window < 1 || window > ARQ_MAX_WINDOW
+			|| batch < 1 || batch > ARQ_MAX_BATCH
+			|| fec_k < 0 || fec_k > FEC_MAX_K
+			|| fec_m < 0 || fec_m > FEC_MAX_M
+			|| (fec_k && 0 == fec_m)
+			|| mss < DATA_SZ || mss > ARQ_MAX_MSS
+			|| jobs < 1 || jobs > MAX_JOBS)
+		usage(argv[0]);
 
 	/*
 	 * Setup the interrupt handler to catch
@@ -91,6 +1647,16 @@ int main(int argc, char* argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
+	/* a mapped file that is truncated must not kill the server */
+	page_sz = sysconf(_SC_PAGESIZE);
+	memset(&bus_act, 0, sizeof(bus_act));
+	bus_act.sa_sigaction = bus_handler;
+	bus_act.sa_flags = SA_SIGINFO;
+	if (-1 == sigaction(SIGBUS, &bus_act, 0)) {
+		perror("bus sigaction failed");
+		exit(EXIT_FAILURE);
+	}
+
 	/* Setup the server socket. */
 
 	memset(&hints, 0, sizeof(hints));
@@ -111,6 +1677,14 @@ int main(int argc, char* argv[]) {
 			continue;
 		}
 
+		/* a window of large packets needs more than the default */
+		if (mss > DATA_SZ && -1 == setsockopt(sockfd, SOL_SOCKET,
+					SO_SNDBUF, &sock_buf, sizeof(sock_buf))) {
+			close(sockfd);
+			perror("setsockopt");
+			continue;
+		}
+
 		if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
 			close(sockfd);
 			perror("bind");
@@ -144,74 +1718,43 @@ int main(int argc, char* argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
-	while (!quit) {
-
-		reset_seq();
-
-		/* Read the file name from the client. */
-
-		memset(&cliaddr, 0, sizeof(struct sockaddr));
-		cliaddr_len = sizeof(cliaddr);
-		n = arq_recvfrom(sockfd, rbuf, MAXDATA, 0,
-				&cliaddr, &cliaddr_len);
-		if (-1 == n) {
-			if (errno == EINTR) {
-				exit(EXIT_SUCCESS);
-			} else {
-				perror("arq_recvfrom");
-				exit(EXIT_FAILURE);
-			}
-		}
-
-		/* Read the data file and send it to the client */
-
-		infile = rbuf;
-		infd = open(infile, O_RDONLY);
-		if (-1 == infd) {
-			arq_sendto(sockfd, "HTTP/1.0 404 Not Found\r\n", 24, 0,
-					&cliaddr, cliaddr_len);
-			arq_sendto(sockfd, NULL, 0, 0, &cliaddr, cliaddr_len);
-			continue;
-		}
-
-		while ( (n = read(infd, &sbuf, MAXDATA))) {
-			if (quit)
-				break;
-
-			if (-1 == n) {
-				perror("read");
-				exit(EXIT_FAILURE);
-			}
-
-			left = n;
-			i = 0;
-			while (left) {
-				n = arq_sendto(sockfd, &sbuf + i, left, 0,
-						&cliaddr, cliaddr_len);
-				if (-1 == n) {
-					perror("arq_sendto");
-					exit(EXIT_FAILURE);
-				}
-				left -= n;
-				i += n;
-			}
+	/* the other workers on the ports after it */
+	socks[0] = sockfd;
+	for (i = 1; i < jobs; i++) {
+		sin.sin_port = htons(ntohs(sin.sin_port) + 1);
+		socks[i] = port_open(&sin, sock_buf);
+		if (-1 == socks[i]) {
+			fprintf(stderr, "unable to bind port %u: %s\n",
+					ntohs(sin.sin_port), strerror(errno));
+			exit(EXIT_FAILURE);
 		}
+	}
 
-		close(infd);
-
-		/* Send a zero length packet to signal EOF */
-
-		n = arq_sendto(sockfd, &sbuf, 0, 0, &cliaddr, cliaddr_len);
-		if (-1 == n) {
-			perror("arq_sendto, EOF");
+	/* only the first worker is interrupted, the rest end with it */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	for (i = 1; i < jobs; i++) {
+		errno = pthread_create(&tid, NULL, worker, &socks[i]);
+		if (errno) {
+			perror("pthread_create");
 			exit(EXIT_FAILURE);
 		}
+		pthread_detach(tid);
 	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	worker(&socks[0]);
 
 	/* Cleanup and exit */
 
-	if (sockfd > 0)
-		close(sockfd);
+	if (trace)
+		fclose(trace);
+	if (evtrace)
+		fclose(evtrace);
+
+	for (i = 0; i < jobs; i++)
+		close(socks[i]);
 
 	if (res)
 		freeaddrinfo(res);
@@ -0,0 +1,75 @@
+/*
+ * snw.h
+ *
+ * The requests of the snw-client and the replies of the snw-server.
+ *
+ * A request is the name of the file and its '\0', followed by where
+ * to resume a transfer of it that was cut short: the offset, and the
+ * size and modification time the file had then (or -1).
+ *
+ *   "data\0" "1048576 5242880 1444000000"
+ *
+ * The reply then starts with a packet of its own with the offset the
+ * data really starts from, 0 unless the file is still the same, and
+ * the size and modification time it has now.  The data follows.  A
+ * request of only the name gets only the data, from the start.
+ *
+ * A striped client (-j) asks for a range instead, with where it ends
+ * after the rest.  It first asks for nothing (an end of 0) to learn
+ * the size, and then for each range from its own port of the server.
+ *
+ *   "data\0" "1048576 5242880 1444000000 2097152"
+ *
+ * The reply to a range adds how many workers (-j) the server has, so
+ * a client can tell it asked for more stripes than there are ports.
+ *
+ *   "1048576 5242880 1444000000 4"
+ *
+ * A request with an empty name is for a manifest instead, the names
+ * of files and directories that follow, each with its '\0', up to
+ * an empty one.  It may take more than one packet.
+ *
+ *   "\0" "data\0" "photos\0" "\0"
+ *
+ * Every file, and every one under a directory, is then sent in one
+ * stream: a header with its size, modification time, mode (in octal)
+ * and path, and its '\0', then its data.  The next header follows at
+ * once, in the same packet, so small files are sent back to back.  A
+ * file that can not be sent has a size of -1 and no data.  The EOF
+ * ends the stream.
+ *
+ *   "11 1444000000 644 data\0" "hello world" "-1 0 0 photos/x\0" ...
+ *
+ * Author:
+ *
+ *   Jeremiah Mahler <jmmahler@gmail.com>
+ *
+ * Copyright:
+ *
+ * Copyright &copy; 2015, Jeremiah Mahler.  All Rights Reserved.
+ * This project is free software and released under
+ * the GNU General Public License.
+ */
+
+#ifndef _SNW_H
+#define _SNW_H
+
+/* offset, size and mtime, as long long */
+#define SNW_RESUME "%lld %lld %lld"
+
+/* and the end, as long long */
+#define SNW_RANGE SNW_RESUME " %lld"
+
+/* the reply to a range, and the workers of the server, as int */
+#define SNW_WORKERS SNW_RESUME " %d"
+
+/* the header of a file in a manifest, the path comes after it */
+#define SNW_ENTRY "%lld %lld %o "
+
+/* the most a manifest request may be */
+#define MANIFEST_MAX (1024 * 1024)
+
+/* most stripes of a transfer (-j), each from a port of its own */
+#define MAX_JOBS 64
+
+#endif /* _SNW_H */
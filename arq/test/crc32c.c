@@ -0,0 +1,108 @@
+/*
+ * crc32c.c
+ *
+ * Check arq_crc32c() against the check value of CRC32C and against
+ * a CRC done one bit at a time, for every length around the three
+ * parts the SSE4.2 code does at once and for calls that continue
+ * one another.  arq_crc.c is included, so the tables (crc_sw()) are
+ * checked too even where the CPU has SSE4.2.
+ *
+ *   ./crc32c
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arq_crc.c"
+
+#define BUF_LEN (4 * 3 * CRC_PART + 64)
+
+/* the CRC of "123456789" */
+#define CRC_CHECK 0xe3069283
+
+/* one bit at a time, straight from the polynomial */
+static uint32_t crc_bits(uint32_t crc, const unsigned char *p, size_t len) {
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (CRC_POLY & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+/* every way of working it out, 0 if they all agree with 'want' */
+static int crc_check(uint32_t crc, const unsigned char *p, size_t len,
+		uint32_t want) {
+	uint32_t got;
+	int bad = 0;
+
+	got = arq_crc32c(crc, p, len);
+	if (got != want) {
+		fprintf(stderr, "arq_crc32c, %zu bytes: %08x, not %08x\n",
+				len, got, want);
+		bad = 1;
+	}
+
+	got = ~crc_sw(~crc, p, len);
+	if (got != want) {
+		fprintf(stderr, "crc_sw, %zu bytes: %08x, not %08x\n",
+				len, got, want);
+		bad = 1;
+	}
+
+#ifdef CRC_X86
+	if (has_sse42) {
+		got = ~crc_sse42(~crc, p, len);
+		if (got != want) {
+			fprintf(stderr, "crc_sse42, %zu bytes: %08x,"
+					" not %08x\n", len, got, want);
+			bad = 1;
+		}
+	}
+#endif
+
+	return bad;
+}
+
+int main() {
+	static unsigned char buf[BUF_LEN];
+	uint32_t whole, crc;
+	size_t len, off, k;
+	int bad = 0;
+
+	for (k = 0; k < BUF_LEN; k++)
+		buf[k] = rand();
+
+	/* the tables are made on the first call */
+	bad |= crc_check(0, (const unsigned char *) "123456789", 9,
+			CRC_CHECK);
+
+	/* every length, and at every alignment */
+	for (off = 0; off < 8; off++)
+		for (len = 0; off + len <= BUF_LEN; len++)
+			bad |= crc_check(0, buf + off, len,
+					crc_bits(0, buf + off, len));
+
+	/* continued from any point, also from the middle of a part */
+	len = 2 * 3 * CRC_PART + 5;
+	whole = crc_bits(0, buf, len);
+	for (k = 0; k <= len; k++) {
+		crc = crc_bits(0, buf, k);
+		bad |= crc_check(crc, buf + k, len - k, whole);
+	}
+
+	if (bad)
+		exit(1);
+
+#ifdef CRC_X86
+	if (!has_sse42)
+		fprintf(stderr, "no SSE4.2, only the tables checked\n");
+#endif
+
+	return 0;
+}
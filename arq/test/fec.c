@@ -0,0 +1,168 @@
+/*
+ * fec.c
+ *
+ * Code blocks of k data packets into m parity packets as a sender
+ * does (arq_fec_coef(), arq_fec_mul_add()), drop up to m of the k + m
+ * packets at random and rebuild the lost data from the parity that
+ * is left as a receiver does (arq_fec_invert()).  It must come back
+ * exactly.  Also check which k and m arq_session_set_fec() takes,
+ * k 0 and m 0 included, which is FEC off.
+ *
+ *   ./fec
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arq.h"
+
+#define LEN 100
+#define TRIES 500
+
+static unsigned char data[FEC_MAX_K][LEN];
+static unsigned char parity[FEC_MAX_M][LEN];
+
+/*
+ * decode()
+ *
+ * Drop 'e' of the 'k' + 'm' packets of a block and rebuild them.
+ *
+ * Returns: 0 if the data came back as it was, -1 if not.
+ */
+static int decode(int k, int m, int e) {
+	static unsigned char got[FEC_MAX_K][LEN];
+	unsigned char a[FEC_MAX_M * FEC_MAX_M];
+	unsigned char sym[FEC_MAX_M][LEN];
+	int lost[FEC_MAX_M], par[FEC_MAX_M];
+	char gone[FEC_MAX_K + FEC_MAX_M];
+	int nlost = 0, npar = 0;
+	int i, j, r, t;
+
+	memset(gone, 0, sizeof(gone));
+	for (i = 0; i < e; ) {
+		j = rand() % (k + m);
+		if (!gone[j]) {
+			gone[j] = 1;
+			i++;
+		}
+	}
+
+	for (i = 0; i < k; i++) {
+		memcpy(got[i], data[i], LEN);
+		if (gone[i]) {
+			memset(got[i], 0, LEN);
+			lost[nlost++] = i;
+		}
+	}
+	for (j = 0; j < m && npar < nlost; j++)
+		if (!gone[k + j])
+			par[npar++] = j;
+	if (npar < nlost) {
+		fprintf(stderr, "%d:%d, %d lost: %d parity left\n", k, m,
+				nlost, npar);
+		return -1;
+	}
+	if (0 == nlost)
+		return 0;
+
+	/* what is left of the parity without the data that is here */
+	for (t = 0; t < nlost; t++) {
+		memcpy(sym[t], parity[par[t]], LEN);
+		for (i = 0; i < k; i++)
+			if (!gone[i])
+				arq_fec_mul_add(sym[t], data[i],
+						arq_fec_coef(par[t], i), LEN);
+		for (r = 0; r < nlost; r++)
+			a[t * nlost + r] = arq_fec_coef(par[t], lost[r]);
+	}
+
+	if (-1 == arq_fec_invert(a, nlost)) {
+		fprintf(stderr, "%d:%d, %d lost: no inverse\n", k, m, nlost);
+		return -1;
+	}
+
+	for (r = 0; r < nlost; r++) {
+		for (t = 0; t < nlost; t++)
+			arq_fec_mul_add(got[lost[r]], sym[t],
+					a[r * nlost + t], LEN);
+		if (memcmp(got[lost[r]], data[lost[r]], LEN)) {
+			fprintf(stderr, "%d:%d, %d lost: packet %d is wrong\n",
+					k, m, nlost, lost[r]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* code blocks of 'k' and 'm' and take them apart again */
+static int code(int k, int m) {
+	int i, j, n;
+
+	for (n = 0; n < TRIES; n++) {
+		for (i = 0; i < k; i++)
+			for (j = 0; j < LEN; j++)
+				data[i][j] = rand();
+
+		memset(parity, 0, sizeof(parity));
+		for (j = 0; j < m; j++)
+			for (i = 0; i < k; i++)
+				arq_fec_mul_add(parity[j], data[i],
+						arq_fec_coef(j, i), LEN);
+
+		/* parity 0 is a plain XOR */
+		for (i = 0; i < k; i++)
+			if (1 != arq_fec_coef(0, i))
+				return -1;
+
+		if (-1 == decode(k, m, rand() % (m + 1)))
+			return -1;
+	}
+
+	return 0;
+}
+
+int main() {
+	static const int km[][2] = {
+		{ 1, 1 }, { 8, 1 }, { 4, 2 }, { 16, 4 }, { 32, 16 },
+		{ FEC_MAX_K, 1 }, { FEC_MAX_K, FEC_MAX_M }
+	};
+	static const int bad[][2] = {
+		{ -1, 1 }, { 4, 0 }, { 4, FEC_MAX_M + 1 },
+		{ FEC_MAX_K + 1, 1 }, { 0, -1 }
+	};
+	struct arq_session *sess;
+	size_t i;
+
+	for (i = 0; i < sizeof(km) / sizeof(km[0]); i++)
+		if (-1 == code(km[i][0], km[i][1]))
+			exit(1);
+
+	/* FEC off, as k 0 and m 0 or with any m */
+	sess = arq_session_new(-1, NULL, 0);
+	if (NULL == sess) {
+		perror("arq_session_new");
+		exit(1);
+	}
+	if (-1 == arq_session_set_fec(sess, 0, 0)
+			|| -1 == arq_session_set_fec(sess, 0, 1)
+			|| -1 == arq_session_set_fec(sess, 8, 2)
+			|| -1 == arq_session_set_fec(sess, 0, 0)) {
+		perror("arq_session_set_fec");
+		exit(1);
+	}
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		if (-1 != arq_session_set_fec(sess, bad[i][0], bad[i][1])
+				|| EINVAL != errno) {
+			fprintf(stderr, "arq_session_set_fec(%d, %d) taken\n",
+					bad[i][0], bad[i][1]);
+			exit(1);
+		}
+	}
+	arq_session_free(sess);
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * output_hook.c
+ *
+ * Pass a transfer between two sessions created with an fd of -1,
+ * through a queue in memory that their outputs write to
+ * (arq_session_set_output()).  It is run three times:
+ *
+ *   - with room for every datagram, the data must arrive as sent
+ *   - with room for only a few, so most of a batch is dropped as on
+ *     EAGAIN, and the dropped ones must be re-sent
+ *   - with ARQ_GSO, where each run must come with its UDP_SEGMENT
+ *     cmsg, or it is taken as one datagram and the data is lost
+ *
+ *   ./output_hook
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arq.h"
+
+#define DATA_LEN (256 * 1024)
+
+/* datagrams a queue can hold, and the most of one */
+#define QUEUE_MAX 256
+#define DGRAM_MAX 2048
+
+/* most seconds for a transfer */
+#define TIME_MAX 10
+
+/* datagrams on their way to one session, from the other */
+struct queue {
+	char buf[QUEUE_MAX][DGRAM_MAX];
+	size_t len[QUEUE_MAX];
+	unsigned int head;
+	unsigned int count;
+	unsigned int room;		/* the rest are dropped */
+	struct sockaddr_in from;
+	unsigned long dropped;
+	unsigned long gso;		/* datagrams with UDP_SEGMENT */
+};
+
+static struct queue to_srv, to_cli;
+
+/* the datagrams of a session, cut into segments and queued */
+static int output(void *arg, struct mmsghdr *msgs, unsigned int n) {
+	struct queue *q = arg;
+	struct cmsghdr *cmsg;
+	struct iovec *iov;
+	char dgram[65536];
+	size_t len, off, seg;
+	uint16_t gso;
+	unsigned int i, t;
+	size_t j;
+
+	for (i = 0; i < n; i++) {
+		len = 0;
+		for (j = 0; j < msgs[i].msg_hdr.msg_iovlen; j++) {
+			iov = &msgs[i].msg_hdr.msg_iov[j];
+			memcpy(dgram + len, iov->iov_base, iov->iov_len);
+			len += iov->iov_len;
+		}
+
+		seg = len;
+		if (msgs[i].msg_hdr.msg_control) {
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+					cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr,
+						cmsg)) {
+				if (SOL_UDP == cmsg->cmsg_level && UDP_SEGMENT
+						== cmsg->cmsg_type) {
+					memcpy(&gso, CMSG_DATA(cmsg),
+							sizeof(gso));
+					seg = gso;
+					q->gso++;
+				}
+			}
+		}
+
+		/* as the kernel would split it */
+		for (off = 0; off < len; off += seg) {
+			if (q->count == q->room || MIN(seg, len - off)
+					> DGRAM_MAX) {
+				q->dropped++;
+				continue;
+			}
+			t = (q->head + q->count) % QUEUE_MAX;
+			q->len[t] = MIN(seg, len - off);
+			memcpy(q->buf[t], dgram + off, q->len[t]);
+			q->count++;
+		}
+	}
+
+	return n;
+}
+
+/* hand everything queued for 's' to it */
+static int deliver(struct arq_session *s, struct queue *q) {
+	int moved = q->count > 0;
+
+	while (q->count) {
+		if (-1 == arq_session_input(s, q->buf[q->head],
+				q->len[q->head],
+				(struct sockaddr *) &q->from,
+				sizeof(q->from)))
+			return -1;
+		q->head = (q->head + 1) % QUEUE_MAX;
+		q->count--;
+	}
+
+	return moved;
+}
+
+/* wait for the earlier deadline of 'a' and 'b', then expire both */
+static int expire(struct arq_session *a, struct arq_session *b) {
+	struct timespec ts, tb;
+	int has_a, has_b;
+
+	has_a = arq_session_deadline(a, &ts);
+	has_b = arq_session_deadline(b, &tb);
+	if (!has_a && !has_b)
+		return 0;
+	if (!has_a || (has_b && (tb.tv_sec < ts.tv_sec
+				|| (tb.tv_sec == ts.tv_sec
+					&& tb.tv_nsec < ts.tv_nsec))))
+		ts = tb;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+	if (-1 == arq_session_expire(a) || -1 == arq_session_expire(b))
+		return -1;
+
+	return 0;
+}
+
+static struct arq_session *session(const struct sockaddr_in *peer,
+		struct queue *q, int room, int offload) {
+	struct arq_session *s;
+
+	s = arq_session_new(-1, (struct sockaddr *) peer,
+			peer ? sizeof(*peer) : 0);
+	if (NULL == s)
+		return NULL;
+
+	q->head = q->count = 0;
+	q->room = room;
+	q->dropped = q->gso = 0;
+	arq_session_set_output(s, output, q);
+	if (-1 == arq_session_set_window(s, 64)
+			|| -1 == arq_session_set_batch(s, 16)
+			|| -1 == arq_session_set_timeout(s, 5)
+			|| -1 == arq_session_set_offload(s, offload)) {
+		arq_session_free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+/*
+ * transfer()
+ *
+ * Send DATA_LEN bytes and an EOF from a client session to a server
+ * session, with 'room' datagrams in each queue.
+ *
+ * Returns: 0 if all of it arrived as sent, -1 if not.
+ */
+static int transfer(const char *name, int room, int offload,
+		struct arq_stats *st) {
+	static char data[DATA_LEN], got[DATA_LEN + MAXDATA];
+	struct arq_session *cli, *srv;
+	size_t sent = 0, recvd = 0;
+	int eof_sent = 0, eof = 0;
+	time_t start;
+	int moved;
+	int n;
+
+	for (n = 0; n < DATA_LEN; n++)
+		data[n] = rand();
+
+	/* each queue is from the other end */
+	to_srv.from.sin_family = to_cli.from.sin_family = AF_INET;
+	to_srv.from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	to_cli.from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	to_srv.from.sin_port = htons(2);
+	to_cli.from.sin_port = htons(1);
+
+	srv = session(NULL, &to_cli, room, offload);
+	cli = session(&to_cli.from, &to_srv, room, offload);
+	if (NULL == srv || NULL == cli) {
+		perror("session");
+		exit(1);
+	}
+
+	start = time(NULL);
+	while (!eof && time(NULL) - start < TIME_MAX) {
+		while (sent < DATA_LEN) {
+			n = arq_session_send(cli, data + sent,
+					MIN(MAXDATA, DATA_LEN - sent),
+					MSG_DONTWAIT);
+			if (-1 == n && EAGAIN == errno)
+				break;
+			if (-1 == n)
+				goto fail;
+			sent += n;
+		}
+		if (DATA_LEN == sent && !eof_sent) {
+			n = arq_session_send(cli, "", 0, MSG_DONTWAIT);
+			if (-1 == n && EAGAIN != errno)
+				goto fail;
+			eof_sent = (0 == n);
+		}
+		if (-1 == arq_session_flush(cli))
+			goto fail;
+
+		moved = deliver(srv, &to_srv);
+		if (-1 == moved)
+			goto fail;
+		while (!eof) {
+			n = arq_session_recv(srv, got + recvd,
+					sizeof(got) - recvd, MSG_DONTWAIT);
+			if (-1 == n && EAGAIN == errno)
+				break;
+			if (-1 == n)
+				goto fail;
+			eof = (0 == n);
+			recvd += n;
+		}
+		if (-1 == arq_session_flush(srv))
+			goto fail;
+
+		n = deliver(cli, &to_cli);
+		if (-1 == n)
+			goto fail;
+
+		/* nothing is on its way, only a timer can go on */
+		if (!moved && !n && -1 == expire(cli, srv))
+			goto fail;
+	}
+
+	arq_session_stats(cli, st);
+	arq_session_free(cli);
+	arq_session_free(srv);
+
+	if (!eof || DATA_LEN != recvd || memcmp(data, got, DATA_LEN)) {
+		fprintf(stderr, "%s: %zu of %d bytes%s\n", name, recvd,
+				DATA_LEN, eof ? ", not as sent" : "");
+		return -1;
+	}
+
+	return 0;
+
+fail:
+	perror(name);
+	exit(1);
+}
+
+int main() {
+	struct arq_stats st;
+
+	if (-1 == transfer("fd -1", QUEUE_MAX, 0, &st))
+		exit(1);
+	if (to_srv.dropped || to_cli.dropped) {
+		fprintf(stderr, "fd -1: %lu dropped\n",
+				to_srv.dropped + to_cli.dropped);
+		exit(1);
+	}
+
+	if (-1 == transfer("dropped", 8, 0, &st))
+		exit(1);
+	if (0 == to_srv.dropped || 0 == st.packets_resent) {
+		fprintf(stderr, "dropped: %lu dropped, %lu re-sent\n",
+				to_srv.dropped, st.packets_resent);
+		exit(1);
+	}
+
+	if (-1 == transfer("gso", QUEUE_MAX, ARQ_GSO, &st))
+		exit(1);
+	if (0 == to_srv.gso) {
+		fprintf(stderr, "gso: no UDP_SEGMENT\n");
+		exit(1);
+	}
+
+	return 0;
+}
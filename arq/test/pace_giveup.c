@@ -0,0 +1,119 @@
+/*
+ * pace_giveup.c
+ *
+ * Send to a peer that never ACKs, with pacing so slow that the
+ * newest packet is still held when the sender gives up on the
+ * oldest.  The packet that is taken back must not be counted as
+ * held any more, or the next flush starts before it and sends the
+ * wrong slots.
+ *
+ *   ./pace_giveup
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arq.h"
+
+#define TRIES 10
+
+int main() {
+	struct arq_session *sess;
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	struct arq_packet pkt;
+	char buf[ARQ_MAX_MSS];
+	int sockfd, peerfd;
+	int sent = 0, bad = 0;
+	int i, n, mss;
+
+	/* nothing lost, just never ACKed */
+	setenv("UNRELIABLE_LOSS", "0", 1);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	peerfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (-1 == sockfd || -1 == peerfd
+			|| -1 == bind(peerfd, (struct sockaddr *) &sin, len)
+			|| -1 == getsockname(peerfd, (struct sockaddr *) &sin,
+				&len)) {
+		perror("socket");
+		exit(1);
+	}
+
+	sess = arq_session_new(sockfd, (struct sockaddr *) &sin, len);
+	if (NULL == sess) {
+		perror("arq_session_new");
+		exit(1);
+	}
+
+	/*
+	 * The first packet goes at once, every one after that half a
+	 * second apart.  With a timeout of 1 ms a give up takes less
+	 * than 100 ms, so the second is given up on several times while
+	 * it is still held.
+	 */
+	mss = arq_session_mss(sess);
+	if (-1 == arq_session_set_window(sess, 2)
+			|| -1 == arq_session_set_pacing(sess,
+				2 * (HEADER_SZ + mss))) {
+		perror("arq_session_set");
+		exit(1);
+	}
+
+	memset(buf, 'A', mss);
+	n = arq_session_send(sess, buf, mss, 0);
+	if (n != mss) {
+		fprintf(stderr, "packet 0: %d\n", n);
+		exit(1);
+	}
+
+	/* given up on while it is held, and after pacing lets it go */
+	memset(buf, 'B', mss);
+	for (i = 0; i < TRIES; i++) {
+		/* without the resends that doubled it */
+		arq_session_set_timeout(sess, 1);
+		n = arq_session_send(sess, buf, mss, 0);
+		if (0 != n) {
+			fprintf(stderr, "packet 1: %d\n", n);
+			exit(1);
+		}
+	}
+
+	if (1 != arq_session_pending(sess)) {
+		fprintf(stderr, "pending: %d\n", arq_session_pending(sess));
+		exit(1);
+	}
+
+	/* only the two packets, each with its own data */
+	while ((n = recv(peerfd, &pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+		if (TYPE_DATA != pkt.type)
+			continue;
+		if (0 == ntohs(pkt.seq) && 'A' == pkt.data[0])
+			continue;
+		if (1 == ntohs(pkt.seq) && 'B' == pkt.data[0])
+			sent++;
+		else
+			bad++;
+	}
+
+	arq_session_free(sess);
+	close(sockfd);
+	close(peerfd);
+
+	if (bad || 0 == sent) {
+		fprintf(stderr, "%d wrong packets, the second sent %d times\n",
+				bad, sent);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * wheel.c
+ *
+ * Add, cancel and expire timers in a timing wheel (arq_timer.c) at
+ * random, at every level, and compare it with a plain list of when
+ * each one is due.  No timer may expire early, late or not at all,
+ * arq_wheel_next() may never be later than the first one, and timers
+ * cancelled while they are still in a higher level must not come
+ * back when their slot cascades.
+ *
+ *   ./wheel [seed]
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arq.h"
+
+#define TIMERS 512
+#define STEPS 200000
+
+/* the most ticks ahead a timer can be */
+#define SPAN ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define NONE UINT64_MAX
+
+static struct arq_wheel w;
+static struct arq_timer timers[TIMERS];
+static uint64_t due[TIMERS];	/* tick, or NONE if it is not in the wheel */
+static int high[TIMERS];	/* added above level 0 */
+static unsigned long cascaded;	/* of those, expired */
+static unsigned int seed = 1;
+
+static void fail(const char *what, int i) {
+	fprintf(stderr, "seed %u, tick %llu: %s", seed,
+			(unsigned long long) w.now, what);
+	if (i >= 0)
+		fprintf(stderr, ", timer %d due at %llu", i,
+				(unsigned long long) due[i]);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static uint64_t rand64(void) {
+	return (uint64_t) rand() << 31 ^ rand();
+}
+
+/* ticks ahead, as often on each level as on the next */
+static uint64_t ahead(void) {
+	int level = rand() % (WHEEL_LEVELS + 1);
+
+	return rand64() % ((uint64_t) 1 << (WHEEL_BITS * level));
+}
+
+/* the first tick a timer is due, or NONE */
+static uint64_t first(void) {
+	uint64_t min = NONE;
+	int i;
+
+	for (i = 0; i < TIMERS; i++)
+		if (due[i] < min)
+			min = due[i];
+
+	return min;
+}
+
+/* move the wheel on to 'now', the timers due by then must come out */
+static void expire(uint64_t now) {
+	struct arq_timer *t;
+	uint64_t from = w.now;
+	int i;
+
+	for (t = arq_wheel_expire(&w, now); t; t = t->next) {
+		i = t - timers;
+		if (NONE == due[i])
+			fail("expired when it was not in the wheel", i);
+		if (due[i] > now)
+			fail("expired early", i);
+		if (due[i] < from)
+			fail("expired late", i);
+		if (NULL != t->pprev)
+			fail("expired but still in the wheel", i);
+		cascaded += high[i];
+		due[i] = NONE;
+	}
+
+	for (i = 0; i < TIMERS; i++)
+		if (due[i] <= now)
+			fail("did not expire", i);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t tick, when, min;
+	unsigned long high_dels = 0;
+	int i, step, count;
+
+	if (argc > 1)
+		seed = atoi(argv[1]);
+	srand(seed);
+
+	/* not at a tick that the higher levels start at */
+	arq_wheel_init(&w, rand64() % (SPAN * 16));
+	for (i = 0; i < TIMERS; i++)
+		due[i] = NONE;
+
+	for (step = 0; step < STEPS; step++) {
+		i = rand() % TIMERS;
+
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			/* as added, in the past or too far ahead */
+			when = w.now + ahead();
+			if (0 == rand() % 16)
+				when = w.now - rand() % 100;
+			arq_timer_add(&w, &timers[i], when);
+			high[i] = (timers[i].slot >= WHEEL_SIZE);
+			if (when < w.now)
+				when = w.now;
+			if (when >= w.now + SPAN)
+				when = w.now + SPAN - 1;
+			due[i] = when;
+			break;
+		case 2:
+			if (NONE != due[i]
+					&& timers[i].slot >= WHEEL_SIZE)
+				high_dels++;
+			arq_timer_del(&w, &timers[i]);
+			due[i] = NONE;
+			break;
+		case 3:
+			min = first();
+			if (!arq_wheel_next(&w, &tick)) {
+				if (NONE != min)
+					fail("no next tick", -1);
+				break;
+			}
+			if (tick > min)
+				fail("next tick after the first timer", -1);
+			if (tick < w.now)
+				fail("next tick already past", -1);
+
+			/* to the next tick, or on past some */
+			if (rand() % 2)
+				tick += ahead();
+			expire(tick);
+			break;
+		}
+
+		for (count = 0, i = 0; i < TIMERS; i++)
+			count += (NONE != due[i]);
+		if ((unsigned int) count != w.count)
+			fail("count is wrong", -1);
+	}
+
+	/* the rest, one next tick at a time */
+	while (arq_wheel_next(&w, &tick))
+		expire(tick);
+	if (NONE != first())
+		fail("timers left over", -1);
+
+	/* or the test did not reach what it is for */
+	if (0 == high_dels || 0 == cascaded) {
+		fprintf(stderr, "%lu cancelled from a higher level,"
+				" %lu cascaded\n", high_dels, cascaded);
+		exit(1);
+	}
+
+	return 0;
+}
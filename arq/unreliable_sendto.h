@@ -1,11 +1,99 @@
+/*
+ * unreliable_sendto.h
+ *
+ * A model of an unreliable network channel.  Packets sent with
+ * unreliable_sendto() can be lost, delayed, duplicated, reordered
+ * and corrupted.  The random choices come from a seeded generator so
+ * the same settings give the same result every time.
+ *
+ * With no settings the original fixed pattern is used, 1/4 of the
+ * packets are lost in bursts of 2.  The channel can be set from the
+ * environment,
+ *
+ *   UNRELIABLE_SEED=n             seed of the random generator (1)
+ *   UNRELIABLE_LOSS=p             lose each packet with probability p
+ *   UNRELIABLE_GE=p,r[,h[,k]]     Gilbert-Elliott burst loss, go from
+ *                                 the good to the bad state with
+ *                                 probability p and back with r, lose
+ *                                 packets with probability h in the bad
+ *                                 state (1) and k in the good state (0)
+ *   UNRELIABLE_DELAY=ms[,jitter]  delay every packet by ms, plus or
+ *                                 minus up to jitter ms
+ *   UNRELIABLE_DUP=p              send a packet twice with probability p
+ *   UNRELIABLE_REORDER=p[,ms]     hold a packet back by ms (1) more
+ *                                 with probability p
+ *   UNRELIABLE_CORRUPT=p          flip a random bit of a packet with
+ *                                 probability p
+ *   UNRELIABLE_LIMIT=n            most packets being delayed at once,
+ *                                 more are lost (1000)
+ *
+ *   UNRELIABLE_LOSS=0.001 UNRELIABLE_DELAY=5,1 ./snw-server
+ *
+ * or with unreliable_set_channel().  Setting a loss model (even a
+ * loss of 0) turns the fixed pattern off.
+ *
+ * Delayed packets are sent from a thread at their time.
+ */
+
+#ifndef _UNRELIABLE_SENDTO_H
+#define _UNRELIABLE_SENDTO_H
 
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #define MAX_PACKET_DATA_SIZE (1300)
 
+struct unreliable_channel {
+	unsigned long seed;
+	int periodic;		/* the original 1/4 loss, bursts of 2 */
+
+	double loss;		/* Bernoulli loss probability */
+
+	double ge_p;		/* Gilbert-Elliott, good -> bad */
+	double ge_r;		/*   bad -> good */
+	double ge_loss_bad;
+	double ge_loss_good;
+
+	double delay_ms;
+	double jitter_ms;
+	double dup;
+	double reorder;
+	double reorder_ms;
+	double corrupt;		/* flip a bit */
+	int limit;		/* most packets in the delay queue */
+};
+
 /* Works just like sendto(2) except it is grossly unreliable and
  * randomly drops packets.
  */
 ssize_t unreliable_sendto(int sockfd, const void *buf, size_t len, int flags,
 		const struct sockaddr *dest_addr, socklen_t addrlen);
+
+struct mmsghdr;
+
+/* Works just like sendmmsg(2), sending a batch of datagrams with
+ * one system call, but drops packets the same as unreliable_sendto().
+ * The dropped packets are reported as sent.  A datagram for UDP GSO
+ * (with a UDP_SEGMENT cmsg) is sent as its separate segments when
+ * the channel does anything to packets, and whole when it does not.
+ */
+int unreliable_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+		int flags);
+
+/* Is the channel one that does nothing to packets?  Then they can
+ * just as well be sent some other way.
+ */
+int unreliable_transparent();
+
+/* Get the channel model, as set from the environment if it has
+ * not been set otherwise.
+ */
+void unreliable_get_channel(struct unreliable_channel *ch);
+
+/* Replace the channel model and restart the random generator from
+ * its seed.  Returns 0 on success, -1 with errno EINVAL if a
+ * probability is not between 0 and 1 or a delay is negative.
+ */
+int unreliable_set_channel(const struct unreliable_channel *ch);
+
+#endif /* _UNRELIABLE_SENDTO_H */